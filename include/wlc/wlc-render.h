@@ -21,6 +21,12 @@ extern "C" {
 /** Allowed pixel formats. */
 enum wlc_pixel_format {
    WLC_RGBA8888,
+
+   /** Bytes in B, G, R, A order. Native layout of the renderers, read without swizzling when possible. */
+   WLC_BGRA8888,
+
+   /** Same layout as WLC_BGRA8888 with undefined alpha, matches WL_SHM_FORMAT_XRGB8888 and DRM_FORMAT_XRGB8888. */
+   WLC_XRGB8888,
 };
 
 /**
@@ -36,12 +42,57 @@ WLC_NONULL void wlc_pixels_write(enum wlc_pixel_format format, const struct wlc_
  */
 WLC_NONULL void wlc_pixels_read(enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data);
 
+/**
+ * Reads pixel data of the output's framebuffer asynchronously, without stalling rendering.
+ * Pixels are those of the next frame rendered on the output, a repaint is scheduled for it.
+ * Geometry is in framebuffer pixels with origin at top left, it will be clamped to the framebuffer.
+ * Callback is called from the event loop once the data is available, geometry holds the clamped area.
+ * Data is only valid during the callback, rows go downwards from it and are stride bytes apart.
+ * Stride is negative when the framebuffer is stored bottom up, data then points to the top row still.
+ * Data is NULL if the readback failed or was canceled, for example when the output was destroyed.
+ * Returns false if the readback could not be queued.
+ */
+WLC_NONULLV(3,4) bool wlc_output_read_pixels(wlc_handle output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg), void *arg);
+
+/**
+ * Gets whole framebuffer of the next frame of output as tightly packed top down WLC_RGBA8888 rows.
+ * Data is only valid during the callback and NULL if reading failed. Return true from it to keep receiving the following frames.
+ */
+WLC_NONULLV(2) void wlc_output_get_pixels(wlc_handle output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg);
+
+/** Maximum number of planes of an exported dmabuf. */
+#define WLC_DMABUF_MAX_PLANES 4
+
+/** Output frame exported as dmabuf, see wlc_output_export_dmabuf(). */
+struct wlc_dmabuf_attributes {
+   struct wlc_size size;
+   uint32_t format; // DRM fourcc
+   uint64_t modifier;
+   uint32_t num_planes;
+   int32_t fd[WLC_DMABUF_MAX_PLANES];
+   uint32_t offset[WLC_DMABUF_MAX_PLANES];
+   uint32_t stride[WLC_DMABUF_MAX_PLANES];
+   bool y_invert; // first row in memory is the bottom of the frame
+};
+
+/**
+ * Exports the next frame of output as dmabuf, without copying it through system memory.
+ * The frame is copied on the GPU into one of a few buffers owned by the renderer, which are reused in turn.
+ * Callback is called from the event loop once the frame has been presented.
+ * Attributes and their fds are only valid during the callback, dup the fds to keep them.
+ * Fence is a sync_file fd that signals when the copy is complete, or -1 if the copy is known to be complete.
+ * It's closed after the callback, dup it to keep it. Attributes are NULL if the export failed or was canceled.
+ * Returns false if the export could not be queued, for example when the renderer can't export buffers.
+ */
+WLC_NONULLV(2) bool wlc_output_export_dmabuf(wlc_handle output, void (*done)(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg), void *arg);
+
 /** Renders surface. */
 WLC_NONULL void wlc_surface_render(wlc_resource surface, const struct wlc_geometry *geometry);
 
 /**
  * Schedules output for rendering next frame. If output was already scheduled this is no-op,
  * if output is currently rendering, it will render immediately after.
+ * The whole output is repainted, as wlc can't know what you are going to draw.
  */
 void wlc_output_schedule_render(wlc_handle output);
 
@@ -53,10 +104,14 @@ void wlc_output_schedule_render(wlc_handle output);
  */
 void wlc_surface_flush_frame_callbacks(wlc_resource surface);
 
-/** Enabled renderers */
+/**
+ * Enabled renderers, new values are appended to keep the existing ones.
+ * WLC_RENDERER_GLES2 is reported for GLES3 contexts as well, textures and GL state work the same.
+ */
 enum wlc_renderer {
     WLC_RENDERER_GLES2,
-    WLC_NO_RENDERER
+    WLC_NO_RENDERER,
+    WLC_RENDERER_PIXMAN
 };
 
 /** Returns currently active renderer on the given output */
@@ -28,6 +28,7 @@ enum wlc_backend_type {
    WLC_BACKEND_NONE,
    WLC_BACKEND_DRM,
    WLC_BACKEND_X11,
+   WLC_BACKEND_HEADLESS,
 };
 
 /** mask in wlc_event_loop_add_fd(); */
@@ -127,6 +128,20 @@ struct wlc_modifiers {
    uint32_t leds, mods;
 };
 
+/** Distribution of frame timing in wlc_output_frame_stats, in nanoseconds. */
+struct wlc_frame_timing {
+   uint64_t min, median, p90, p99, max;
+};
+
+/** wlc_output_get_frame_stats(); */
+struct wlc_output_frame_stats {
+   struct wlc_frame_timing repaint; // CPU time spent rendering the frame
+   struct wlc_frame_timing swap; // Time spent swapping buffers
+   struct wlc_frame_timing flip; // Time from swap until the frame was presented
+   uint64_t missed; // Frames that missed their scheduled vblank since the output was created
+   uint32_t frames; // Number of recent frames the timings are computed from
+};
+
 /** -- Callbacks API */
 
 /** Output was created. Return false if you want to destroy the output. (e.g. failed to allocate data related to view) */
@@ -284,6 +299,9 @@ const struct wlc_size* wlc_output_get_resolution(wlc_handle output);
 /** Set resolution. */
 WLC_NONULL void wlc_output_set_resolution(wlc_handle output, const struct wlc_size *resolution);
 
+/** Get frame statistics over the recently presented frames. Returns false if output is invalid. */
+WLC_NONULL bool wlc_output_get_frame_stats(wlc_handle output, struct wlc_output_frame_stats *out_stats);
+
 /** Get current visibility bitmask. */
 uint32_t wlc_output_get_mask(wlc_handle output);
 
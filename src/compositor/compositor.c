@@ -184,7 +184,7 @@ wl_cb_surface_create(struct wl_client *client, struct wl_resource *resource, uin
       return;
 
    wlc_resource r;
-   if (!(r = wlc_resource_create(&compositor->surfaces, client, &wl_surface_interface, wl_resource_get_version(resource), 3, id)))
+   if (!(r = wlc_resource_create(&compositor->surfaces, client, &wl_surface_interface, wl_resource_get_version(resource), 4, id)))
       return;
 
    wlc_resource_implement(r, wlc_surface_implementation(), compositor);
@@ -216,7 +216,7 @@ static void
 wl_compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 {
    struct wl_resource *r;
-   if (!(r = wl_resource_create_checked(client, &wl_compositor_interface, version, 3, id)))
+   if (!(r = wl_resource_create_checked(client, &wl_compositor_interface, version, 4, id)))
       return;
 
    wl_resource_set_implementation(r, &wl_compositor_implementation, data, NULL);
@@ -705,6 +705,10 @@ wlc_compositor_release(struct wlc_compositor *compositor)
    wlc_shell_release(&compositor->shell);
    wlc_xdg_shell_release(&compositor->xdg_shell);
    wlc_custom_shell_release(&compositor->custom_shell);
+   wlc_presentation_release(&compositor->presentation);
+   wlc_screencopy_release(&compositor->screencopy);
+   wlc_export_dmabuf_release(&compositor->export_dmabuf);
+   wlc_vnc_release(&compositor->vnc);
    wlc_seat_release(&compositor->seat);
 
    if (compositor->wl.subcompositor)
@@ -757,7 +761,7 @@ wlc_compositor(struct wlc_compositor *compositor)
        !wlc_source(&compositor->regions, "region", NULL, wlc_region_release, 32, sizeof(struct wlc_region)))
       goto fail;
 
-   if (!(compositor->wl.compositor = wl_global_create(wlc_display(), &wl_compositor_interface, 3, compositor, wl_compositor_bind)))
+   if (!(compositor->wl.compositor = wl_global_create(wlc_display(), &wl_compositor_interface, 4, compositor, wl_compositor_bind)))
       goto compositor_interface_fail;
 
    if (!(compositor->wl.subcompositor = wl_global_create(wlc_display(), &wl_subcompositor_interface, 1, compositor, wl_subcompositor_bind)))
@@ -767,9 +771,15 @@ wlc_compositor(struct wlc_compositor *compositor)
        !wlc_shell(&compositor->shell) ||
        !wlc_xdg_shell(&compositor->xdg_shell) ||
        !wlc_custom_shell(&compositor->custom_shell) ||
+       !wlc_presentation(&compositor->presentation) ||
+       !wlc_screencopy(&compositor->screencopy) ||
+       !wlc_export_dmabuf(&compositor->export_dmabuf) ||
        !wlc_backend(&compositor->backend))
       goto fail;
 
+   // Remote display is optional, compositor runs without it
+   wlc_vnc(&compositor->vnc);
+
    return true;
 
 compositor_interface_fail:
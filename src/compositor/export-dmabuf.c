@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include "internal.h"
+#include "macros.h"
+#include "export-dmabuf.h"
+#include "compositor/output.h"
+#include "wayland-wlr-export-dmabuf-unstable-v1-server-protocol.h"
+
+// Same value as zwp_linux_buffer_params_v1.flags y_invert
+static const uint32_t BUFFER_FLAGS_Y_INVERT = 1;
+
+struct frame {
+   struct wl_resource *resource;
+   wlc_handle output;
+   bool pending; // export queued on the output
+   bool cursor; // cursor is held off the plane until the export is done
+};
+
+static void
+frame_release_cursor(struct frame *frame)
+{
+   assert(frame);
+
+   struct wlc_output *output;
+   if (frame->cursor && (output = convert_from_wlc_handle(frame->output, "output")))
+      wlc_output_capture_cursor(output, false);
+
+   frame->cursor = false;
+}
+
+static void
+export_done(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg)
+{
+   // Frame is presented by now, so the copy behind the fence has completed
+   (void)fence;
+   assert(arg);
+
+   struct frame *frame = arg;
+   frame->pending = false;
+   frame_release_cursor(frame);
+
+   if (!frame->resource) {
+      free(frame);
+      return;
+   }
+
+   struct wlc_output *o;
+   if (!attributes || !(o = convert_from_wlc_handle(output, "output"))) {
+      zwlr_export_dmabuf_frame_v1_send_cancel(frame->resource, ZWLR_EXPORT_DMABUF_FRAME_V1_CANCEL_REASON_TEMPORARY);
+      return;
+   }
+
+   // Buffers are reused after a few frames
+   zwlr_export_dmabuf_frame_v1_send_frame(frame->resource, attributes->size.w, attributes->size.h, 0, 0,
+         (attributes->y_invert ? BUFFER_FLAGS_Y_INVERT : 0), ZWLR_EXPORT_DMABUF_FRAME_V1_FLAGS_TRANSIENT,
+         attributes->format, attributes->modifier >> 32, attributes->modifier & 0xffffffff, attributes->num_planes);
+
+   for (uint32_t i = 0; i < attributes->num_planes; ++i) {
+      // fd is duplicated when the event is sent, the renderer keeps its own
+      const off_t size = lseek(attributes->fd[i], 0, SEEK_END);
+      zwlr_export_dmabuf_frame_v1_send_object(frame->resource, i, attributes->fd[i], (size > 0 ? size : 0), attributes->offset[i], attributes->stride[i], i);
+   }
+
+   const uint64_t sec = o->state.frame_time / 1000000000;
+   zwlr_export_dmabuf_frame_v1_send_ready(frame->resource, sec >> 32, sec & 0xffffffff, o->state.frame_time % 1000000000);
+}
+
+static const struct zwlr_export_dmabuf_frame_v1_interface zwlr_export_dmabuf_frame_implementation = {
+   .destroy = wlc_cb_resource_destructor,
+};
+
+static void
+frame_resource_destroyed(struct wl_resource *resource)
+{
+   struct frame *frame;
+   if (!(frame = wl_resource_get_user_data(resource)))
+      return;
+
+   // Export in flight still references the frame, it's freed when done
+   frame->resource = NULL;
+   frame_release_cursor(frame);
+
+   if (!frame->pending)
+      free(frame);
+}
+
+static void
+zwlr_export_dmabuf_manager_cb_capture_output(struct wl_client *client, struct wl_resource *resource, uint32_t id, int32_t overlay_cursor, struct wl_resource *output_resource)
+{
+   struct frame *frame;
+   if (!(frame = calloc(1, sizeof(struct frame)))) {
+      wl_client_post_no_memory(client);
+      return;
+   }
+
+   if (!(frame->resource = wl_resource_create(client, &zwlr_export_dmabuf_frame_v1_interface, wl_resource_get_version(resource), id))) {
+      free(frame);
+      wl_client_post_no_memory(client);
+      return;
+   }
+
+   wl_resource_set_implementation(frame->resource, &zwlr_export_dmabuf_frame_implementation, frame, frame_resource_destroyed);
+
+   struct wlc_output *output = convert_from_wlc_handle((wlc_handle)wl_resource_get_user_data(output_resource), "output");
+   if (!(frame->pending = wlc_output_export_dmabuf_ptr(output, export_done, frame))) {
+      zwlr_export_dmabuf_frame_v1_send_cancel(frame->resource, ZWLR_EXPORT_DMABUF_FRAME_V1_CANCEL_REASON_PERMANENT);
+      return;
+   }
+
+   // Cursor plane is not part of the exported buffer, composite the cursor into it
+   if (overlay_cursor) {
+      wlc_output_capture_cursor(output, true);
+      frame->output = convert_to_wlc_handle(output);
+      frame->cursor = true;
+   }
+}
+
+static const struct zwlr_export_dmabuf_manager_v1_interface zwlr_export_dmabuf_manager_implementation = {
+   .capture_output = zwlr_export_dmabuf_manager_cb_capture_output,
+   .destroy = wlc_cb_resource_destructor,
+};
+
+static void
+zwlr_export_dmabuf_manager_bind(struct wl_client *client, void *data, unsigned int version, unsigned int id)
+{
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_create_checked(client, &zwlr_export_dmabuf_manager_v1_interface, version, 1, id)))
+      return;
+
+   wl_resource_set_implementation(resource, &zwlr_export_dmabuf_manager_implementation, data, NULL);
+}
+
+void
+wlc_export_dmabuf_release(struct wlc_export_dmabuf *export_dmabuf)
+{
+   if (!export_dmabuf)
+      return;
+
+   if (export_dmabuf->wl.manager)
+      wl_global_destroy(export_dmabuf->wl.manager);
+
+   memset(export_dmabuf, 0, sizeof(struct wlc_export_dmabuf));
+}
+
+bool
+wlc_export_dmabuf(struct wlc_export_dmabuf *export_dmabuf)
+{
+   assert(export_dmabuf);
+   memset(export_dmabuf, 0, sizeof(struct wlc_export_dmabuf));
+
+   if (!(export_dmabuf->wl.manager = wl_global_create(wlc_display(), &zwlr_export_dmabuf_manager_v1_interface, 1, export_dmabuf, zwlr_export_dmabuf_manager_bind)))
+      goto export_dmabuf_interface_fail;
+
+   return true;
+
+export_dmabuf_interface_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to bind export dmabuf interface");
+   wlc_export_dmabuf_release(export_dmabuf);
+   return false;
+}
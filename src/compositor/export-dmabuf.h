@@ -0,0 +1,16 @@
+#ifndef _WLC_EXPORT_DMABUF_H_
+#define _WLC_EXPORT_DMABUF_H_
+
+#include <stdbool.h>
+#include <wlc/defines.h>
+
+struct wlc_export_dmabuf {
+   struct {
+      struct wl_global *manager;
+   } wl;
+};
+
+void wlc_export_dmabuf_release(struct wlc_export_dmabuf *export_dmabuf);
+WLC_NONULL bool wlc_export_dmabuf(struct wlc_export_dmabuf *export_dmabuf);
+
+#endif /* _WLC_EXPORT_DMABUF_H_ */
@@ -1,6 +1,8 @@
 #include "output.h"
 #include <stdlib.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include <wayland-server.h>
 #include <chck/string/string.h>
 #include <chck/math/math.h>
@@ -11,9 +13,32 @@
 #include "output.h"
 #include "view.h"
 #include "resources/types/surface.h"
+#include "resources/types/buffer.h"
+#include "platform/render/cursor.h"
+#include "presentation.h"
 
 static struct wlc_output *rendering_output;
 
+static const uint64_t NSEC_PER_SEC = 1000000000;
+static const uint64_t NSEC_PER_MSEC = 1000000;
+
+// Repaint margin bounds, the margin adapts between these when vblanks are missed or made
+static const uint64_t MIN_REPAINT_MARGIN = 1000000;
+static const uint64_t DEFAULT_REPAINT_MARGIN = 2000000;
+
+struct output_readback {
+   struct wlc_readback readback;
+   void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg);
+   void *arg;
+   bool started;
+};
+
+struct output_export {
+   void (*done)(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg);
+   void *arg;
+   bool started;
+};
+
 // FIXME: this is a hack
 static EGLNativeDisplayType INVALID_DISPLAY = (EGLNativeDisplayType)~0;
 
@@ -132,40 +157,63 @@ view_visible(struct wlc_view *view, struct wlc_surface *surface, uint32_t mask)
    return (surface->commit.attached && (view->mask & mask));
 }
 
-static bool
-blit(bool *g, const struct wlc_size *r, const struct wlc_point *a, const struct wlc_point *b, bool should_blit)
+static void
+subsurfaces_for_each(struct wlc_output *output, struct wlc_surface *surface, struct wlc_coordinate_scale parent_scale, struct wlc_point offset, void (*function)(struct wlc_output*, struct wlc_surface*, const struct wlc_geometry*, void*), void *arg)
 {
-   assert(g && r && a && b);
+   if (!surface)
+       return;
 
-   bool visible = false;
-   const size_t gsz = r->w * r->h;
-   assert(b->x - a->x >= 0);
-   assert(a->x >= 0 && b->x <= (int32_t)r->w && a->y >= 0 && b->y <= (int32_t)r->h);
-   for (int32_t y = a->y; y < b->y; ++y) {
-      const size_t off = a->x + y * r->w, memb = (b->x - a->x);
-      assert(off + memb <= gsz);
+   /* view's main surface is handled by the caller */
+   if (surface->parent) {
+      const struct wlc_geometry g = (struct wlc_geometry) {
+          .origin = {offset.x + parent_scale.w * (surface->commit.subsurface_position.x + surface->commit.offset.x),
+                     offset.y + parent_scale.h * (surface->commit.subsurface_position.y + surface->commit.offset.y)},
+          .size = surface->size
+      };
+      function(output, surface, &g, arg);
+   }
 
-      if (!visible && memchr(g + off, false, memb)) {
-         visible = true;
+   wlc_resource *sub;
+   chck_iter_pool_for_each(&surface->subsurface_list, sub) {
+       subsurfaces_for_each(output, convert_from_wlc_resource(*sub, "surface"), surface->coordinate_transform,
+             (struct wlc_point) {
+              offset.x + (surface->parent ? 0 : surface->commit.subsurface_position.x / parent_scale.w),
+              offset.y + (surface->parent ? 0 : surface->commit.subsurface_position.y / parent_scale.h)
+             }, function, arg);
+   }
+}
 
-         if (!should_blit)
-            return true;
-      }
+static void
+add_subsurface_extents(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, void *arg)
+{
+   (void)output, (void)surface;
+   pixman_region32_union_rect(arg, arg, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+}
 
-      if (should_blit)
-         memset(g + off, true, memb);
-   }
+static bool
+view_opaque_region(struct wlc_view *view, struct wlc_surface *surface, pixman_region32_t *out_opaque)
+{
+   assert(view && surface && out_opaque);
+
+   // Committed opaque region in output coordinates, scaled surfaces don't occlude anything
+   struct wlc_geometry b, v;
+   wlc_view_get_bounds(view, &b, &v);
+   if (!pixman_region32_not_empty(&surface->commit.opaque) || !wlc_size_equals(&surface->size, &v.size))
+      return false;
 
-   return visible;
+   pixman_region32_copy(out_opaque, &surface->commit.opaque);
+   pixman_region32_translate(out_opaque, v.origin.x, v.origin.y);
+   return true;
 }
 
 static bool
 get_visible_views(struct wlc_output *output, struct chck_iter_pool *visible)
 {
-   assert(output && output->blit);
+   assert(output);
 
-   const size_t gsz = output->resolution.w * output->resolution.h;
-   memset(output->blit, false, gsz);
+   // Area covered by opaque views so far, walking from top to bottom
+   pixman_region32_t covered;
+   pixman_region32_init(&covered);
 
    wlc_handle *h;
    chck_iter_pool_for_each_reverse(&output->views, h) {
@@ -193,23 +241,40 @@ get_visible_views(struct wlc_output *output, struct chck_iter_pool *visible)
       if (!vis)
          continue;
 
-      struct wlc_geometry o;
-      struct wlc_point a, b;
-      const bool should_blit = wlc_view_get_opaque(v, &o);
-      a.x = chck_clamp32(o.origin.x, 0, output->resolution.w);
-      a.y = chck_clamp32(o.origin.y, 0, output->resolution.h);
-      b.x = chck_clamp32((o.origin.x + o.size.w), 1, output->resolution.w);
-      b.y = chck_clamp32((o.origin.y + o.size.h), 1, output->resolution.h);
+      // Everything the view paints, translucent borders and subsurfaces outside of bounds included
+      struct wlc_geometry b;
+      wlc_view_get_bounds(v, &b, NULL);
+      pixman_region32_fini(&v->visible);
+      pixman_region32_init_rect(&v->visible, b.origin.x, b.origin.y, b.size.w, b.size.h);
+      subsurfaces_for_each(output, s, (struct wlc_coordinate_scale) {1, 1}, b.origin, add_subsurface_extents, &v->visible);
+      pixman_region32_intersect_rect(&v->visible, &v->visible, 0, 0, output->resolution.w, output->resolution.h);
+      pixman_region32_subtract(&v->visible, &v->visible, &covered);
 
-      if (!blit(output->blit, &output->resolution, &a, &b, should_blit)) {
+      if (!pixman_region32_not_empty(&v->visible)) {
          wlc_dlog(WLC_DBG_RENDER_LOOP, "%" PRIuWLC " is not visible", *h);
          continue;
       }
 
-      chck_iter_pool_push_front(visible, &v);
+      pixman_region32_fini(&v->clip);
+      pixman_region32_init_rect(&v->clip, 0, 0, output->resolution.w, output->resolution.h);
+      pixman_region32_subtract(&v->clip, &v->clip, &covered);
+
+      pixman_region32_t opaque;
+      pixman_region32_init(&opaque);
+      if (view_opaque_region(v, s, &opaque)) {
+         pixman_region32_union(&covered, &covered, &opaque);
+         pixman_region32_intersect_rect(&covered, &covered, 0, 0, output->resolution.w, output->resolution.h);
+      }
+      pixman_region32_fini(&opaque);
+
+      // Top to bottom, render loop walks this in reverse
+      chck_iter_pool_push_back(visible, &v);
    }
 
-   return memchr(output->blit, false, gsz);
+   pixman_box32_t box = { 0, 0, output->resolution.w, output->resolution.h };
+   const bool bg_visible = (pixman_region32_contains_rectangle(&covered, &box) != PIXMAN_REGION_IN);
+   pixman_region32_fini(&covered);
+   return bg_visible;
 }
 
 static void
@@ -234,40 +299,205 @@ finish_frame_tasks(struct wlc_output *output)
 }
 
 static void
-render_subsurface(struct wlc_output *output, struct wlc_surface *surface, struct wlc_point offset, struct wlc_coordinate_scale parent_scale)
+surface_take_frame_callbacks(struct wlc_output *output, struct wlc_surface *surface, struct chck_iter_pool *callbacks)
+{
+   assert(output && surface && callbacks);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
+      chck_iter_pool_push_back(callbacks, r);
+   chck_iter_pool_flush(&surface->commit.frame_cbs);
+
+   // Presentation feedback is sent once the frame actually hits the screen
+   chck_iter_pool_for_each(&surface->commit.feedbacks, r)
+      chck_iter_pool_push_back(&output->feedbacks, r);
+   chck_iter_pool_flush(&surface->commit.feedbacks);
+}
+
+static void
+render_subsurface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, void *arg)
+{
+   wlc_render_surface_paint(&output->render, &output->context, surface, geometry);
+   surface_take_frame_callbacks(output, surface, arg);
+}
+
+static void
+damage_surface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry)
 {
-   const struct wlc_geometry g = (struct wlc_geometry) {
-       .origin = {offset.x + parent_scale.w * (surface->commit.subsurface_position.x + surface->commit.offset.x),
-                  offset.y + parent_scale.h * (surface->commit.subsurface_position.y + surface->commit.offset.y)},
-       .size = surface->size
-   };
-   wlc_render_surface_paint(&output->render, &output->context, surface, &g);
+   assert(output && surface && geometry);
+
+   if (!wlc_geometry_equals(&surface->painted, geometry)) {
+      // Surface moved or was resized, repaint both areas
+      wlc_output_damage(output, &surface->painted);
+      wlc_output_damage(output, geometry);
+      surface->painted = *geometry;
+   } else if (pixman_region32_not_empty(&surface->commit.damage) && surface->size.w > 0 && surface->size.h > 0) {
+      // Transform surface damage to output coordinates.
+      // Pad by a pixel when scaled, since the filtering samples neighbouring texels.
+      const float sw = (float)geometry->size.w / surface->size.w;
+      const float sh = (float)geometry->size.h / surface->size.h;
+      const int32_t pad = (sw != 1.0f || sh != 1.0f);
+
+      int nrects;
+      pixman_box32_t *rects = pixman_region32_rectangles(&surface->commit.damage, &nrects);
+      for (int i = 0; i < nrects; ++i) {
+         const int32_t x1 = rects[i].x1 * sw - pad, x2 = rects[i].x2 * sw + pad;
+         const int32_t y1 = rects[i].y1 * sh - pad, y2 = rects[i].y2 * sh + pad;
+         wlc_output_damage(output, &(struct wlc_geometry){ { geometry->origin.x + x1, geometry->origin.y + y1 }, { x2 - x1, y2 - y1 } });
+      }
+   }
+
+   pixman_region32_clear(&surface->commit.damage);
 }
 
 static void
-subsurfaces_render(struct wlc_output *output, struct wlc_surface *surface, struct wlc_coordinate_scale parent_scale, struct chck_iter_pool *callbacks, struct wlc_point offset)
+damage_subsurface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, void *arg)
 {
+   (void)arg;
+   damage_surface(output, surface, geometry);
+}
 
+static void
+damage_painted_surface_tree(struct wlc_output *output, struct wlc_surface *surface)
+{
    if (!surface)
-       return;
-   /* do not render view's main surface twice */
-   if (surface->parent)
-       render_subsurface(output, surface, offset, parent_scale);
+      return;
+
+   wlc_output_damage(output, &surface->painted);
 
    wlc_resource *sub;
-   chck_iter_pool_for_each(&surface->subsurface_list, sub) {
-       subsurfaces_render(output, convert_from_wlc_resource(*sub, "surface"), surface->coordinate_transform,
-             callbacks,
-             (struct wlc_point) {
-              offset.x + (surface->parent ? 0 : surface->commit.subsurface_position.x / parent_scale.w),
-              offset.y + (surface->parent ? 0 : surface->commit.subsurface_position.y / parent_scale.h)
-             });
+   chck_iter_pool_for_each(&surface->subsurface_list, sub)
+      damage_painted_surface_tree(output, convert_from_wlc_resource(*sub, "surface"));
+}
+
+static void
+damage_views(struct wlc_output *output)
+{
+   assert(output);
+
+   wlc_handle *h;
+   chck_iter_pool_for_each(&output->views, h) {
+      struct wlc_view *v;
+      struct wlc_surface *s;
+      if (!(v = convert_from_wlc_handle(*h, "view")) ||
+          !(s = convert_from_wlc_resource(v->surface, "surface")) ||
+          !view_visible(v, s, output->active.mask))
+         continue;
+
+      if (!v->state.created) {
+         // View is created during render, we can't know what it will look like
+         wlc_output_damage_all(output);
+      } else if (memcmp(&v->pending, &v->commit, sizeof(v->commit))) {
+         // Decorations drawn from view render hooks may go outside of the view bounds
+         if (wlc_interface()->view.render.pre || wlc_interface()->view.render.post)
+            wlc_output_damage_all(output);
+
+         // Commit the state now so the new bounds are known before the frame is drawn
+         wlc_output_damage_view(output, v);
+         wlc_view_commit_state(v, &v->pending, &v->commit);
+         wlc_output_damage_view(output, v);
+      }
+
+      struct wlc_geometry b, visible;
+      wlc_view_get_bounds(v, &b, &visible);
+      damage_surface(output, s, &visible);
+      subsurfaces_for_each(output, s, (struct wlc_coordinate_scale) {1, 1}, b.origin, damage_subsurface, NULL);
    }
 
+   // Surfaces that are not part of view (cursors, and surfaces rendered with wlc_surface_render)
+   // Hidden views are damaged as whole when they become visible.
    wlc_resource *r;
-   chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
-      chck_iter_pool_push_back(callbacks, r);
-   chck_iter_pool_flush(&surface->commit.frame_cbs);
+   chck_iter_pool_for_each(&output->surfaces, r) {
+      struct wlc_surface *s;
+      if (!(s = convert_from_wlc_resource(*r, "surface")) || !pixman_region32_not_empty(&s->commit.damage))
+         continue;
+
+      if (!s->parent_view)
+         damage_surface(output, s, &s->painted);
+
+      pixman_region32_clear(&s->commit.damage);
+   }
+}
+
+static void
+damage_late(struct wlc_output *output, const struct wlc_geometry *geometry)
+{
+   assert(output && geometry);
+
+   pixman_region32_t late;
+   pixman_region32_init_rect(&late, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+   pixman_region32_intersect_rect(&late, &late, 0, 0, output->resolution.w, output->resolution.h);
+   pixman_region32_subtract(&late, &late, &output->damage.previous[0]);
+
+   // Area that was not repainted this frame, repaint it on next one
+   if (pixman_region32_not_empty(&late)) {
+      pixman_region32_union(&output->damage.current, &output->damage.current, &late);
+      wlc_output_schedule_repaint(output);
+   }
+
+   pixman_region32_fini(&late);
+}
+
+static void
+region_to_extents(pixman_region32_t *region)
+{
+   assert(region);
+   const pixman_box32_t e = *pixman_region32_extents(region);
+   pixman_region32_fini(region);
+   pixman_region32_init_rect(region, e.x1, e.y1, e.x2 - e.x1, e.y2 - e.y1);
+}
+
+static void
+frame_damage(struct wlc_output *output, pixman_region32_t *out_repaint)
+{
+   assert(output && out_repaint);
+
+   pixman_region32_intersect_rect(&output->damage.current, &output->damage.current, 0, 0, output->resolution.w, output->resolution.h);
+
+   // Back buffer holds contents from age frames ago, repaint everything that has changed since then.
+   const int32_t age = wlc_context_get_buffer_age(&output->context);
+   if (age > 0 && age - 1 <= OUTPUT_DAMAGE_HISTORY) {
+      pixman_region32_copy(out_repaint, &output->damage.current);
+      for (int32_t i = 0; i < age - 1; ++i)
+         pixman_region32_union(out_repaint, out_repaint, &output->damage.previous[i]);
+   } else {
+      pixman_region32_fini(out_repaint);
+      pixman_region32_init_rect(out_repaint, 0, 0, output->resolution.w, output->resolution.h);
+   }
+
+   // Repaint is scissored to a single box, everything inside of it gets cleared and drawn again.
+   // History keeps the box of each frame's own damage, keeping the boxes of the whole repaint would only grow them.
+   region_to_extents(out_repaint);
+
+   pixman_region32_fini(&output->damage.previous[OUTPUT_DAMAGE_HISTORY - 1]);
+   memmove(&output->damage.previous[1], &output->damage.previous[0], sizeof(pixman_region32_t) * (OUTPUT_DAMAGE_HISTORY - 1));
+   output->damage.previous[0] = output->damage.current;
+   region_to_extents(&output->damage.previous[0]);
+   pixman_region32_init(&output->damage.current);
+
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Damage %d,%d %d,%d (age %d)", out_repaint->extents.x1, out_repaint->extents.y1, out_repaint->extents.x2, out_repaint->extents.y2, age);
+}
+
+static void
+damage_to_mode(struct wlc_output *output, pixman_region32_t *damage, pixman_region32_t *out_damage)
+{
+   assert(output && damage && out_damage);
+
+   if (wlc_size_equals(&output->mode, &output->resolution)) {
+      pixman_region32_copy(out_damage, damage);
+      return;
+   }
+
+   const float sw = (float)output->mode.w / output->resolution.w;
+   const float sh = (float)output->mode.h / output->resolution.h;
+
+   int nrects;
+   pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const int32_t x1 = rects[i].x1 * sw - 1, x2 = rects[i].x2 * sw + 1;
+      const int32_t y1 = rects[i].y1 * sh - 1, y2 = rects[i].y2 * sh + 1;
+      pixman_region32_union_rect(out_damage, out_damage, x1, y1, x2 - x1, y2 - y1);
+   }
 }
 
 static void
@@ -285,16 +515,383 @@ render_view(struct wlc_output *output, struct wlc_view *view, struct chck_iter_p
    wlc_view_commit_state(view, &view->pending, &view->commit);
    WLC_INTERFACE_EMIT(view.render.pre, convert_to_wlc_handle(view));
    wlc_render_flush_fakefb(&output->render, &output->context);
+
+   // Nothing behind opaque views is drawn
+   wlc_render_clip(&output->render, &output->context, &view->clip);
    wlc_render_view_paint(&output->render, &output->context, view);
 
    struct wlc_geometry b;
    wlc_view_get_bounds(view, &b, NULL);
-   subsurfaces_render(output, surface, (struct wlc_coordinate_scale) {1, 1}, callbacks, b.origin);
+   subsurfaces_for_each(output, surface, (struct wlc_coordinate_scale) {1, 1}, b.origin, render_subsurface, callbacks);
+   surface_take_frame_callbacks(output, surface, callbacks);
+   wlc_render_clip(&output->render, &output->context, NULL);
 
    WLC_INTERFACE_EMIT(view.render.post, convert_to_wlc_handle(view));
    wlc_render_flush_fakefb(&output->render, &output->context);
 }
 
+static void
+take_subsurface_frame_callbacks(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, void *arg)
+{
+   (void)output, (void)geometry;
+   surface_take_frame_callbacks(output, surface, arg);
+}
+
+static void
+view_take_frame_callbacks(struct wlc_output *output, struct wlc_view *view, struct chck_iter_pool *callbacks)
+{
+   assert(output && view && callbacks);
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wlc_resource(view->surface, "surface")))
+      return;
+
+   struct wlc_geometry b;
+   wlc_view_get_bounds(view, &b, NULL);
+   subsurfaces_for_each(output, surface, (struct wlc_coordinate_scale) {1, 1}, b.origin, take_subsurface_frame_callbacks, callbacks);
+   surface_take_frame_callbacks(output, surface, callbacks);
+}
+
+static void
+view_take_zero_copy_callbacks(struct wlc_output *output, struct wlc_view *view)
+{
+   assert(output && view);
+
+   // Scanout and overlay planes show the client buffer itself, its feedbacks report zero copy
+   const size_t first = output->feedbacks.items.count;
+   view_take_frame_callbacks(output, view, &output->callbacks);
+
+   for (size_t i = first; i < output->feedbacks.items.count; ++i)
+      chck_iter_pool_push_back(&output->zero_copy, chck_iter_pool_get(&output->feedbacks, i));
+
+   while (output->feedbacks.items.count > first)
+      chck_iter_pool_remove(&output->feedbacks, output->feedbacks.items.count - 1);
+}
+
+static void
+start_readbacks(struct wlc_output *output)
+{
+   assert(output);
+
+   struct output_readback *r;
+   chck_iter_pool_for_each_reverse(&output->readbacks, r) {
+      if (r->started)
+         continue;
+
+      if (!(r->started = wlc_render_readback_start(&output->render, &output->context, &r->readback))) {
+         struct output_readback copy = *r;
+         wlc_render_readback_release(&output->render, &output->context, &copy.readback);
+         chck_iter_pool_remove(&output->readbacks, _I);
+         copy.done(convert_to_wlc_handle(output), &copy.readback.geometry, NULL, 0, copy.arg);
+      }
+   }
+}
+
+static bool
+finish_readbacks(struct wlc_output *output)
+{
+   assert(output);
+
+   bool in_flight = false;
+   struct output_readback *r;
+   chck_iter_pool_for_each_reverse(&output->readbacks, r) {
+      if (!r->started)
+         continue;
+
+      const void *data;
+      int32_t stride;
+      if (!wlc_render_readback_map(&output->render, &output->context, &r->readback, &data, &stride)) {
+         in_flight = true;
+         continue;
+      }
+
+      // Callback may queue new readbacks, so the entry is removed first
+      struct output_readback copy = *r;
+      chck_iter_pool_remove(&output->readbacks, _I);
+      copy.done(convert_to_wlc_handle(output), &copy.readback.geometry, data, stride, copy.arg);
+      wlc_render_readback_release(&output->render, &output->context, &copy.readback);
+   }
+
+   return in_flight;
+}
+
+static void
+cancel_readbacks(struct wlc_output *output)
+{
+   assert(output);
+
+   struct output_readback *r;
+   chck_iter_pool_for_each_reverse(&output->readbacks, r) {
+      struct output_readback copy = *r;
+      wlc_render_readback_release(&output->render, &output->context, &copy.readback);
+      chck_iter_pool_remove(&output->readbacks, _I);
+      copy.done(convert_to_wlc_handle(output), &copy.readback.geometry, NULL, 0, copy.arg);
+   }
+}
+
+static void
+start_exports(struct wlc_output *output)
+{
+   assert(output);
+
+   if (!output->exports.requests.items.count || output->exports.exported)
+      return;
+
+   output->exports.exported = wlc_render_export_dmabuf(&output->render, &output->context, &output->exports.attributes, &output->exports.fence);
+
+   struct output_export *e;
+   chck_iter_pool_for_each(&output->exports.requests, e)
+      e->started = true;
+}
+
+static void
+finish_exports(struct wlc_output *output, bool cancel)
+{
+   assert(output);
+
+   const struct wlc_dmabuf_attributes *attributes = (output->exports.exported && !cancel ? &output->exports.attributes : NULL);
+
+   // Callbacks may queue exports for the next frame, so entries are removed first
+   struct output_export *e;
+   chck_iter_pool_for_each_reverse(&output->exports.requests, e) {
+      if (!e->started && !cancel)
+         continue;
+
+      struct output_export copy = *e;
+      chck_iter_pool_remove(&output->exports.requests, _I);
+      copy.done(convert_to_wlc_handle(output), (copy.started ? attributes : NULL), (copy.started && attributes ? output->exports.fence : -1), copy.arg);
+   }
+
+   if (output->exports.fence >= 0)
+      close(output->exports.fence);
+
+   output->exports.fence = -1;
+   output->exports.exported = false;
+}
+
+static void
+finish_repaint(struct wlc_output *output, uint64_t start, uint64_t rendered)
+{
+   assert(output);
+
+   const uint64_t swapped = wlc_get_time_ns();
+   output->schedule.cost[output->schedule.cost_index] = swapped - start;
+   output->schedule.cost_index = (output->schedule.cost_index + 1) % OUTPUT_REPAINT_COST_HISTORY;
+
+   // Flip time is filled in by wlc_output_finish_frame
+   output->stats.repaint[output->stats.index] = rendered - start;
+   output->stats.swap[output->stats.index] = swapped - rendered;
+   output->stats.swapped = swapped;
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(&output->callbacks, r) {
+      struct wl_resource *resource;
+      if ((resource = wl_resource_from_wlc_resource(*r, "callback")))
+         wl_callback_send_done(resource, (uint32_t)(output->state.frame_time / NSEC_PER_MSEC));
+      wlc_resource_release_ptr(r);
+   }
+   chck_iter_pool_flush(&output->callbacks);
+}
+
+static void
+release_buffers(struct chck_iter_pool *buffers)
+{
+   assert(buffers);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(buffers, r)
+      wlc_buffer_dispose(convert_from_wlc_resource(*r, "buffer"));
+   chck_iter_pool_flush(buffers);
+}
+
+static void
+hold_buffer(struct wlc_output *output, struct wlc_buffer *buffer)
+{
+   assert(output && buffer);
+
+   // Held until the next frame replaces it on screen, see wlc_output_finish_frame
+   const wlc_resource r = wlc_buffer_use(buffer);
+   if (!chck_iter_pool_push_back(&output->scanout.pending, &r)) {
+      wlc_log(WLC_LOG_WARN, "Failed to hold buffer shown by output (out of memory?)");
+      wlc_buffer_dispose(buffer);
+   }
+}
+
+static bool
+planes_usable(struct wlc_output *output)
+{
+   assert(output);
+
+   // Anything drawn over the clients, or reading the composited frame, needs composition
+   return (!output->scanout.captures && !output->readbacks.items.count && !output->exports.requests.items.count &&
+           !output->cursor.composited && wlc_size_equals(&output->mode, &output->resolution) &&
+           !wlc_interface()->output.render.post && !wlc_interface()->view.render.pre && !wlc_interface()->view.render.post);
+}
+
+static struct wlc_buffer*
+direct_buffer(struct wlc_view *view, const struct wlc_geometry *bounds)
+{
+   assert(view && bounds);
+
+   // Buffer is shown as is, so it has to be unscaled and upright without anything attached to it
+   struct wlc_surface *surface;
+   struct wlc_buffer *buffer;
+   if (!(surface = convert_from_wlc_resource(view->surface, "surface")) || surface->subsurface_list.items.count > 0 ||
+       !(buffer = wlc_surface_get_buffer(surface)) || !buffer->y_inverted || !wlc_size_equals(&buffer->size, &bounds->size))
+      return NULL;
+
+   return buffer;
+}
+
+static struct wlc_buffer*
+scanout_buffer(struct wlc_output *output, bool bg_visible)
+{
+   assert(output);
+
+   if (!output->bsurface.api.scanout || bg_visible || output->visible.items.count != 1 || !planes_usable(output))
+      return NULL;
+
+   struct wlc_view *view = *(struct wlc_view**)chck_iter_pool_get(&output->visible, 0);
+   wlc_view_commit_state(view, &view->pending, &view->commit);
+
+   // Buffer has to cover the output exactly
+   struct wlc_geometry b;
+   wlc_view_get_bounds(view, &b, NULL);
+   if (!wlc_geometry_equals(&b, &(struct wlc_geometry){ wlc_point_zero, output->resolution }))
+      return NULL;
+
+   return direct_buffer(view, &b);
+}
+
+static bool
+scanout(struct wlc_output *output, struct wlc_buffer *buffer, uint64_t start)
+{
+   assert(output && buffer);
+
+   struct wl_resource *wl_buffer;
+   if (!(wl_buffer = convert_to_wl_resource(buffer, "buffer")) || !output->bsurface.api.scanout(&output->bsurface, wl_buffer))
+      return false;
+
+   if (!output->scanout.active)
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Scanout of buffer (%" PRIuWLC ")", convert_to_wlc_resource(buffer));
+
+   hold_buffer(output, buffer);
+   chck_iter_pool_flush(&output->scanout.overlays);
+   output->scanout.active = true;
+   output->state.pending = true;
+
+   // Damage still moves through the history, the context has not seen it though (see repaint)
+   pixman_region32_t frame;
+   pixman_region32_init(&frame);
+   frame_damage(output, &frame);
+   pixman_region32_fini(&frame);
+
+   view_take_zero_copy_callbacks(output, *(struct wlc_view**)chck_iter_pool_get(&output->visible, 0));
+   chck_iter_pool_flush(&output->visible);
+
+   // Pointer moves the cursor plane, or finds out it has to be composited from next frame on
+   rendering_output = output;
+   struct wlc_render_event ev = { .output = output, .type = WLC_RENDER_EVENT_POINTER };
+   wl_signal_emit(&wlc_system_signals()->render, &ev);
+   rendering_output = NULL;
+
+   finish_repaint(output, start, wlc_get_time_ns());
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint (scanout)");
+   return true;
+}
+
+static bool
+lift_view(struct wlc_output *output, struct wlc_view *view, const struct wlc_geometry *bounds)
+{
+   assert(output && view && bounds);
+
+   // Planes are not blended, the view has to be opaque and fully on the output
+   struct wlc_surface *surface;
+   if (bounds->origin.x < 0 || bounds->origin.y < 0 ||
+       bounds->origin.x + (int32_t)bounds->size.w > (int32_t)output->resolution.w ||
+       bounds->origin.y + (int32_t)bounds->size.h > (int32_t)output->resolution.h ||
+       !(surface = convert_from_wlc_resource(view->surface, "surface")))
+      return false;
+
+   pixman_region32_t opaque;
+   pixman_region32_init(&opaque);
+   pixman_box32_t box = { bounds->origin.x, bounds->origin.y, bounds->origin.x + bounds->size.w, bounds->origin.y + bounds->size.h };
+   const bool covers = (view_opaque_region(view, surface, &opaque) && pixman_region32_contains_rectangle(&opaque, &box) == PIXMAN_REGION_IN);
+   pixman_region32_fini(&opaque);
+
+   if (!covers)
+      return false;
+
+   struct wlc_buffer *buffer;
+   struct wl_resource *wl_buffer;
+   if (!(buffer = direct_buffer(view, bounds)) || !(wl_buffer = convert_to_wl_resource(buffer, "buffer")) ||
+       !output->bsurface.api.assign_overlay(&output->bsurface, wl_buffer, bounds))
+      return false;
+
+   hold_buffer(output, buffer);
+   view_take_zero_copy_callbacks(output, view);
+   return true;
+}
+
+static void
+assign_overlays(struct wlc_output *output)
+{
+   assert(output);
+
+   if (!output->bsurface.api.assign_overlay)
+      return;
+
+   // Assignments of a frame that never made it to the screen
+   output->bsurface.api.assign_overlay(&output->bsurface, NULL, NULL);
+
+   // Handles from last frame stay at the front, views lifted this frame are appended
+   const size_t previous = output->scanout.overlays.items.count;
+
+   if (planes_usable(output)) {
+      pixman_region32_t above;
+      pixman_region32_init(&above);
+
+      // Top to bottom, views can be lifted onto planes while nothing is drawn over them
+      for (size_t i = 0; i < output->visible.items.count;) {
+         struct wlc_view *v = *(struct wlc_view**)chck_iter_pool_get(&output->visible, i);
+         wlc_view_commit_state(v, &v->pending, &v->commit);
+
+         struct wlc_geometry b;
+         wlc_view_get_bounds(v, &b, NULL);
+         pixman_box32_t box = { b.origin.x, b.origin.y, b.origin.x + b.size.w, b.origin.y + b.size.h };
+         const bool covered = (pixman_region32_contains_rectangle(&above, &box) != PIXMAN_REGION_OUT);
+         pixman_region32_union_rect(&above, &above, b.origin.x, b.origin.y, b.size.w, b.size.h);
+
+         if (covered || !lift_view(output, v, &b)) {
+            ++i;
+            continue;
+         }
+
+         const wlc_handle h = convert_to_wlc_handle(v);
+         chck_iter_pool_push_back(&output->scanout.overlays, &h);
+         chck_iter_pool_remove(&output->visible, i);
+      }
+
+      pixman_region32_fini(&above);
+   }
+
+   // Views that left their plane are composited again, the back buffers have nothing of them
+   for (size_t i = 0; i < previous; ++i) {
+      const wlc_handle *h = chck_iter_pool_get(&output->scanout.overlays, i);
+
+      bool lifted = false;
+      for (size_t n = previous; n < output->scanout.overlays.items.count && !lifted; ++n)
+         lifted = (*(wlc_handle*)chck_iter_pool_get(&output->scanout.overlays, n) == *h);
+
+      struct wlc_view *v;
+      if (!lifted && (v = convert_from_wlc_handle(*h, "view")))
+         wlc_output_damage_view(output, v);
+   }
+
+   for (size_t i = 0; i < previous; ++i)
+      chck_iter_pool_remove(&output->scanout.overlays, 0);
+}
+
 static bool
 should_render(struct wlc_output *output)
 {
@@ -315,17 +912,21 @@ repaint(struct wlc_output *output)
       return false;
    }
 
+   const uint64_t start = wlc_get_time_ns();
    wlc_render_resolution(&output->render, &output->context, &output->mode, &output->resolution);
 
    if (output->state.sleeping) {
       // fake sleep
+      wlc_render_scissor(&output->render, &output->context, NULL);
       wlc_render_clear(&output->render, &output->context);
       output->state.pending = true;
-      wlc_context_swap(&output->context, &output->bsurface);
+      wlc_context_swap(&output->context, &output->bsurface, NULL);
       wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
       return true;
    }
 
+   damage_views(output);
+
    const bool bg_visible = get_visible_views(output, &output->visible);
 
    if (!output->state.background_visible && bg_visible) {
@@ -336,6 +937,29 @@ repaint(struct wlc_output *output)
       output->state.background_visible = false;
    }
 
+   struct wlc_buffer *buffer;
+   if ((buffer = scanout_buffer(output, bg_visible)) && scanout(output, buffer, start))
+      return true;
+
+   if (output->scanout.active) {
+      // Back buffers missed every scanout frame
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Composite");
+      wlc_output_damage_all(output);
+      output->scanout.active = false;
+   }
+
+   assign_overlays(output);
+
+   pixman_region32_t frame;
+   pixman_region32_init(&frame);
+   frame_damage(output, &frame);
+
+   {
+      const pixman_box32_t *e = pixman_region32_extents(&frame);
+      const struct wlc_geometry clip = { { e->x1, e->y1 }, { e->x2 - e->x1, e->y2 - e->y1 } };
+      wlc_render_scissor(&output->render, &output->context, &clip);
+   }
+
    rendering_output = output;
    wlc_render_clear(&output->render, &output->context);
 
@@ -345,9 +969,24 @@ repaint(struct wlc_output *output)
    }
 
    {
+      // Views outside of the repainted area only need their frame callbacks,
+      // unless there are view render hooks that may draw outside of the view.
+      const bool skip = !wlc_interface()->view.render.pre && !wlc_interface()->view.render.post;
+
       struct wlc_view **v;
-      chck_iter_pool_for_each(&output->visible, v)
-         render_view(output, *v, &output->callbacks);
+      chck_iter_pool_for_each_reverse(&output->visible, v) {
+         pixman_region32_t area;
+         pixman_region32_init(&area);
+         pixman_region32_intersect(&area, &(*v)->visible, &frame);
+
+         if (skip && !pixman_region32_not_empty(&area)) {
+            view_take_frame_callbacks(output, *v, &output->callbacks);
+         } else {
+            render_view(output, *v, &output->callbacks);
+         }
+
+         pixman_region32_fini(&area);
+      }
       chck_iter_pool_flush(&output->visible);
    }
 
@@ -357,43 +996,116 @@ repaint(struct wlc_output *output)
    struct wlc_render_event ev = { .output = output, .type = WLC_RENDER_EVENT_POINTER };
    wl_signal_emit(&wlc_system_signals()->render, &ev);
 
+   wlc_render_scissor(&output->render, &output->context, NULL);
+
+   // Only the damage of this frame has changed from the previous one
+   pixman_region32_t swap;
+   pixman_region32_init(&swap);
+   damage_to_mode(output, &output->damage.previous[0], &swap);
+
+   ev.type = WLC_RENDER_EVENT_DAMAGE;
+   ev.damage = &swap;
+   wl_signal_emit(&wlc_system_signals()->render, &ev);
+   start_readbacks(output);
+   start_exports(output);
+
    rendering_output = NULL;
 
+   const uint64_t rendered = wlc_get_time_ns();
+
    output->state.pending = true;
-   wlc_context_swap(&output->context, &output->bsurface);
+   wlc_context_swap(&output->context, &output->bsurface, &swap);
+   pixman_region32_fini(&swap);
+   pixman_region32_fini(&frame);
 
-   {
-      wlc_resource *r;
-      chck_iter_pool_for_each(&output->callbacks, r) {
-         struct wl_resource *resource;
-         if ((resource = wl_resource_from_wlc_resource(*r, "callback")))
-            wl_callback_send_done(resource, output->state.frame_time);
-         wlc_resource_release_ptr(r);
-      }
-      chck_iter_pool_flush(&output->callbacks);
+   finish_repaint(output, start, rendered);
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
+   return true;
+}
+
+static int
+cb_repaint_timer(int fd, uint32_t mask, void *data)
+{
+   (void)mask;
+   assert(data);
+
+   uint64_t expirations;
+   if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+      return 0;
+
+   repaint(convert_from_wlc_handle((wlc_handle)data, "output"));
+   return 1;
+}
+
+static void
+arm_repaint_timer(struct wlc_output *output, uint64_t time)
+{
+   assert(output);
+
+   // Absolute time, 0 disarms the timer and times in past expire immediately
+   struct itimerspec its = {{0}, {0}};
+   its.it_value.tv_sec = time / NSEC_PER_SEC;
+   its.it_value.tv_nsec = time % NSEC_PER_SEC;
+
+   if (timerfd_settime(output->timer.fd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+      wlc_log(WLC_LOG_WARN, "Failed to arm repaint timer for output (%" PRIuWLC ")", convert_to_wlc_handle(output));
+}
+
+static uint64_t
+repaint_budget(struct wlc_output *output)
+{
+   assert(output);
+
+   uint64_t cost = 0;
+   for (uint32_t i = 0; i < OUTPUT_REPAINT_COST_HISTORY; ++i)
+      cost = chck_maxu64(cost, output->schedule.cost[i]);
+
+   return cost + output->schedule.margin;
+}
+
+static void
+schedule_repaint_timer(struct wlc_output *output)
+{
+   assert(output);
+
+   const uint64_t now = wlc_get_time_ns();
+   const uint64_t refresh = output->schedule.refresh;
+   const uint64_t budget = repaint_budget(output);
+
+   // Without recent vblank we can't predict the next one, repaint right away and let the flip sync us up.
+   if (!output->state.frame_time || now > output->state.frame_time + NSEC_PER_SEC || budget >= refresh) {
+      output->schedule.target = 0;
+      arm_repaint_timer(output, now);
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint scheduled now");
+      return;
+   }
+
+   if (!output->schedule.vsync) {
+      // No vblank to aim for, just don't repaint faster than the mode refreshes
+      output->schedule.target = 0;
+      arm_repaint_timer(output, chck_maxu64(now, output->state.frame_time + refresh));
+      return;
    }
 
-   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
-   return true;
-}
+   // First vblank we still have time to make
+   uint64_t vblank = output->state.frame_time + refresh;
+   if (vblank < now + budget)
+      vblank += ((now + budget - vblank) + refresh - 1) / refresh * refresh;
 
-static int
-cb_idle_timer(void *data)
-{
-   assert(data);
-   repaint(convert_from_wlc_handle((wlc_handle)data, "output"));
-   return 1;
+   output->schedule.target = vblank;
+   arm_repaint_timer(output, vblank - budget);
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint scheduled in %" PRIu64 " ns (budget %" PRIu64 " ns)", vblank - budget - now, budget);
 }
 
 static void
 cancel_repaint(struct wlc_output *output)
 {
-   wl_event_source_timer_update(output->timer.idle, 0);
+   arm_repaint_timer(output, 0);
    output->state.scheduled = output->state.activity = false;
 }
 
 void
-wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts)
+wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts, uint64_t seq, uint32_t flags)
 {
    assert(ts);
 
@@ -402,18 +1114,62 @@ wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts)
 
    output->state.pending = false;
 
-   // XXX: uint32_t holds mostly for 50 days before overflowing
-   //      is this tied to wayland somewhere, or should we increase precision?
-   const uint32_t last = output->state.frame_time;
-   output->state.frame_time = ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
-   const uint32_t ms = output->state.frame_time - last;
+   const uint64_t vblank = (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+   output->schedule.vsync = (flags & WLC_PRESENTATION_VSYNC);
+
+   {
+      // Refresh is unknown without vsync (X11), the protocol allows 0 for that
+      const uint64_t refresh = (output->schedule.vsync ? output->schedule.refresh : 0);
+
+      wlc_resource *r;
+      chck_iter_pool_for_each(&output->feedbacks, r)
+         wlc_presentation_feedback_presented(*r, output, vblank, refresh, seq, flags);
+      chck_iter_pool_flush(&output->feedbacks);
+
+      chck_iter_pool_for_each(&output->zero_copy, r)
+         wlc_presentation_feedback_presented(*r, output, vblank, refresh, seq, flags | WLC_PRESENTATION_ZERO_COPY);
+      chck_iter_pool_flush(&output->zero_copy);
+   }
+
+   if (output->stats.swapped) {
+      output->stats.flip[output->stats.index] = (vblank > output->stats.swapped ? vblank - output->stats.swapped : 0);
+      output->stats.index = (output->stats.index + 1) % OUTPUT_FRAME_STATS_HISTORY;
+      output->stats.frames = chck_minu32(output->stats.frames + 1, OUTPUT_FRAME_STATS_HISTORY);
+      output->stats.swapped = 0;
+   }
+
+   if (output->schedule.target) {
+      if (vblank > output->schedule.target + output->schedule.refresh / 2) {
+         // Missed the vblank we aimed for, start earlier
+         output->schedule.margin = chck_minu64(output->schedule.margin * 2, output->schedule.refresh / 2);
+         ++output->stats.missed;
+         wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Missed vblank by %" PRIu64 " ns, margin now %" PRIu64 " ns", vblank - output->schedule.target, output->schedule.margin);
+      } else {
+         // Slowly give the time back
+         output->schedule.margin = chck_maxu64(output->schedule.margin - output->schedule.margin / 32, MIN_REPAINT_MARGIN);
+      }
+
+      output->schedule.target = 0;
+   }
+
+   output->state.frame_time = vblank;
 
-   // TODO: handle presentation feedback here
+   {
+      // Buffers that left the screen may be reused by the clients
+      release_buffers(&output->scanout.current);
+      const struct chck_iter_pool current = output->scanout.current;
+      output->scanout.current = output->scanout.pending;
+      output->scanout.pending = current;
+   }
+
+   // Readbacks not finished yet are polled again after next frame
+   if (finish_readbacks(output))
+      output->state.activity = true;
+
+   finish_exports(output, false);
 
    if (output->state.activity && !output->task.terminate) {
-      output->state.ims = chck_clampf(output->state.ims * (output->state.activity ? 0.9 : 1.1), 1, 41);
-      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Interpolated idle time %f (%u : %d)", output->state.ims, ms, output->state.activity);
-      wl_event_source_timer_update(output->timer.idle, output->state.ims);
+      schedule_repaint_timer(output);
       output->state.scheduled = true;
       output->state.activity = false;
    } else {
@@ -424,17 +1180,26 @@ wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts)
    finish_frame_tasks(output);
 }
 
-void
-wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surface)
+static bool
+shares_textures(struct wlc_output *a, struct wlc_output *b)
 {
-   if (!output)
-      return;
+   assert(a && b);
+   const void *group = wlc_context_get_share_group(&a->context);
+   return (group && group == wlc_context_get_share_group(&b->context));
+}
 
-   assert(surface && surface->output == convert_to_wlc_handle(output));
+static void
+detach_surface(struct wlc_output *output, struct wlc_surface *surface)
+{
+   assert(output && surface);
 
-   wlc_render_surface_destroy(&output->render, &output->context, surface);
    surface->output = 0;
 
+   if (output->cursor.surface == convert_to_wlc_resource(surface))
+      output->cursor.changed = true;
+
+   wlc_output_damage(output, &surface->painted);
+   surface->painted = wlc_geometry_zero;
    wlc_output_schedule_repaint(output);
 
    wlc_resource *r;
@@ -449,6 +1214,18 @@ wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surfac
    wlc_dlog(WLC_DBG_RENDER, "-> Deattached surface (%" PRIuWLC ") from output (%" PRIuWLC ")", convert_to_wlc_resource(surface), convert_to_wlc_handle(output));
 }
 
+void
+wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surface)
+{
+   if (!output)
+      return;
+
+   assert(surface && surface->output == convert_to_wlc_handle(output));
+
+   wlc_render_surface_destroy(&output->render, &output->context, surface);
+   detach_surface(output, surface);
+}
+
 bool
 wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface, struct wlc_buffer *buffer)
 {
@@ -457,9 +1234,20 @@ wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface
    if (!output)
       return false;
 
+   // New buffer for the surface on the cursor plane, it's uploaded again on next repaint
+   if (output->cursor.surface == convert_to_wlc_resource(surface))
+      output->cursor.changed = true;
+
    bool new_surface = false;
    if (surface->output != convert_to_wlc_handle(output)) {
-      wlc_surface_invalidate(surface);
+      struct wlc_output *old;
+      if ((old = convert_from_wlc_handle(surface->output, "output")) && shares_textures(old, output)) {
+         // Textures are usable as is on the new output, no need to upload again
+         detach_surface(old, surface);
+      } else {
+         wlc_surface_invalidate(surface);
+      }
+
       surface->output = convert_to_wlc_handle(output);
       new_surface = true;
    }
@@ -483,6 +1271,146 @@ wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface
    return true;
 }
 
+static pixman_image_t*
+cursor_image_for_surface(struct wlc_output *output, struct wlc_surface *surface, struct wl_shm_buffer **out_shm)
+{
+   assert(output && out_shm);
+   *out_shm = NULL;
+
+   if (!surface) {
+      if (!output->cursor.fallback) {
+         if (!(output->cursor.fallback = pixman_image_create_bits(PIXMAN_a8r8g8b8, CURSOR_SIZE, CURSOR_SIZE, NULL, 0)))
+            return NULL;
+
+         uint32_t *pixels = pixman_image_get_data(output->cursor.fallback);
+         const uint32_t stride = pixman_image_get_stride(output->cursor.fallback) / sizeof(uint32_t);
+         for (uint32_t y = 0; y < CURSOR_SIZE; ++y) {
+            for (uint32_t x = 0; x < CURSOR_SIZE; ++x)
+               pixels[y * stride + x] = cursor_colors[cursor_palette[y * CURSOR_SIZE + x]];
+         }
+      }
+
+      return pixman_image_ref(output->cursor.fallback);
+   }
+
+   // Cursor plane takes only shm buffers, anything else is composited
+   struct wlc_buffer *buffer;
+   struct wl_resource *wl_buffer;
+   struct wl_shm_buffer *shm;
+   if (!(buffer = wlc_surface_get_buffer(surface)) || !(wl_buffer = convert_to_wl_resource(buffer, "buffer")) || !(shm = wl_shm_buffer_get(wl_buffer)))
+      return NULL;
+
+   const uint32_t format = wl_shm_buffer_get_format(shm);
+   if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888)
+      return NULL;
+
+   // Data is accessed until the image is released, see wlc_output_set_cursor
+   wl_shm_buffer_begin_access(shm);
+
+   pixman_image_t *image;
+   if (!(image = pixman_image_create_bits_no_clear((format == WL_SHM_FORMAT_ARGB8888 ? PIXMAN_a8r8g8b8 : PIXMAN_x8r8g8b8), wl_shm_buffer_get_width(shm), wl_shm_buffer_get_height(shm), wl_shm_buffer_get_data(shm), wl_shm_buffer_get_stride(shm)))) {
+      wl_shm_buffer_end_access(shm);
+      return NULL;
+   }
+
+   *out_shm = shm;
+   return image;
+}
+
+bool
+wlc_output_set_cursor(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_point *hotspot, const struct wlc_point *pos)
+{
+   assert(output && hotspot && pos);
+
+   // Cursor plane shows framebuffer pixels, cursor of scaled outputs is composited
+   // Cursor plane is not part of the frame, so captures need the cursor composited as well
+   if (!output->bsurface.api.set_cursor || !output->bsurface.api.move_cursor || !wlc_size_equals(&output->mode, &output->resolution) || output->cursor.captures > 0)
+      goto fail;
+
+   // Plane keeps its contents, only a different image needs uploading
+   const wlc_resource r = convert_to_wlc_resource(surface);
+   if (!output->cursor.visible || output->cursor.changed || output->cursor.surface != r || !wlc_point_equals(&output->cursor.hotspot, hotspot)) {
+      struct wl_shm_buffer *shm;
+      pixman_image_t *image;
+      if (!(image = cursor_image_for_surface(output, surface, &shm)))
+         goto fail;
+
+      const bool shown = output->bsurface.api.set_cursor(&output->bsurface, image, hotspot);
+      pixman_image_unref(image);
+
+      if (shm)
+         wl_shm_buffer_end_access(shm);
+
+      if (!shown)
+         goto fail;
+
+      output->cursor.surface = r;
+      output->cursor.hotspot = *hotspot;
+      output->cursor.changed = false;
+      output->cursor.visible = true;
+   }
+
+   if (!output->bsurface.api.move_cursor(&output->bsurface, pos))
+      goto fail;
+
+   if (surface) {
+      // Surface is not composited while it's on the plane
+      if (!wlc_geometry_equals(&surface->painted, &wlc_geometry_zero)) {
+         damage_late(output, &surface->painted);
+         surface->painted = wlc_geometry_zero;
+      }
+
+      surface_take_frame_callbacks(output, surface, &output->callbacks);
+   }
+
+   return true;
+
+fail:
+   wlc_output_hide_cursor(output);
+   return false;
+}
+
+bool
+wlc_output_move_cursor(struct wlc_output *output, const struct wlc_point *pos)
+{
+   assert(output && pos);
+   return (output->cursor.visible && output->bsurface.api.move_cursor(&output->bsurface, pos));
+}
+
+void
+wlc_output_hide_cursor(struct wlc_output *output)
+{
+   assert(output);
+
+   if (!output->cursor.visible)
+      return;
+
+   output->bsurface.api.set_cursor(&output->bsurface, NULL, NULL);
+   output->cursor.visible = false;
+}
+
+void
+wlc_output_capture_cursor(struct wlc_output *output, bool capture)
+{
+   assert(output && (capture || output->cursor.captures > 0));
+   output->cursor.captures += (capture ? 1 : -1);
+
+   // Pointer moves the cursor off the plane on next repaint, it's put back once motion repaints without captures
+   if (capture && output->cursor.visible)
+      wlc_output_schedule_repaint(output);
+}
+
+void
+wlc_output_capture(struct wlc_output *output, bool capture)
+{
+   assert(output && (capture || output->scanout.captures > 0));
+   output->scanout.captures += (capture ? 1 : -1);
+
+   // Next frame is composited so there is something to read back
+   if (capture && output->scanout.active)
+      wlc_output_schedule_repaint(output);
+}
+
 static bool
 attach_view(struct wlc_output *output, struct wlc_view *view)
 {
@@ -512,8 +1440,46 @@ wlc_output_schedule_repaint(struct wlc_output *output)
       return;
 
    output->state.scheduled = true;
-   wl_event_source_timer_update(output->timer.idle, 1);
-   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint scheduled");
+
+   // Frame in flight, wlc_output_finish_frame schedules the repaint
+   if (output->state.pending)
+      return;
+
+   schedule_repaint_timer(output);
+}
+
+void
+wlc_output_damage(struct wlc_output *output, const struct wlc_geometry *geometry)
+{
+   assert(geometry);
+
+   if (!output || geometry->size.w == 0 || geometry->size.h == 0)
+      return;
+
+   pixman_region32_union_rect(&output->damage.current, &output->damage.current, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+}
+
+void
+wlc_output_damage_view(struct wlc_output *output, struct wlc_view *view)
+{
+   assert(view);
+
+   if (!output)
+      return;
+
+   struct wlc_geometry b;
+   wlc_view_get_bounds(view, &b, NULL);
+   wlc_output_damage(output, &b);
+   damage_painted_surface_tree(output, convert_from_wlc_resource(view->surface, "surface"));
+}
+
+void
+wlc_output_damage_all(struct wlc_output *output)
+{
+   if (!output)
+      return;
+
+   wlc_output_damage(output, &(struct wlc_geometry){ wlc_point_zero, output->resolution });
 }
 
 bool
@@ -534,34 +1500,57 @@ wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_sur
       return true;
    }
 
-   {
-      wlc_resource *r;
-      chck_iter_pool_for_each(&output->surfaces, r) {
-         struct wlc_surface *s;
-         if ((s = convert_from_wlc_resource(*r, "surface")))
-            wlc_render_surface_destroy(&output->render, &output->context, s);
-      }
-   }
-
    if (output->state.created)
       WLC_INTERFACE_EMIT(output.context.destroyed, convert_to_wlc_handle(output));
 
-   wlc_render_release(&output->render, &output->context);
-   wlc_context_release(&output->context);
-   wlc_backend_surface_release(&output->bsurface);
+   cancel_readbacks(output);
+   finish_exports(output, true);
+
+   // Old context is kept alive until the new one exists, so the new one can join its share group
+   const void *group = wlc_context_get_share_group(&output->context);
+   struct wlc_backend_surface old_bsurface = output->bsurface;
+   struct wlc_context old_context = output->context;
+   struct wlc_render old_render = output->render;
+   memset(&output->bsurface, 0, sizeof(output->bsurface));
+   memset(&output->context, 0, sizeof(output->context));
+   memset(&output->render, 0, sizeof(output->render));
 
+   // Cursor plane belongs to the old surface, pointer puts the cursor back on next repaint
+   output->cursor.visible = false;
+
+   bool created = false;
    if (bsurface) {
       memcpy(&output->bsurface, bsurface, sizeof(output->bsurface));
       memset(bsurface, 0, sizeof(output->bsurface));
+
+      if ((created = wlc_context(&output->context, &output->bsurface))) {
+         wlc_context_bind_to_wl_display(&output->context, wlc_display());
+         created = wlc_render(&output->render, &output->context);
+      }
    }
 
-   if (bsurface) {
-      if (!wlc_context(&output->context, &output->bsurface))
-         goto fail;
+   // Textures stay valid if the new context shares objects with the old one
+   if (!created || !group || group != wlc_context_get_share_group(&output->context)) {
+      wlc_resource *r;
+      chck_iter_pool_for_each(&output->surfaces, r) {
+         struct wlc_surface *s;
+         if ((s = convert_from_wlc_resource(*r, "surface")))
+            wlc_render_surface_destroy(&old_render, &old_context, s);
+      }
+   }
+
+   wlc_render_release(&old_render, &old_context);
+   wlc_context_release(&old_context);
+   wlc_backend_surface_release(&old_bsurface);
 
-      wlc_context_bind_to_wl_display(&output->context, wlc_display());
+   // Old surface no longer shows the client buffers
+   release_buffers(&output->scanout.pending);
+   release_buffers(&output->scanout.current);
+   chck_iter_pool_flush(&output->scanout.overlays);
+   output->scanout.active = false;
 
-      if (!wlc_render(&output->render, &output->context))
+   if (bsurface) {
+      if (!created)
          goto fail;
 
       {
@@ -575,6 +1564,8 @@ wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_sur
          }
       }
 
+      wlc_output_damage_all(output);
+
       if (output->state.created)
          WLC_INTERFACE_EMIT(output.context.created, convert_to_wlc_handle(output));
 
@@ -643,6 +1634,8 @@ wlc_output_set_information(struct wlc_output *output, struct wlc_output_informat
       wlc_log(WLC_LOG_INFO, "%s Chose mode (%u) %dx%d", output->information.name.data, output->active.mode, mode->width, mode->height);
       output->mode = (struct wlc_size){ mode->width, mode->height };
       mode->flags |= WL_OUTPUT_MODE_CURRENT;
+      // refresh is in mHz
+      output->schedule.refresh = (mode->refresh > 0 ? 1000 * NSEC_PER_SEC / mode->refresh : NSEC_PER_SEC / 60);
       set_resolution = wlc_output_set_resolution_ptr(output, &output->mode);
    }
 
@@ -685,6 +1678,7 @@ wlc_output_unlink_view(struct wlc_output *output, struct wlc_view *view)
 
    remove_from_pool(&output->views, convert_to_wlc_handle(view));
    remove_from_pool(&output->mutable, convert_to_wlc_handle(view));
+   wlc_output_damage_view(output, view);
    wlc_output_schedule_repaint(output);
 }
 
@@ -701,6 +1695,9 @@ wlc_output_link_view(struct wlc_output *output, struct wlc_view *view, enum outp
       remove_from_pool(&old->views, convert_to_wlc_handle(view));
       if (old != output)
          remove_from_pool(&old->mutable, convert_to_wlc_handle(view));
+
+      wlc_output_damage_view(old, view);
+      wlc_output_schedule_repaint(old);
    }
 
    bool added = false;
@@ -737,9 +1734,55 @@ wlc_output_link_view(struct wlc_output *output, struct wlc_view *view, enum outp
       return;
 
    attach_view(output, view);
+   wlc_output_damage_view(output, view);
    wlc_output_schedule_repaint(output);
 }
 
+static int
+cmp_u64(const void *a, const void *b)
+{
+   const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+   return (x > y) - (x < y);
+}
+
+static void
+frame_timing(const uint64_t *samples, uint32_t count, struct wlc_frame_timing *out_timing)
+{
+   assert(samples && out_timing);
+   memset(out_timing, 0, sizeof(struct wlc_frame_timing));
+
+   if (!count)
+      return;
+
+   uint64_t sorted[OUTPUT_FRAME_STATS_HISTORY];
+   memcpy(sorted, samples, count * sizeof(uint64_t));
+   qsort(sorted, count, sizeof(uint64_t), cmp_u64);
+
+   out_timing->min = sorted[0];
+   out_timing->median = sorted[(count - 1) / 2];
+   out_timing->p90 = sorted[(count - 1) * 90 / 100];
+   out_timing->p99 = sorted[(count - 1) * 99 / 100];
+   out_timing->max = sorted[count - 1];
+}
+
+bool
+wlc_output_get_frame_stats_ptr(struct wlc_output *output, struct wlc_output_frame_stats *out_stats)
+{
+   assert(out_stats);
+   memset(out_stats, 0, sizeof(struct wlc_output_frame_stats));
+
+   if (!output)
+      return false;
+
+   // Order does not matter for the distribution, so the ring buffer can be used as is
+   frame_timing(output->stats.repaint, output->stats.frames, &out_stats->repaint);
+   frame_timing(output->stats.swap, output->stats.frames, &out_stats->swap);
+   frame_timing(output->stats.flip, output->stats.frames, &out_stats->flip);
+   out_stats->missed = output->stats.missed;
+   out_stats->frames = output->stats.frames;
+   return true;
+}
+
 bool
 wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *resolution)
 {
@@ -762,14 +1805,12 @@ wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *
       return false;
    }
 
-   free(output->blit);
-   except(output->blit = calloc(1, gsz));
-
    struct wlc_size old = output->resolution;
    output->resolution = *resolution;
 
    output_push_to_resources(output);
    WLC_INTERFACE_EMIT(output.resolution, convert_to_wlc_handle(output), &old, &output->resolution);
+   wlc_output_damage_all(output);
    wlc_output_schedule_repaint(output);
    return true;
 }
@@ -788,10 +1829,15 @@ wlc_output_set_sleep_ptr(struct wlc_output *output, bool sleep)
       return;
    }
 
+   // Cursor plane is turned off with the output, pointer uploads the cursor again on wake up
+   if (sleep)
+      wlc_output_hide_cursor(output);
+
    if (output->bsurface.api.sleep)
       output->bsurface.api.sleep(&output->bsurface, sleep);
 
    if (!(output->state.sleeping = sleep)) {
+      wlc_output_damage_all(output);
       wlc_output_schedule_repaint(output);
       wlc_log(WLC_LOG_INFO, "Output (%p) wake up", output);
    } else {
@@ -811,6 +1857,7 @@ wlc_output_set_mask_ptr(struct wlc_output *output, uint32_t mask)
       return;
 
    output->active.mask = mask;
+   wlc_output_damage_all(output);
    wlc_output_schedule_repaint(output);
 }
 
@@ -824,6 +1871,7 @@ wlc_output_set_views_ptr(struct wlc_output *output, const wlc_handle *views, siz
    chck_iter_pool_for_each(&output->views, h)
       attach_view(output, convert_from_wlc_handle(*h, "view"));
 
+   wlc_output_damage_all(output);
    wlc_output_schedule_repaint(output);
    return true;
 }
@@ -862,6 +1910,90 @@ get(struct wlc_output *output, size_t offset)
    return (output ? ((char*)output + offset) : NULL);
 }
 
+bool
+wlc_output_read_pixels_ptr(struct wlc_output *output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg), void *arg)
+{
+   assert(geometry && done);
+
+   if (!output || !output->render.api.readback_start)
+      return false;
+
+   struct output_readback r = { .readback = { .geometry = *geometry, .format = format }, .done = done, .arg = arg };
+   if (!chck_iter_pool_push_back(&output->readbacks, &r))
+      return false;
+
+   // Queued from a render event, started with the frame being drawn
+   if (rendering_output != output)
+      wlc_output_schedule_repaint(output);
+
+   return true;
+}
+
+bool
+wlc_output_export_dmabuf_ptr(struct wlc_output *output, void (*done)(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg), void *arg)
+{
+   assert(done);
+
+   if (!output || !output->render.api.export_dmabuf)
+      return false;
+
+   struct output_export e = { .done = done, .arg = arg };
+   if (!chck_iter_pool_push_back(&output->exports.requests, &e))
+      return false;
+
+   // Queued from a render event, exported with the frame being drawn
+   if (rendering_output != output)
+      wlc_output_schedule_repaint(output);
+
+   return true;
+}
+
+struct get_pixels {
+   bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg);
+   void *arg;
+};
+
+static void
+get_pixels_done(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg)
+{
+   assert(geometry && arg);
+   struct get_pixels *gp = arg;
+
+   uint8_t *rgba = NULL;
+   if (data && (rgba = malloc(geometry->size.w * geometry->size.h * 4))) {
+      const size_t row = geometry->size.w * 4;
+      for (uint32_t y = 0; y < geometry->size.h; ++y)
+         memcpy(rgba + y * row, (const uint8_t*)data + (ptrdiff_t)y * stride, row);
+   }
+
+   const bool again = gp->pixels(&geometry->size, rgba, gp->arg);
+   free(rgba);
+
+   struct wlc_output *o;
+   if (!again || !rgba || !(o = convert_from_wlc_handle(output, "output")) ||
+       !wlc_output_read_pixels_ptr(o, WLC_RGBA8888, &(struct wlc_geometry){ wlc_point_zero, o->mode }, get_pixels_done, gp))
+      free(gp);
+}
+
+void
+wlc_output_get_pixels_ptr(struct wlc_output *output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg)
+{
+   assert(pixels);
+
+   if (!output)
+      return;
+
+   struct get_pixels *gp;
+   if (!(gp = calloc(1, sizeof(struct get_pixels))))
+      return;
+
+   gp->pixels = pixels;
+   gp->arg = arg;
+
+   if (!wlc_output_read_pixels_ptr(output, WLC_RGBA8888, &(struct wlc_geometry){ wlc_point_zero, output->mode }, get_pixels_done, gp))
+      free(gp);
+}
+
 WLC_API const struct wlc_size*
 wlc_output_get_resolution(wlc_handle output)
 {
@@ -874,6 +2006,12 @@ wlc_output_set_resolution(wlc_handle output, const struct wlc_size *resolution)
    wlc_output_set_resolution_ptr(convert_from_wlc_handle(output, "output"), resolution);
 }
 
+WLC_API bool
+wlc_output_get_frame_stats(wlc_handle output, struct wlc_output_frame_stats *out_stats)
+{
+   return wlc_output_get_frame_stats_ptr(convert_from_wlc_handle(output, "output"), out_stats);
+}
+
 WLC_API bool
 wlc_output_get_sleep(wlc_handle output)
 {
@@ -954,19 +2092,36 @@ wlc_output_release(struct wlc_output *output)
    if (!output)
       return;
 
-   if (output->timer.idle)
-      wl_event_source_remove(output->timer.idle);
+   if (output->timer.repaint) {
+      wl_event_source_remove(output->timer.repaint);
+      close(output->timer.fd);
+   }
 
    wlc_output_set_information(output, NULL);
+   cancel_readbacks(output);
+   finish_exports(output, true);
    wlc_output_set_backend_surface(output, NULL);
    chck_iter_pool_release(&output->surfaces);
    chck_iter_pool_release(&output->views);
    chck_iter_pool_release(&output->mutable);
    chck_iter_pool_release(&output->visible);
    chck_iter_pool_release(&output->callbacks);
-
-   free(output->blit);
-   output->blit = NULL;
+   wlc_presentation_feedback_discard_all(&output->feedbacks);
+   wlc_presentation_feedback_discard_all(&output->zero_copy);
+   chck_iter_pool_release(&output->feedbacks);
+   chck_iter_pool_release(&output->zero_copy);
+   chck_iter_pool_release(&output->readbacks);
+   chck_iter_pool_release(&output->exports.requests);
+   chck_iter_pool_release(&output->scanout.pending);
+   chck_iter_pool_release(&output->scanout.current);
+   chck_iter_pool_release(&output->scanout.overlays);
+
+   pixman_region32_fini(&output->damage.current);
+   for (uint32_t i = 0; i < OUTPUT_DAMAGE_HISTORY; ++i)
+      pixman_region32_fini(&output->damage.previous[i]);
+
+   if (output->cursor.fallback)
+      pixman_image_unref(output->cursor.fallback);
 
    if (output->wl.output)
       wl_global_destroy(output->wl.output);
@@ -978,9 +2133,19 @@ bool
 wlc_output(struct wlc_output *output)
 {
    assert(output);
+   output->exports.fence = -1;
+
+   pixman_region32_init(&output->damage.current);
+   for (uint32_t i = 0; i < OUTPUT_DAMAGE_HISTORY; ++i)
+      pixman_region32_init(&output->damage.previous[i]);
+
+   if ((output->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+      goto fail;
 
-   if (!(output->timer.idle = wl_event_loop_add_timer(wlc_event_loop(), cb_idle_timer, (void*)convert_to_wlc_handle(output))))
+   if (!(output->timer.repaint = wl_event_loop_add_fd(wlc_event_loop(), output->timer.fd, WL_EVENT_READABLE, cb_repaint_timer, (void*)convert_to_wlc_handle(output)))) {
+      close(output->timer.fd);
       goto fail;
+   }
 
    if (!(output->wl.output = wl_global_create(wlc_display(), &wl_output_interface, 2, output, wl_output_bind)))
       goto fail;
@@ -992,11 +2157,19 @@ wlc_output(struct wlc_output *output)
        !chck_iter_pool(&output->views, 4, 0, sizeof(wlc_handle)) ||
        !chck_iter_pool(&output->mutable, 4, 0, sizeof(wlc_handle)) ||
        !chck_iter_pool(&output->callbacks, 32, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->feedbacks, 32, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->zero_copy, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->readbacks, 4, 0, sizeof(struct output_readback)) ||
+       !chck_iter_pool(&output->exports.requests, 4, 0, sizeof(struct output_export)) ||
+       !chck_iter_pool(&output->scanout.pending, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->scanout.current, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->scanout.overlays, 4, 0, sizeof(wlc_handle)) ||
        !chck_iter_pool(&output->visible, 32, 0, sizeof(struct wlc_view*)))
       goto fail;
 
    output->active.mode = UINT_MAX;
-   output->state.ims = 41;
+   output->schedule.refresh = NSEC_PER_SEC / 60;
+   output->schedule.margin = DEFAULT_REPAINT_MARGIN;
 
    wlc_output_set_sleep_ptr(output, false);
    wlc_output_set_mask_ptr(output, (1<<0));
@@ -1018,12 +2191,15 @@ wlc_output_render_surface(struct wlc_output *output, struct wlc_surface *surface
    if (!surface->commit.attached)
       return;
 
-   wlc_render_surface_paint(&output->render, &output->context, surface, geometry);
+   if (!wlc_geometry_equals(&surface->painted, geometry)) {
+      // We only know where these surfaces go once they are painted
+      damage_late(output, &surface->painted);
+      damage_late(output, geometry);
+      surface->painted = *geometry;
+   }
 
-   wlc_resource *r;
-   chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
-      chck_iter_pool_push_back(callbacks, r);
-   chck_iter_pool_flush(&surface->commit.frame_cbs);
+   wlc_render_surface_paint(&output->render, &output->context, surface, geometry);
+   surface_take_frame_callbacks(output, surface, callbacks);
 }
 
 struct wlc_output*
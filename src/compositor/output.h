@@ -2,6 +2,7 @@
 #define _WLC_OUTPUT_H_
 
 #include <stdint.h>
+#include <pixman.h>
 #include <wayland-util.h>
 #include <chck/string/string.h>
 #include <chck/pool/pool.h>
@@ -16,6 +17,15 @@ struct wlc_surface;
 struct wlc_buffer;
 struct timespec;
 
+// Number of previous frames we keep damage for (EGL_EXT_buffer_age)
+#define OUTPUT_DAMAGE_HISTORY 4
+
+// Number of previous repaints used to estimate the repaint cost
+#define OUTPUT_REPAINT_COST_HISTORY 16
+
+// Number of previous frames wlc_output_get_frame_stats is computed from
+#define OUTPUT_FRAME_STATS_HISTORY 128
+
 enum output_link {
    LINK_BELOW,
    LINK_ABOVE,
@@ -51,14 +61,73 @@ struct wlc_output {
    struct chck_iter_pool surfaces, views, mutable;
    struct chck_iter_pool callbacks, visible;
 
-   // Pixel blit buffer size of current resolution
-   // Used to do visibility checks
-   bool *blit;
+   // Presentation feedbacks for the frame in flight, zero_copy for surfaces shown straight from their buffer
+   struct chck_iter_pool feedbacks, zero_copy;
+
+   // Pixel readbacks, started once the frame is drawn and delivered after it's presented
+   struct chck_iter_pool readbacks;
+
+   // Dmabuf exports, same as readbacks but a single export serves every request of a frame
+   struct {
+      struct chck_iter_pool requests;
+      struct wlc_dmabuf_attributes attributes;
+      int32_t fence;
+      bool exported;
+   } exports;
 
    struct {
-      struct wl_event_source *idle;
+      struct wl_event_source *repaint;
+      int fd; // timerfd
    } timer;
 
+   // Cursor is on the hardware cursor plane of the backend surface, or composited into the last frame
+   // captures counts the screen captures that need the cursor composited into the frames
+   struct {
+      pixman_image_t *fallback; // default cursor, drawn once
+      wlc_resource surface; // surface on the plane, 0 for the default cursor
+      struct wlc_point hotspot;
+      uint32_t captures;
+      bool visible, composited, changed; // changed is set when the surface on the plane gets a new buffer
+   } cursor;
+
+   // Client buffers shown directly by the backend, scanned out or on overlay planes
+   // Buffers are held until they leave the screen, pending are in flight and current on screen
+   // captures counts the screen captures that read back composited frames
+   struct {
+      struct chck_iter_pool pending, current; // wlc_resource
+      struct chck_iter_pool overlays; // views lifted onto overlay planes in last frame
+      uint32_t captures;
+      bool active; // last frame was scanned out
+   } scanout;
+
+   // Frame scheduling, times are nanoseconds of CLOCK_MONOTONIC
+   // Repaint is started just in time to make the next vblank.
+   struct {
+      uint64_t refresh; // refresh interval of current mode
+      uint64_t target; // vblank the scheduled repaint aims for, 0 if unknown
+      uint64_t margin; // time reserved on top of the repaint cost, grows when vblanks are missed
+      uint64_t cost[OUTPUT_REPAINT_COST_HISTORY];
+      uint32_t cost_index;
+      bool vsync; // last frame was presented on vblank, without it only the nominal rate is kept
+   } schedule;
+
+   // Rolling frame statistics, times are nanoseconds
+   struct {
+      uint64_t repaint[OUTPUT_FRAME_STATS_HISTORY];
+      uint64_t swap[OUTPUT_FRAME_STATS_HISTORY];
+      uint64_t flip[OUTPUT_FRAME_STATS_HISTORY];
+      uint64_t swapped; // when the frame in flight was swapped, 0 if none
+      uint64_t missed;
+      uint32_t index, frames;
+   } stats;
+
+   // Damage in output coordinates
+   // current is accumulated until next repaint, previous holds damage of the last frames (newest first)
+   struct {
+      pixman_region32_t current;
+      pixman_region32_t previous[OUTPUT_DAMAGE_HISTORY];
+   } damage;
+
    struct {
       struct wl_global *output;
    } wl;
@@ -71,8 +140,7 @@ struct wlc_output {
    } task;
 
    struct {
-      float ims;
-      uint32_t frame_time;
+      uint64_t frame_time; // nanoseconds (CLOCK_MONOTONIC) of the last presented frame
       bool pending, scheduled, activity, sleeping;
       bool background_visible;
       bool created;
@@ -88,10 +156,19 @@ WLC_NONULL bool wlc_output_information(struct wlc_output_information *info);
 void wlc_output_information_release(struct wlc_output_information *info);
 WLC_NONULL bool wlc_output_information_add_mode(struct wlc_output_information *info, struct wlc_output_mode *mode);
 
-WLC_NONULLV(2) void wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts);
+WLC_NONULLV(2) bool wlc_output_get_frame_stats_ptr(struct wlc_output *output, struct wlc_output_frame_stats *out_stats);
+WLC_NONULLV(2) void wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts, uint64_t seq, uint32_t flags);
 void wlc_output_schedule_repaint(struct wlc_output *output);
+WLC_NONULLV(2) void wlc_output_damage(struct wlc_output *output, const struct wlc_geometry *geometry);
+WLC_NONULLV(2) void wlc_output_damage_view(struct wlc_output *output, struct wlc_view *view);
+void wlc_output_damage_all(struct wlc_output *output);
 WLC_NONULLV(2) bool wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface, struct wlc_buffer *buffer);
 WLC_NONULLV(2) void wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surface);
+WLC_NONULLV(1,3,4) bool wlc_output_set_cursor(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_point *hotspot, const struct wlc_point *pos);
+WLC_NONULL bool wlc_output_move_cursor(struct wlc_output *output, const struct wlc_point *pos);
+WLC_NONULL void wlc_output_hide_cursor(struct wlc_output *output);
+WLC_NONULL void wlc_output_capture_cursor(struct wlc_output *output, bool capture);
+WLC_NONULL void wlc_output_capture(struct wlc_output *output, bool capture);
 bool wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_surface *surface);
 void wlc_output_set_information(struct wlc_output *output, struct wlc_output_information *info);
 WLC_NONULLV(2) void wlc_output_unlink_view(struct wlc_output *output, struct wlc_view *view);
@@ -104,6 +181,8 @@ void wlc_output_focus_ptr(struct wlc_output *output);
 void wlc_output_set_sleep_ptr(struct wlc_output *output, bool sleep);
 WLC_NONULLV(2) bool wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *resolution);
 void wlc_output_set_mask_ptr(struct wlc_output *output, uint32_t mask);
+WLC_NONULLV(3,4) bool wlc_output_read_pixels_ptr(struct wlc_output *output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg), void *arg);
+WLC_NONULLV(2) bool wlc_output_export_dmabuf_ptr(struct wlc_output *output, void (*done)(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg), void *arg);
 WLC_NONULLV(2) void wlc_output_get_pixels_ptr(struct wlc_output *output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg);
 bool wlc_output_set_views_ptr(struct wlc_output *output, const wlc_handle *views, size_t memb);
 const wlc_handle* wlc_output_get_views_ptr(struct wlc_output *output, size_t *out_memb);
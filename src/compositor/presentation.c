@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <wayland-server.h>
+#include "internal.h"
+#include "macros.h"
+#include "presentation.h"
+#include "compositor/output.h"
+#include "resources/types/surface.h"
+#include "wayland-presentation-time-server-protocol.h"
+
+static_assert_x((uint32_t)WLC_PRESENTATION_VSYNC == (uint32_t)WP_PRESENTATION_FEEDBACK_KIND_VSYNC, presentation_vsync_flag_does_not_match_protocol);
+static_assert_x((uint32_t)WLC_PRESENTATION_HW_CLOCK == (uint32_t)WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK, presentation_hw_clock_flag_does_not_match_protocol);
+static_assert_x((uint32_t)WLC_PRESENTATION_HW_COMPLETION == (uint32_t)WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION, presentation_hw_completion_flag_does_not_match_protocol);
+static_assert_x((uint32_t)WLC_PRESENTATION_ZERO_COPY == (uint32_t)WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY, presentation_zero_copy_flag_does_not_match_protocol);
+
+void
+wlc_presentation_feedback_presented(wlc_resource feedback, struct wlc_output *output, uint64_t time, uint32_t refresh, uint64_t seq, uint32_t flags)
+{
+   assert(output);
+
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_from_wlc_resource(feedback, "presentation-feedback")))
+      return;
+
+   struct wl_resource *r;
+   if ((r = wl_resource_for_client(&output->resources, wl_resource_get_client(resource))))
+      wp_presentation_feedback_send_sync_output(resource, r);
+
+   const uint64_t sec = time / 1000000000;
+   wp_presentation_feedback_send_presented(resource, sec >> 32, sec & 0xffffffff, time % 1000000000, refresh, seq >> 32, seq & 0xffffffff, flags);
+   wlc_resource_release(feedback);
+}
+
+void
+wlc_presentation_feedback_discarded(wlc_resource feedback)
+{
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_from_wlc_resource(feedback, "presentation-feedback")))
+      return;
+
+   wp_presentation_feedback_send_discarded(resource);
+   wlc_resource_release(feedback);
+}
+
+void
+wlc_presentation_feedback_discard_all(struct chck_iter_pool *feedbacks)
+{
+   assert(feedbacks);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(feedbacks, r)
+      wlc_presentation_feedback_discarded(*r);
+   chck_iter_pool_flush(feedbacks);
+}
+
+static void
+wp_cb_presentation_feedback(struct wl_client *client, struct wl_resource *resource, struct wl_resource *surface_resource, uint32_t id)
+{
+   (void)resource;
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wl_resource(surface_resource, "surface")))
+      return;
+
+   wlc_resource r;
+   if (!(r = wlc_resource_create(&surface->feedbacks, client, &wp_presentation_feedback_interface, 1, 1, id)))
+      return;
+
+   wlc_resource_implement(r, NULL, NULL);
+   chck_iter_pool_push_back(&surface->pending.feedbacks, &r);
+}
+
+static const struct wp_presentation_interface wp_presentation_implementation = {
+   .destroy = wlc_cb_resource_destructor,
+   .feedback = wp_cb_presentation_feedback,
+};
+
+static void
+wp_presentation_bind(struct wl_client *client, void *data, unsigned int version, unsigned int id)
+{
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_create_checked(client, &wp_presentation_interface, version, 1, id)))
+      return;
+
+   wl_resource_set_implementation(resource, &wp_presentation_implementation, data, NULL);
+
+   // Frame times from both wlc_get_time and DRM page flip events are CLOCK_MONOTONIC
+   wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+void
+wlc_presentation_release(struct wlc_presentation *presentation)
+{
+   if (!presentation)
+      return;
+
+   if (presentation->wl.presentation)
+      wl_global_destroy(presentation->wl.presentation);
+
+   memset(presentation, 0, sizeof(struct wlc_presentation));
+}
+
+bool
+wlc_presentation(struct wlc_presentation *presentation)
+{
+   assert(presentation);
+   memset(presentation, 0, sizeof(struct wlc_presentation));
+
+   if (!(presentation->wl.presentation = wl_global_create(wlc_display(), &wp_presentation_interface, 1, presentation, wp_presentation_bind)))
+      goto presentation_interface_fail;
+
+   return true;
+
+presentation_interface_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to bind presentation interface");
+   wlc_presentation_release(presentation);
+   return false;
+}
@@ -0,0 +1,35 @@
+#ifndef _WLC_PRESENTATION_H_
+#define _WLC_PRESENTATION_H_
+
+#include <stdint.h>
+#include "resources/resources.h"
+
+struct wlc_output;
+
+/** Flags describing how the frame was presented, these match wp_presentation_feedback.kind. */
+enum wlc_presentation_flags {
+   WLC_PRESENTATION_VSYNC = 1<<0,
+   WLC_PRESENTATION_HW_CLOCK = 1<<1,
+   WLC_PRESENTATION_HW_COMPLETION = 1<<2,
+   WLC_PRESENTATION_ZERO_COPY = 1<<3,
+};
+
+struct wlc_presentation {
+   struct {
+      struct wl_global *presentation;
+   } wl;
+};
+
+/** Send presented event for feedback and destroy it. time and refresh are in nanoseconds. */
+WLC_NONULLV(2) void wlc_presentation_feedback_presented(wlc_resource feedback, struct wlc_output *output, uint64_t time, uint32_t refresh, uint64_t seq, uint32_t flags);
+
+/** Send discarded event for feedback and destroy it. */
+void wlc_presentation_feedback_discarded(wlc_resource feedback);
+
+/** Discard all feedbacks in pool, and flush the pool. */
+WLC_NONULL void wlc_presentation_feedback_discard_all(struct chck_iter_pool *feedbacks);
+
+void wlc_presentation_release(struct wlc_presentation *presentation);
+WLC_NONULL bool wlc_presentation(struct wlc_presentation *presentation);
+
+#endif /* _WLC_PRESENTATION_H_ */
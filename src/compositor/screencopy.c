@@ -0,0 +1,564 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <chck/math/math.h>
+#include "internal.h"
+#include "macros.h"
+#include "screencopy.h"
+#include "compositor/output.h"
+#include "wayland-wlr-screencopy-unstable-v1-server-protocol.h"
+
+// Damage with more rectangles than this is read back as its extents
+static const int MAX_READBACK_RECTS = 8;
+
+struct tracker {
+   struct wl_resource *manager;
+   wlc_handle output;
+   pixman_region32_t damage; // framebuffer pixels
+   struct wl_list link;
+};
+
+struct frame {
+   struct wlc_screencopy *screencopy;
+   struct wl_resource *resource, *manager, *buffer;
+   struct wl_listener buffer_destroy;
+   struct wl_list link; // wlc_screencopy.frames, while waiting for damage
+   pixman_region32_t damage; // area copied, framebuffer pixels
+   struct wlc_geometry region; // framebuffer pixels
+   enum wlc_pixel_format format;
+   wlc_handle output;
+   uint32_t pending; // readbacks in flight
+   bool used, with_damage, failed;
+   bool captured, cursor; // holds a capture (and cursor capture) on the output, see wlc_output_capture
+};
+
+static struct tracker*
+tracker_for(struct wlc_screencopy *screencopy, struct wl_resource *manager, wlc_handle output)
+{
+   assert(screencopy);
+
+   struct tracker *t;
+   wl_list_for_each(t, &screencopy->trackers, link) {
+      if (t->manager == manager && t->output == output)
+         return t;
+   }
+
+   return NULL;
+}
+
+static void
+tracker_free(struct tracker *tracker)
+{
+   assert(tracker);
+   wl_list_remove(&tracker->link);
+   pixman_region32_fini(&tracker->damage);
+   free(tracker);
+}
+
+static void
+frame_free(struct frame *frame)
+{
+   assert(frame && !frame->resource && !frame->pending);
+
+   struct wlc_output *output;
+   if ((frame->captured || frame->cursor) && (output = convert_from_wlc_handle(frame->output, "output"))) {
+      if (frame->captured)
+         wlc_output_capture(output, false);
+
+      if (frame->cursor)
+         wlc_output_capture_cursor(output, false);
+   }
+
+   wl_list_remove(&frame->link);
+   pixman_region32_fini(&frame->damage);
+   free(frame);
+}
+
+static void
+frame_detach_buffer(struct frame *frame)
+{
+   assert(frame);
+
+   if (!frame->buffer)
+      return;
+
+   wl_list_remove(&frame->buffer_destroy.link);
+   frame->buffer = NULL;
+}
+
+static void
+frame_finish(struct frame *frame)
+{
+   assert(frame && !frame->pending);
+
+   if (frame->resource) {
+      if (frame->failed || !frame->buffer) {
+         zwlr_screencopy_frame_v1_send_failed(frame->resource);
+      } else {
+         zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+
+         if (frame->with_damage) {
+            int nrects;
+            const pixman_box32_t *b = pixman_region32_rectangles(&frame->damage, &nrects);
+            for (int i = 0; i < nrects; ++i)
+               zwlr_screencopy_frame_v1_send_damage(frame->resource, b[i].x1 - frame->region.origin.x, b[i].y1 - frame->region.origin.y, b[i].x2 - b[i].x1, b[i].y2 - b[i].y1);
+         }
+
+         // Copy is delivered once the frame was presented, so it carries the flip time
+         struct wlc_output *o;
+         const uint64_t time = ((o = convert_from_wlc_handle(frame->output, "output")) && o->state.frame_time ? o->state.frame_time : wlc_get_time_ns());
+         const uint64_t sec = time / 1000000000;
+         zwlr_screencopy_frame_v1_send_ready(frame->resource, sec >> 32, sec & 0xffffffff, time % 1000000000);
+      }
+   }
+
+   frame_detach_buffer(frame);
+
+   if (!frame->resource)
+      frame_free(frame);
+}
+
+static void
+frame_fail(struct frame *frame)
+{
+   assert(frame);
+   frame->failed = true;
+
+   if (!frame->pending)
+      frame_finish(frame);
+}
+
+static void
+readback_done(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg)
+{
+   (void)output;
+   assert(geometry && arg);
+
+   struct frame *frame = arg;
+   assert(frame->pending > 0);
+   --frame->pending;
+
+   if (!data) {
+      frame->failed = true;
+   } else if (frame->buffer && !frame->failed) {
+      struct wl_shm_buffer *shm = wl_shm_buffer_get(frame->buffer);
+      const int32_t dst_stride = wl_shm_buffer_get_stride(shm);
+      const size_t row = geometry->size.w * 4;
+
+      wl_shm_buffer_begin_access(shm);
+      uint8_t *dst = (uint8_t*)wl_shm_buffer_get_data(shm) + (geometry->origin.y - frame->region.origin.y) * dst_stride + (geometry->origin.x - frame->region.origin.x) * 4;
+      for (uint32_t y = 0; y < geometry->size.h; ++y)
+         memcpy(dst + y * dst_stride, (const uint8_t*)data + (ptrdiff_t)y * stride, row);
+      wl_shm_buffer_end_access(shm);
+   }
+
+   if (!frame->pending)
+      frame_finish(frame);
+}
+
+static void
+frame_copy_region(struct frame *frame, struct wlc_output *output, pixman_region32_t *region)
+{
+   assert(frame && output && region);
+
+   pixman_region32_intersect_rect(&frame->damage, region, frame->region.origin.x, frame->region.origin.y, frame->region.size.w, frame->region.size.h);
+
+   int nrects;
+   pixman_box32_t *boxes = pixman_region32_rectangles(&frame->damage, &nrects);
+
+   if (nrects > MAX_READBACK_RECTS) {
+      boxes = pixman_region32_extents(&frame->damage);
+      nrects = 1;
+   }
+
+   for (int i = 0; i < nrects; ++i) {
+      const struct wlc_geometry g = { { boxes[i].x1, boxes[i].y1 }, { boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 } };
+      if (wlc_output_read_pixels_ptr(output, frame->format, &g, readback_done, frame)) {
+         ++frame->pending;
+      } else {
+         frame->failed = true;
+      }
+   }
+
+   if (!frame->pending)
+      frame_finish(frame);
+}
+
+static void
+cb_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+   (void)data;
+   struct frame *frame;
+   except(frame = wl_container_of(listener, frame, buffer_destroy));
+   frame_detach_buffer(frame);
+}
+
+static void
+frame_copy(struct wl_resource *resource, struct wl_resource *buffer, bool with_damage)
+{
+   struct frame *frame;
+   if (!(frame = wl_resource_get_user_data(resource)))
+      return;
+
+   if (frame->used) {
+      wl_resource_post_error(resource, ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED, "frame already used");
+      return;
+   }
+
+   // Already failed, client is expected to destroy the frame
+   if (frame->failed)
+      return;
+
+   struct wl_shm_buffer *shm;
+   if (!(shm = wl_shm_buffer_get(buffer)) ||
+       (wl_shm_buffer_get_format(shm) != WL_SHM_FORMAT_XRGB8888 && wl_shm_buffer_get_format(shm) != WL_SHM_FORMAT_ARGB8888) ||
+       (uint32_t)wl_shm_buffer_get_width(shm) != frame->region.size.w ||
+       (uint32_t)wl_shm_buffer_get_height(shm) != frame->region.size.h ||
+       wl_shm_buffer_get_stride(shm) < (int32_t)frame->region.size.w * 4) {
+      wl_resource_post_error(resource, ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER, "invalid buffer attributes");
+      return;
+   }
+
+   frame->used = true;
+   frame->with_damage = with_damage;
+   frame->format = (wl_shm_buffer_get_format(shm) == WL_SHM_FORMAT_ARGB8888 ? WLC_BGRA8888 : WLC_XRGB8888);
+   frame->buffer = buffer;
+   frame->buffer_destroy.notify = cb_buffer_destroyed;
+   wl_resource_add_destroy_listener(buffer, &frame->buffer_destroy);
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle(frame->output, "output"))) {
+      frame_fail(frame);
+      return;
+   }
+
+   struct tracker *t = tracker_for(frame->screencopy, frame->manager, frame->output);
+
+   if (!with_damage) {
+      // Whole region is copied, damage since last copy starts over
+      if (t)
+         pixman_region32_clear(&t->damage);
+
+      pixman_region32_t region;
+      pixman_region32_init_rect(&region, frame->region.origin.x, frame->region.origin.y, frame->region.size.w, frame->region.size.h);
+      frame_copy_region(frame, output, &region);
+      pixman_region32_fini(&region);
+      return;
+   }
+
+   if (!t) {
+      if (!(t = calloc(1, sizeof(struct tracker)))) {
+         wl_client_post_no_memory(wl_resource_get_client(resource));
+         frame_fail(frame);
+         return;
+      }
+
+      // First copy of this manager, everything is damaged
+      t->manager = frame->manager;
+      t->output = frame->output;
+      pixman_region32_init_rect(&t->damage, 0, 0, output->mode.w, output->mode.h);
+      wl_list_insert(&frame->screencopy->trackers, &t->link);
+   }
+
+   wl_list_insert(&frame->screencopy->frames, &frame->link);
+
+   // Damage from earlier frames can be copied from the next one
+   pixman_region32_t area;
+   pixman_region32_init(&area);
+   pixman_region32_intersect_rect(&area, &t->damage, frame->region.origin.x, frame->region.origin.y, frame->region.size.w, frame->region.size.h);
+
+   if (pixman_region32_not_empty(&area))
+      wlc_output_schedule_repaint(output);
+
+   pixman_region32_fini(&area);
+}
+
+static void
+zwlr_screencopy_frame_cb_copy(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer)
+{
+   (void)client;
+   frame_copy(resource, buffer, false);
+}
+
+static void
+zwlr_screencopy_frame_cb_copy_with_damage(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer)
+{
+   (void)client;
+   frame_copy(resource, buffer, true);
+}
+
+static const struct zwlr_screencopy_frame_v1_interface zwlr_screencopy_frame_implementation = {
+   .copy = zwlr_screencopy_frame_cb_copy,
+   .destroy = wlc_cb_resource_destructor,
+   .copy_with_damage = zwlr_screencopy_frame_cb_copy_with_damage,
+};
+
+static void
+frame_resource_destroyed(struct wl_resource *resource)
+{
+   struct frame *frame;
+   if (!(frame = wl_resource_get_user_data(resource)))
+      return;
+
+   // Readbacks in flight keep the frame alive, it's freed by the last one
+   frame->resource = NULL;
+   wl_list_remove(&frame->link);
+   wl_list_init(&frame->link);
+   frame_detach_buffer(frame);
+
+   if (!frame->pending)
+      frame_free(frame);
+}
+
+WLC_CONST static int64_t
+to_mode(int64_t v, uint32_t mode, uint32_t resolution, bool round_up)
+{
+   if (!resolution)
+      return 0;
+
+   const int64_t scaled = (v * mode + (round_up && v > 0 ? resolution - 1 : 0)) / resolution;
+   return chck_clamp(scaled, 0, (int64_t)mode);
+}
+
+static void
+capture(struct wl_client *client, struct wl_resource *manager, uint32_t id, struct wl_resource *output_resource, const struct wlc_geometry *geometry, bool overlay_cursor)
+{
+   struct wlc_screencopy *screencopy;
+   if (!(screencopy = wl_resource_get_user_data(manager)))
+      return;
+
+   struct frame *frame;
+   if (!(frame = calloc(1, sizeof(struct frame)))) {
+      wl_client_post_no_memory(client);
+      return;
+   }
+
+   pixman_region32_init(&frame->damage);
+   wl_list_init(&frame->link);
+
+   if (!(frame->resource = wl_resource_create(client, &zwlr_screencopy_frame_v1_interface, wl_resource_get_version(manager), id))) {
+      frame_free(frame);
+      wl_client_post_no_memory(client);
+      return;
+   }
+
+   frame->screencopy = screencopy;
+   frame->manager = manager;
+   frame->output = (wlc_handle)wl_resource_get_user_data(output_resource);
+   wl_resource_set_implementation(frame->resource, &zwlr_screencopy_frame_implementation, frame, frame_resource_destroyed);
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle(frame->output, "output")) || !output->bsurface.display) {
+      frame_fail(frame);
+      return;
+   }
+
+   frame->region = (struct wlc_geometry){ wlc_point_zero, output->mode };
+
+   if (geometry) {
+      // Logical coordinates to framebuffer pixels, rounded outwards
+      const struct wlc_size *r = &output->resolution, *m = &output->mode;
+      const int64_t x1 = to_mode(geometry->origin.x, m->w, r->w, false);
+      const int64_t y1 = to_mode(geometry->origin.y, m->h, r->h, false);
+      const int64_t x2 = to_mode((int64_t)geometry->origin.x + geometry->size.w, m->w, r->w, true);
+      const int64_t y2 = to_mode((int64_t)geometry->origin.y + geometry->size.h, m->h, r->h, true);
+      frame->region = (struct wlc_geometry){ { x1, y1 }, { (x2 > x1 ? x2 - x1 : 0), (y2 > y1 ? y2 - y1 : 0) } };
+   }
+
+   if (!frame->region.size.w || !frame->region.size.h) {
+      frame_fail(frame);
+      return;
+   }
+
+   // Copies come from the composited frame, which has to exist (and contain the cursor if asked)
+   wlc_output_capture(output, true);
+   frame->captured = true;
+
+   if (overlay_cursor) {
+      wlc_output_capture_cursor(output, true);
+      frame->cursor = true;
+   }
+
+   zwlr_screencopy_frame_v1_send_buffer(frame->resource, WL_SHM_FORMAT_XRGB8888, frame->region.size.w, frame->region.size.h, frame->region.size.w * 4);
+}
+
+static void
+zwlr_screencopy_manager_cb_capture_output(struct wl_client *client, struct wl_resource *resource, uint32_t frame, int32_t overlay_cursor, struct wl_resource *output)
+{
+   capture(client, resource, frame, output, NULL, overlay_cursor);
+}
+
+static void
+zwlr_screencopy_manager_cb_capture_output_region(struct wl_client *client, struct wl_resource *resource, uint32_t frame, int32_t overlay_cursor, struct wl_resource *output, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   capture(client, resource, frame, output, &(struct wlc_geometry){ { x, y }, { chck_max32(width, 0), chck_max32(height, 0) } }, overlay_cursor);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface zwlr_screencopy_manager_implementation = {
+   .capture_output = zwlr_screencopy_manager_cb_capture_output,
+   .capture_output_region = zwlr_screencopy_manager_cb_capture_output_region,
+   .destroy = wlc_cb_resource_destructor,
+};
+
+static void
+manager_resource_destroyed(struct wl_resource *resource)
+{
+   // Resources may outlive the global on shutdown
+   struct wlc_screencopy *screencopy;
+   if (!(screencopy = wl_resource_get_user_data(resource)) || !screencopy->wl.manager)
+      return;
+
+   struct tracker *t, *tn;
+   wl_list_for_each_safe(t, tn, &screencopy->trackers, link) {
+      if (t->manager == resource)
+         tracker_free(t);
+   }
+
+   // Frames outlive the manager, without it the whole region counts as damaged
+   struct frame *f;
+   wl_list_for_each(f, &screencopy->frames, link) {
+      if (f->manager == resource)
+         f->manager = NULL;
+   }
+}
+
+static void
+zwlr_screencopy_manager_bind(struct wl_client *client, void *data, unsigned int version, unsigned int id)
+{
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_create_checked(client, &zwlr_screencopy_manager_v1_interface, version, 2, id)))
+      return;
+
+   wl_resource_set_implementation(resource, &zwlr_screencopy_manager_implementation, data, manager_resource_destroyed);
+}
+
+static void
+render_event(struct wl_listener *listener, void *data)
+{
+   struct wlc_screencopy *screencopy;
+   except(screencopy = wl_container_of(listener, screencopy, listener.render));
+
+   struct wlc_render_event *ev = data;
+   if (ev->type != WLC_RENDER_EVENT_DAMAGE)
+      return;
+
+   const wlc_handle output = convert_to_wlc_handle(ev->output);
+
+   struct tracker *t;
+   wl_list_for_each(t, &screencopy->trackers, link) {
+      if (t->output == output)
+         pixman_region32_union(&t->damage, &t->damage, ev->damage);
+   }
+
+   struct frame *f, *fn;
+   wl_list_for_each_safe(f, fn, &screencopy->frames, link) {
+      if (f->output != output)
+         continue;
+
+      pixman_region32_t area;
+      if ((t = tracker_for(screencopy, f->manager, output))) {
+         pixman_region32_init(&area);
+         pixman_region32_intersect_rect(&area, &t->damage, f->region.origin.x, f->region.origin.y, f->region.size.w, f->region.size.h);
+      } else {
+         pixman_region32_init_rect(&area, f->region.origin.x, f->region.origin.y, f->region.size.w, f->region.size.h);
+      }
+
+      if (pixman_region32_not_empty(&area)) {
+         if (t)
+            pixman_region32_subtract(&t->damage, &t->damage, &area);
+
+         wl_list_remove(&f->link);
+         wl_list_init(&f->link);
+         frame_copy_region(f, ev->output, &area);
+      }
+
+      pixman_region32_fini(&area);
+   }
+}
+
+static void
+output_event(struct wl_listener *listener, void *data)
+{
+   struct wlc_screencopy *screencopy;
+   except(screencopy = wl_container_of(listener, screencopy, listener.output));
+
+   struct wlc_output_event *ev = data;
+   if (ev->type != WLC_OUTPUT_EVENT_REMOVE)
+      return;
+
+   const wlc_handle output = convert_to_wlc_handle(ev->remove.output);
+
+   struct tracker *t, *tn;
+   wl_list_for_each_safe(t, tn, &screencopy->trackers, link) {
+      if (t->output == output)
+         tracker_free(t);
+   }
+
+   struct frame *f, *fn;
+   wl_list_for_each_safe(f, fn, &screencopy->frames, link) {
+      if (f->output != output)
+         continue;
+
+      wl_list_remove(&f->link);
+      wl_list_init(&f->link);
+      frame_fail(f);
+   }
+}
+
+void
+wlc_screencopy_release(struct wlc_screencopy *screencopy)
+{
+   if (!screencopy)
+      return;
+
+   if (screencopy->listener.render.notify) {
+      wl_list_remove(&screencopy->listener.render.link);
+      wl_list_remove(&screencopy->listener.output.link);
+   }
+
+   if (screencopy->trackers.next) {
+      struct tracker *t, *tn;
+      wl_list_for_each_safe(t, tn, &screencopy->trackers, link)
+         tracker_free(t);
+   }
+
+   if (screencopy->frames.next) {
+      struct frame *f, *fn;
+      wl_list_for_each_safe(f, fn, &screencopy->frames, link) {
+         wl_list_remove(&f->link);
+         wl_list_init(&f->link);
+         f->manager = NULL;
+      }
+   }
+
+   if (screencopy->wl.manager)
+      wl_global_destroy(screencopy->wl.manager);
+
+   memset(screencopy, 0, sizeof(struct wlc_screencopy));
+}
+
+bool
+wlc_screencopy(struct wlc_screencopy *screencopy)
+{
+   assert(screencopy);
+   memset(screencopy, 0, sizeof(struct wlc_screencopy));
+   wl_list_init(&screencopy->frames);
+   wl_list_init(&screencopy->trackers);
+
+   screencopy->listener.render.notify = render_event;
+   screencopy->listener.output.notify = output_event;
+   wl_signal_add(&wlc_system_signals()->render, &screencopy->listener.render);
+   wl_signal_add(&wlc_system_signals()->output, &screencopy->listener.output);
+
+   if (!(screencopy->wl.manager = wl_global_create(wlc_display(), &zwlr_screencopy_manager_v1_interface, 2, screencopy, zwlr_screencopy_manager_bind)))
+      goto screencopy_interface_fail;
+
+   return true;
+
+screencopy_interface_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to bind screencopy interface");
+   wlc_screencopy_release(screencopy);
+   return false;
+}
@@ -0,0 +1,28 @@
+#ifndef _WLC_SCREENCOPY_H_
+#define _WLC_SCREENCOPY_H_
+
+#include <stdbool.h>
+#include <wayland-server.h>
+#include <wlc/defines.h>
+
+struct wlc_screencopy {
+   // Frames that wait for damage (copy_with_damage)
+   struct wl_list frames;
+
+   // Damage accumulated per manager resource and output, see zwlr_screencopy_frame_v1.damage
+   struct wl_list trackers;
+
+   struct {
+      struct wl_listener render;
+      struct wl_listener output;
+   } listener;
+
+   struct {
+      struct wl_global *manager;
+   } wl;
+};
+
+void wlc_screencopy_release(struct wlc_screencopy *screencopy);
+WLC_NONULL bool wlc_screencopy(struct wlc_screencopy *screencopy);
+
+#endif /* _WLC_SCREENCOPY_H_ */
@@ -132,33 +132,124 @@ surface_under_pointer(struct wlc_pointer *pointer, struct wlc_output *output, st
    return false;
 }
 
+static void
+cursor_position(struct wlc_pointer *pointer, struct wlc_output *output, struct wlc_point *out_pos)
+{
+   assert(pointer && output && out_pos);
+   out_pos->x = chck_clamp(pointer->pos.x, 0, output->resolution.w);
+   out_pos->y = chck_clamp(pointer->pos.y, 0, output->resolution.h);
+}
+
+static void
+cursor_geometry(struct wlc_pointer *pointer, struct wlc_output *output, struct wlc_geometry *out_geometry)
+{
+   assert(pointer && output && out_geometry);
+
+   struct wlc_point pos;
+   cursor_position(pointer, output, &pos);
+
+   struct wlc_surface *surface;
+   if ((surface = convert_from_wlc_resource(pointer->surface, "surface"))) {
+      *out_geometry = (struct wlc_geometry){ .origin = { pos.x - pointer->tip.x, pos.y - pointer->tip.y }, surface->size };
+   } else {
+      // Size of the default cursor
+      *out_geometry = (struct wlc_geometry){ .origin = pos, { 14, 14 } };
+   }
+}
+
+static void
+damage_cursor(struct wlc_pointer *pointer, struct wlc_output *output)
+{
+   assert(pointer);
+
+   struct wlc_output *old;
+   if ((old = convert_from_wlc_handle(pointer->painted.output, "output"))) {
+      wlc_output_damage(old, &pointer->painted.geometry);
+
+      if (old != output)
+         wlc_output_schedule_repaint(old);
+   }
+
+   if (!output)
+      return;
+
+   struct wlc_geometry g;
+   cursor_geometry(pointer, output, &g);
+   wlc_output_damage(output, &g);
+}
+
+static bool
+move_hw_cursor(struct wlc_pointer *pointer, struct wlc_output *output)
+{
+   assert(pointer);
+
+   if (!output || !pointer->painted.hw || pointer->painted.output != convert_to_wlc_handle(output))
+      return false;
+
+   struct wlc_point pos;
+   cursor_position(pointer, output, &pos);
+   return wlc_output_move_cursor(output, &pos);
+}
+
 static void
 pointer_paint(struct wlc_pointer *pointer, struct wlc_output *output)
 {
    assert(output);
 
-   if (!pointer || output != active_output(pointer))
+   if (!pointer)
       return;
 
-   const struct wlc_point pos = {
-      chck_clamp(pointer->pos.x, 0, output->resolution.w),
-      chck_clamp(pointer->pos.y, 0, output->resolution.h)
-   };
+   if (output != active_output(pointer)) {
+      wlc_output_hide_cursor(output);
+      output->cursor.composited = false;
+      return;
+   }
+
+   struct wlc_point pos;
+   struct wlc_geometry g;
+   cursor_position(pointer, output, &pos);
+   cursor_geometry(pointer, output, &g);
 
    struct wlc_view *view = convert_from_wlc_handle(pointer->focused.view, "view");
    struct wlc_surface *surface;
 
+   const bool was_hw = (pointer->painted.hw && pointer->painted.output == convert_to_wlc_handle(output));
+   const struct wlc_geometry old = pointer->painted.geometry;
+   bool hw = false;
+
+   pointer->painted.output = convert_to_wlc_handle(output);
+   pointer->painted.geometry = g;
+
    if ((surface = convert_from_wlc_resource(pointer->surface, "surface"))) {
       if (surface->output != convert_to_wlc_handle(output) && !wlc_surface_attach_to_output(surface, output, wlc_surface_get_buffer(surface))) {
          // Fallback
-         wlc_render_pointer_paint(&output->render, &output->context, &pos);
-      } else {
-         wlc_output_render_surface(output, surface, &(struct wlc_geometry){ .origin = { pos.x - pointer->tip.x, pos.y - pointer->tip.y }, surface->size }, &output->callbacks);
+         wlc_output_hide_cursor(output);
+         wlc_render_pointer_paint(&output->render, &output->context, &g.origin);
+      } else if (!(hw = wlc_output_set_cursor(output, surface, &pointer->tip, &pos))) {
+         wlc_output_render_surface(output, surface, &g, &output->callbacks);
       }
    } else if (!view || is_x11_view(view)) { // focused->x11.id workarounds bug <https://github.com/Cloudef/wlc/issues/21>
       // Show default cursor when no focus and no surface.
-      wlc_render_pointer_paint(&output->render, &output->context, &pos);
+      if (!(hw = wlc_output_set_cursor(output, NULL, &wlc_point_zero, &pos)))
+         wlc_render_pointer_paint(&output->render, &output->context, &g.origin);
+   } else {
+      wlc_output_hide_cursor(output);
+      pointer->painted.geometry = wlc_geometry_zero;
+   }
+
+   if (hw != was_hw) {
+      // Composited cursor may still be in the back buffers, and the cursor leaving the plane is repainted on next frame
+      wlc_output_damage(output, (hw ? &old : &g));
+      wlc_output_schedule_repaint(output);
    }
+
+   pointer->painted.hw = hw;
+
+   // Nothing to damage on motion when the cursor is on the plane
+   if (hw)
+      pointer->painted.geometry = wlc_geometry_zero;
+
+   output->cursor.composited = !wlc_geometry_equals(&pointer->painted.geometry, &wlc_geometry_zero);
 }
 
 static void
@@ -333,7 +424,11 @@ wlc_pointer_motion(struct wlc_pointer *pointer, uint32_t time, bool pass)
    if (pass)
       wlc_pointer_focus(pointer, convert_from_wlc_resource(focused.id, "surface"), &d);
 
-   wlc_output_schedule_repaint(output);
+   // Pure motion of a cursor on the plane doesn't need a repaint
+   if (!move_hw_cursor(pointer, output)) {
+      damage_cursor(pointer, output);
+      wlc_output_schedule_repaint(output);
+   }
 
    if (!focused.id || !pass)
       return;
@@ -355,6 +450,12 @@ wlc_pointer_set_surface(struct wlc_pointer *pointer, struct wlc_surface *surface
    memcpy(&pointer->tip, tip, sizeof(pointer->tip));
    wlc_surface_invalidate(convert_from_wlc_resource(pointer->surface, "surface"));
    pointer->surface = convert_to_wlc_resource(surface);
+
+   struct wlc_output *output;
+   if ((output = active_output(pointer))) {
+      damage_cursor(pointer, output);
+      wlc_output_schedule_repaint(output);
+   }
 }
 
 void
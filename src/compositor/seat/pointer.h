@@ -40,6 +40,14 @@ struct wlc_pointer {
 
    wlc_resource surface;
 
+   // Last painted cursor, used for damage tracking
+   // hw is set when the cursor is on the cursor plane of the output and there is nothing to damage
+   struct {
+      struct wlc_geometry geometry;
+      wlc_handle output;
+      bool hw;
+   } painted;
+
    struct {
       struct chck_iter_pool resources;
       struct wlc_focused_surface surface;
@@ -687,6 +687,8 @@ wlc_view_release(struct wlc_view *view)
 
    wlc_surface_attach_to_view(convert_from_wlc_resource(view->surface, "surface"), NULL);
    chck_iter_pool_release(&view->wl_state);
+   pixman_region32_fini(&view->visible);
+   pixman_region32_fini(&view->clip);
 }
 
 bool
@@ -694,5 +696,7 @@ wlc_view(struct wlc_view *view)
 {
    assert(view);
    assert(!view->state.created);
+   pixman_region32_init(&view->visible);
+   pixman_region32_init(&view->clip);
    return chck_iter_pool(&view->wl_state, 8, 0, sizeof(uint32_t));
 }
@@ -2,6 +2,7 @@
 #define _WLC_VIEW_H_
 
 #include <stdbool.h>
+#include <pixman.h>
 #include <wlc/geometry.h>
 #include <wayland-util.h>
 #include <chck/pool/pool.h>
@@ -36,6 +37,13 @@ struct wlc_view {
    struct wlc_view_surface_state surface_commit;
    struct chck_iter_pool wl_state;
 
+   // Part of the view not occluded by opaque views above it, in output coordinates.
+   // Updated on every repaint of the output.
+   pixman_region32_t visible;
+
+   // Output area not covered by opaque views above, the view is only drawn inside it.
+   pixman_region32_t clip;
+
    wlc_handle parent;
    wlc_resource surface;
    wlc_resource shell_surface;
@@ -0,0 +1,1491 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <zlib.h>
+#include <pixman.h>
+#include <linux/input.h>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+#include <chck/math/math.h>
+#include "internal.h"
+#include "macros.h"
+#include "vnc.h"
+#include "compositor/compositor.h"
+#include "compositor/output.h"
+
+// Updates are read back and sent in tiles of this size, ZRLE uses the same tile size
+static const uint32_t TILE_SIZE = 64;
+
+// Damage with more rectangles than this is read back as its extents
+static const int MAX_READBACK_RECTS = 8;
+
+// Client cut text is skipped, everything else must fit in here
+static const size_t MAX_MESSAGE_SIZE = 4096;
+
+static const char RFB_VERSION[] = "RFB 003.008\n";
+
+enum {
+   RFB_SECURITY_NONE = 1,
+};
+
+enum {
+   RFB_SET_PIXEL_FORMAT = 0,
+   RFB_SET_ENCODINGS = 2,
+   RFB_FRAMEBUFFER_UPDATE_REQUEST = 3,
+   RFB_KEY_EVENT = 4,
+   RFB_POINTER_EVENT = 5,
+   RFB_CLIENT_CUT_TEXT = 6,
+};
+
+enum {
+   RFB_ENCODING_RAW = 0,
+   RFB_ENCODING_ZLIB = 6,
+   RFB_ENCODING_ZRLE = 16,
+   RFB_ENCODING_DESKTOP_SIZE = -223,
+};
+
+enum state {
+   STATE_VERSION,
+   STATE_SECURITY,
+   STATE_INIT,
+   STATE_NORMAL,
+};
+
+struct pixel_format {
+   uint16_t max[3]; // red, green, blue
+   uint8_t shift[3];
+   uint8_t bpp, depth;
+   bool big_endian, true_colour;
+};
+
+struct buffer {
+   uint8_t *data;
+   size_t size, allocated;
+   bool failed; // allocation failed, contents are incomplete
+};
+
+struct client {
+   struct wlc_vnc *vnc;
+   struct wl_event_source *source;
+   struct wl_list link;
+
+   // Socket buffers, out is sent from offset
+   struct buffer in, out;
+   size_t offset, skip;
+
+   // Rectangles of the update being read back, scratch for encoding them
+   struct buffer update, scratch;
+   uint32_t *pixels;
+   size_t num_pixels;
+   uint32_t rects, pending;
+
+   pixman_region32_t damage; // framebuffer pixels, not yet sent
+   struct wlc_size size; // remote framebuffer
+   wlc_handle output;
+
+   struct pixel_format format;
+
+   // Compressed pixel of ZRLE, format bytes shifted right by shift
+   struct {
+      uint8_t bytes, shift;
+   } cpixel;
+
+   // Both encodings keep one stream for the whole connection
+   struct {
+      z_stream zlib, zrle;
+      bool zlib_init, zrle_init;
+   } z;
+
+   struct {
+      uint16_t x, y;
+      uint8_t buttons;
+   } pointer;
+
+   uint8_t keys[32]; // pressed keycodes - 8
+
+   int32_t encoding;
+   enum state state;
+   int fd;
+   uint8_t minor; // protocol version 3.minor
+   bool requested, desktop_size, closed;
+};
+
+static uint8_t*
+buffer_grow(struct buffer *buffer, size_t size)
+{
+   assert(buffer);
+
+   if (buffer->failed)
+      return NULL;
+
+   if (buffer->allocated - buffer->size < size) {
+      size_t allocated = (buffer->allocated ? buffer->allocated : 4096);
+      while (allocated - buffer->size < size)
+         allocated *= 2;
+
+      uint8_t *data;
+      if (!(data = realloc(buffer->data, allocated))) {
+         buffer->failed = true;
+         return NULL;
+      }
+
+      buffer->data = data;
+      buffer->allocated = allocated;
+   }
+
+   uint8_t *p = buffer->data + buffer->size;
+   buffer->size += size;
+   return p;
+}
+
+static void
+buffer_consume(struct buffer *buffer, size_t size)
+{
+   assert(buffer && size <= buffer->size);
+   memmove(buffer->data, buffer->data + size, buffer->size - size);
+   buffer->size -= size;
+}
+
+static void
+buffer_release(struct buffer *buffer)
+{
+   assert(buffer);
+   free(buffer->data);
+   memset(buffer, 0, sizeof(struct buffer));
+}
+
+static void
+put_u8(struct buffer *buffer, uint8_t v)
+{
+   uint8_t *p;
+   if ((p = buffer_grow(buffer, 1)))
+      p[0] = v;
+}
+
+static void
+put_u16(struct buffer *buffer, uint16_t v)
+{
+   uint8_t *p;
+   if ((p = buffer_grow(buffer, 2)))
+      p[0] = v >> 8, p[1] = v;
+}
+
+static void
+put_u32(struct buffer *buffer, uint32_t v)
+{
+   uint8_t *p;
+   if ((p = buffer_grow(buffer, 4)))
+      p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static void
+put_data(struct buffer *buffer, const void *data, size_t size)
+{
+   uint8_t *p;
+   if ((p = buffer_grow(buffer, size)))
+      memcpy(p, data, size);
+}
+
+WLC_PURE static uint16_t
+get_u16(const uint8_t *p)
+{
+   return (uint16_t)p[0] << 8 | p[1];
+}
+
+WLC_PURE static uint32_t
+get_u32(const uint8_t *p)
+{
+   return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void
+put_pixel_format(struct buffer *buffer, const struct pixel_format *format)
+{
+   put_u8(buffer, format->bpp);
+   put_u8(buffer, format->depth);
+   put_u8(buffer, format->big_endian);
+   put_u8(buffer, format->true_colour);
+
+   for (int i = 0; i < 3; ++i)
+      put_u16(buffer, format->max[i]);
+
+   for (int i = 0; i < 3; ++i)
+      put_u8(buffer, format->shift[i]);
+
+   put_data(buffer, (uint8_t[3]){0}, 3);
+}
+
+static bool
+get_pixel_format(struct pixel_format *format, const uint8_t *p)
+{
+   assert(format && p);
+
+   const struct pixel_format f = {
+      .bpp = p[0],
+      .depth = p[1],
+      .big_endian = p[2],
+      .true_colour = p[3],
+      .max = { get_u16(p + 4), get_u16(p + 6), get_u16(p + 8) },
+      .shift = { p[10], p[11], p[12] },
+   };
+
+   // Colour maps are not supported, every client can do true colour
+   if ((f.bpp != 8 && f.bpp != 16 && f.bpp != 32) || !f.true_colour)
+      return false;
+
+   for (int i = 0; i < 3; ++i) {
+      if (f.shift[i] >= f.bpp || ((uint32_t)f.max[i] << f.shift[i]) >> f.shift[i] != f.max[i])
+         return false;
+   }
+
+   *format = f;
+   return true;
+}
+
+static void
+client_set_pixel_format(struct client *client, const struct pixel_format *format)
+{
+   assert(client && format);
+   client->format = *format;
+   client->cpixel.bytes = format->bpp / 8;
+   client->cpixel.shift = 0;
+
+   if (format->bpp != 32 || format->depth > 24)
+      return;
+
+   uint32_t mask = 0;
+   for (int i = 0; i < 3; ++i)
+      mask |= (uint32_t)format->max[i] << format->shift[i];
+
+   // Pixels that fit in three bytes are sent as three bytes
+   if (!(mask & 0xff000000)) {
+      client->cpixel.bytes = 3;
+   } else if (!(mask & 0xff)) {
+      client->cpixel.bytes = 3;
+      client->cpixel.shift = 8;
+   }
+}
+
+WLC_CONST static uint32_t
+scale_channel(uint8_t v, uint16_t max)
+{
+   return (max == 255 ? v : (uint32_t)v * max / 255);
+}
+
+static void
+write_pixel(uint8_t *dst, uint32_t v, uint8_t bytes, bool big_endian)
+{
+   for (uint8_t i = 0; i < bytes; ++i)
+      dst[(big_endian ? bytes - 1 - i : i)] = v >> (i * 8);
+}
+
+static void
+client_release_input(struct client *client)
+{
+   assert(client);
+
+   // Nothing stays pressed when the remote goes away
+   struct wlc_input_event ev = {0};
+   ev.time = wlc_get_time(NULL);
+
+   static const uint32_t buttons[] = { BTN_LEFT, BTN_MIDDLE, BTN_RIGHT };
+   for (uint32_t i = 0; i < LENGTH(buttons); ++i) {
+      if (!(client->pointer.buttons & (1 << i)))
+         continue;
+
+      ev.type = WLC_INPUT_EVENT_BUTTON;
+      ev.button.code = buttons[i];
+      ev.button.state = WL_POINTER_BUTTON_STATE_RELEASED;
+      wl_signal_emit(&wlc_system_signals()->input, &ev);
+   }
+
+   for (uint32_t i = 0; i < sizeof(client->keys) * 8; ++i) {
+      if (!(client->keys[i / 8] & (1 << (i % 8))))
+         continue;
+
+      ev.type = WLC_INPUT_EVENT_KEY;
+      ev.key.code = i;
+      ev.key.state = WL_KEYBOARD_KEY_STATE_RELEASED;
+      wl_signal_emit(&wlc_system_signals()->input, &ev);
+   }
+
+   client->pointer.buttons = 0;
+   memset(client->keys, 0, sizeof(client->keys));
+}
+
+static void
+client_free(struct client *client)
+{
+   assert(client && client->closed && !client->pending);
+
+   if (client->z.zlib_init)
+      deflateEnd(&client->z.zlib);
+
+   if (client->z.zrle_init)
+      deflateEnd(&client->z.zrle);
+
+   buffer_release(&client->in);
+   buffer_release(&client->out);
+   buffer_release(&client->update);
+   buffer_release(&client->scratch);
+   pixman_region32_fini(&client->damage);
+   free(client->pixels);
+   free(client);
+}
+
+static void
+client_close(struct client *client)
+{
+   assert(client);
+
+   if (client->closed)
+      return;
+
+   wlc_log(WLC_LOG_INFO, "VNC client disconnected");
+
+   if (client->vnc)
+      client_release_input(client);
+
+   struct wlc_output *output;
+   if (client->output && (output = convert_from_wlc_handle(client->output, "output"))) {
+      wlc_output_capture(output, false);
+      wlc_output_capture_cursor(output, false);
+   }
+
+   if (client->source)
+      wl_event_source_remove(client->source);
+
+   close(client->fd);
+   wl_list_remove(&client->link);
+   wl_list_init(&client->link);
+   client->source = NULL;
+   client->fd = -1;
+   client->closed = true;
+}
+
+// Closed clients are freed from the event that closed them, or by their last readback
+static void
+client_check_free(struct client *client)
+{
+   assert(client);
+
+   if (client->closed && !client->pending)
+      client_free(client);
+}
+
+static void
+client_flush(struct client *client)
+{
+   assert(client);
+
+   if (client->closed)
+      return;
+
+   if (client->out.failed) {
+      wlc_log(WLC_LOG_WARN, "VNC client ran out of memory");
+      client_close(client);
+      return;
+   }
+
+   while (client->offset < client->out.size) {
+      const ssize_t ret = send(client->fd, client->out.data + client->offset, client->out.size - client->offset, MSG_NOSIGNAL);
+
+      if (ret < 0) {
+         if (errno == EINTR)
+            continue;
+
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+         client_close(client);
+         return;
+      }
+
+      client->offset += ret;
+   }
+
+   if (client->offset == client->out.size)
+      client->offset = client->out.size = 0;
+
+   wl_event_source_fd_update(client->source, WL_EVENT_READABLE | (client->out.size ? WL_EVENT_WRITABLE : 0));
+}
+
+static bool
+put_deflated(struct buffer *out, z_stream *zs, const struct buffer *in)
+{
+   assert(out && zs && in);
+
+   const size_t at = out->size;
+   if (!buffer_grow(out, 4))
+      return false;
+
+   zs->next_in = in->data;
+   zs->avail_in = in->size;
+
+   do {
+      const size_t avail = deflateBound(zs, zs->avail_in) + 16;
+
+      uint8_t *dst;
+      if (!(dst = buffer_grow(out, avail)))
+         return false;
+
+      zs->next_out = dst;
+      zs->avail_out = avail;
+
+      if (deflate(zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+         return false;
+
+      out->size -= zs->avail_out;
+   } while (!zs->avail_out);
+
+   const uint32_t size = out->size - at - 4;
+   uint8_t *p = out->data + at;
+   p[0] = size >> 24, p[1] = size >> 16, p[2] = size >> 8, p[3] = size;
+   return true;
+}
+
+static void
+put_raw(struct client *client, struct buffer *out, uint32_t w, uint32_t h)
+{
+   assert(client && out);
+
+   const uint8_t bytes = client->format.bpp / 8;
+
+   uint8_t *dst;
+   if (!(dst = buffer_grow(out, (size_t)w * h * bytes)))
+      return;
+
+   for (size_t i = 0; i < (size_t)w * h; ++i, dst += bytes)
+      write_pixel(dst, client->pixels[i], bytes, client->format.big_endian);
+}
+
+static void
+put_cpixel(struct client *client, struct buffer *out, uint32_t v)
+{
+   uint8_t *dst;
+   if ((dst = buffer_grow(out, client->cpixel.bytes)))
+      write_pixel(dst, v >> client->cpixel.shift, client->cpixel.bytes, client->format.big_endian);
+}
+
+static void
+put_run_length(struct buffer *out, size_t run)
+{
+   assert(run > 0);
+
+   for (--run; run >= 255; run -= 255)
+      put_u8(out, 255);
+
+   put_u8(out, run);
+}
+
+WLC_PURE static int
+palette_index(const uint32_t *palette, uint32_t colours, uint32_t v)
+{
+   for (uint32_t i = 0; i < colours; ++i) {
+      if (palette[i] == v)
+         return i;
+   }
+
+   return -1;
+}
+
+static void
+put_zrle_tile(struct client *client, struct buffer *out, const uint32_t *pixels, uint32_t stride, uint32_t w, uint32_t h)
+{
+   assert(client && out && pixels);
+
+   const size_t cb = client->cpixel.bytes;
+
+   // Collect the palette and runs to pick the smallest subencoding
+   uint32_t palette[16], colours = 0;
+   size_t rle = 0, palette_rle = 0, run = 0;
+   uint32_t last = pixels[0];
+
+   for (uint32_t y = 0; y < h; ++y) {
+      for (uint32_t x = 0; x < w; ++x) {
+         const uint32_t v = pixels[y * stride + x];
+
+         if (colours <= 16 && palette_index(palette, chck_min32(colours, 16), v) < 0) {
+            if (colours < 16)
+               palette[colours] = v;
+
+            ++colours;
+         }
+
+         if (run && v == last) {
+            ++run;
+            continue;
+         }
+
+         if (run) {
+            rle += cb + (run - 1) / 255 + 1;
+            palette_rle += 1 + (run > 1 ? (run - 1) / 255 + 1 : 0);
+         }
+
+         last = v;
+         run = 1;
+      }
+   }
+
+   rle += cb + (run - 1) / 255 + 1;
+   palette_rle += 1 + (run > 1 ? (run - 1) / 255 + 1 : 0);
+
+   if (colours == 1) {
+      put_u8(out, 1);
+      put_cpixel(client, out, palette[0]);
+      return;
+   }
+
+   const uint32_t bits = (colours <= 2 ? 1 : (colours <= 4 ? 2 : 4));
+   const size_t raw = w * h * cb;
+   const size_t packed = (colours <= 16 ? colours * cb + h * ((w * bits + 7) / 8) : (size_t)~0);
+   palette_rle = (colours <= 16 ? colours * cb + palette_rle : (size_t)~0);
+
+   if (raw <= rle && raw <= packed && raw <= palette_rle) {
+      put_u8(out, 0);
+      for (uint32_t y = 0; y < h; ++y) {
+         for (uint32_t x = 0; x < w; ++x)
+            put_cpixel(client, out, pixels[y * stride + x]);
+      }
+   } else if (packed <= rle && packed <= palette_rle) {
+      put_u8(out, colours);
+      for (uint32_t i = 0; i < colours; ++i)
+         put_cpixel(client, out, palette[i]);
+
+      for (uint32_t y = 0; y < h; ++y) {
+         uint8_t byte = 0, used = 0;
+         for (uint32_t x = 0; x < w; ++x) {
+            byte = byte << bits | palette_index(palette, colours, pixels[y * stride + x]);
+
+            if ((used += bits) == 8) {
+               put_u8(out, byte);
+               byte = used = 0;
+            }
+         }
+
+         // Rows are padded to whole bytes
+         if (used)
+            put_u8(out, byte << (8 - used));
+      }
+   } else {
+      const bool use_palette = (palette_rle < rle);
+      put_u8(out, (use_palette ? 128 + colours : 128));
+
+      if (use_palette) {
+         for (uint32_t i = 0; i < colours; ++i)
+            put_cpixel(client, out, palette[i]);
+      }
+
+      run = 0;
+      for (uint32_t y = 0; y < h; ++y) {
+         for (uint32_t x = 0; x < w; ++x) {
+            const uint32_t v = pixels[y * stride + x];
+
+            if (run && v == last) {
+               ++run;
+               continue;
+            }
+
+            if (run && use_palette) {
+               put_u8(out, palette_index(palette, colours, last) | (run > 1 ? 128 : 0));
+               if (run > 1)
+                  put_run_length(out, run);
+            } else if (run) {
+               put_cpixel(client, out, last);
+               put_run_length(out, run);
+            }
+
+            last = v;
+            run = 1;
+         }
+      }
+
+      if (use_palette) {
+         put_u8(out, palette_index(palette, colours, last) | (run > 1 ? 128 : 0));
+         if (run > 1)
+            put_run_length(out, run);
+      } else {
+         put_cpixel(client, out, last);
+         put_run_length(out, run);
+      }
+   }
+}
+
+static bool
+put_rect(struct client *client, const struct wlc_geometry *g, const uint8_t *data, int32_t stride)
+{
+   assert(client && g && data);
+
+   const size_t count = (size_t)g->size.w * g->size.h;
+   if (count > client->num_pixels) {
+      uint32_t *pixels;
+      if (!(pixels = realloc(client->pixels, count * sizeof(uint32_t))))
+         return false;
+
+      client->pixels = pixels;
+      client->num_pixels = count;
+   }
+
+   // Readback rows are B, G, R, X
+   const struct pixel_format *f = &client->format;
+   for (uint32_t y = 0; y < g->size.h; ++y) {
+      const uint8_t *row = data + (ptrdiff_t)y * stride;
+      uint32_t *dst = client->pixels + (size_t)y * g->size.w;
+      for (uint32_t x = 0; x < g->size.w; ++x, row += 4)
+         dst[x] = scale_channel(row[2], f->max[0]) << f->shift[0] | scale_channel(row[1], f->max[1]) << f->shift[1] | scale_channel(row[0], f->max[2]) << f->shift[2];
+   }
+
+   struct buffer *out = &client->update;
+   put_u16(out, g->origin.x);
+   put_u16(out, g->origin.y);
+   put_u16(out, g->size.w);
+   put_u16(out, g->size.h);
+   put_u32(out, client->encoding);
+
+   client->scratch.size = 0;
+
+   switch (client->encoding) {
+      case RFB_ENCODING_ZRLE:
+         for (uint32_t y = 0; y < g->size.h; y += TILE_SIZE) {
+            for (uint32_t x = 0; x < g->size.w; x += TILE_SIZE)
+               put_zrle_tile(client, &client->scratch, client->pixels + (size_t)y * g->size.w + x, g->size.w, chck_min32(TILE_SIZE, g->size.w - x), chck_min32(TILE_SIZE, g->size.h - y));
+         }
+
+         if (client->scratch.failed || !put_deflated(out, &client->z.zrle, &client->scratch))
+            return false;
+         break;
+
+      case RFB_ENCODING_ZLIB:
+         put_raw(client, &client->scratch, g->size.w, g->size.h);
+
+         if (client->scratch.failed || !put_deflated(out, &client->z.zlib, &client->scratch))
+            return false;
+         break;
+
+      default:
+         put_raw(client, out, g->size.w, g->size.h);
+         break;
+   }
+
+   ++client->rects;
+   return !out->failed;
+}
+
+static void
+update_done(struct client *client)
+{
+   assert(client && !client->pending);
+
+   if (client->closed)
+      return;
+
+   if (client->update.failed) {
+      wlc_log(WLC_LOG_WARN, "VNC client ran out of memory");
+      client_close(client);
+      return;
+   }
+
+   if (client->rects) {
+      put_u8(&client->out, 0);
+      put_u8(&client->out, 0);
+      put_u16(&client->out, client->rects);
+      put_data(&client->out, client->update.data, client->update.size);
+   } else {
+      // Nothing could be sent, request stays open for the next update
+      client->requested = true;
+   }
+
+   client->update.size = 0;
+   client->rects = 0;
+   client_flush(client);
+}
+
+static void
+readback_done(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg)
+{
+   (void)output;
+   assert(geometry && arg);
+
+   struct client *client = arg;
+   assert(client->pending > 0);
+   --client->pending;
+
+   if (!client->closed) {
+      if (!data) {
+         // Area that was not read back is sent with the next update
+         pixman_region32_union_rect(&client->damage, &client->damage, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+      } else if (!put_rect(client, geometry, data, stride)) {
+         // Compression streams are out of sync with the client, connection can't continue
+         wlc_log(WLC_LOG_WARN, "Failed to encode VNC update");
+         client_close(client);
+      }
+   }
+
+   if (!client->pending)
+      update_done(client);
+
+   client_check_free(client);
+}
+
+static void
+client_update(struct client *client)
+{
+   assert(client);
+
+   // One update in flight, the next one waits until the previous one was sent
+   if (client->closed || client->state != STATE_NORMAL || !client->requested || client->pending || client->out.size)
+      return;
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle(client->output, "output")) || !output->bsurface.display) {
+      client_close(client);
+      return;
+   }
+
+   if (!wlc_size_equals(&output->mode, &client->size)) {
+      if (!client->desktop_size) {
+         wlc_log(WLC_LOG_WARN, "VNC client can't be resized");
+         client_close(client);
+         return;
+      }
+
+      client->size = output->mode;
+      client->requested = false;
+      pixman_region32_fini(&client->damage);
+      pixman_region32_init_rect(&client->damage, 0, 0, client->size.w, client->size.h);
+
+      put_u8(&client->out, 0);
+      put_u8(&client->out, 0);
+      put_u16(&client->out, 1);
+      put_u16(&client->out, 0);
+      put_u16(&client->out, 0);
+      put_u16(&client->out, client->size.w);
+      put_u16(&client->out, client->size.h);
+      put_u32(&client->out, RFB_ENCODING_DESKTOP_SIZE);
+      client_flush(client);
+      return;
+   }
+
+   if (!pixman_region32_not_empty(&client->damage))
+      return;
+
+   // Damage is sent as whole tiles
+   pixman_region32_t tiles;
+   pixman_region32_init(&tiles);
+
+   int nrects;
+   pixman_box32_t *boxes = pixman_region32_rectangles(&client->damage, &nrects);
+
+   if (nrects > MAX_READBACK_RECTS) {
+      boxes = pixman_region32_extents(&client->damage);
+      nrects = 1;
+   }
+
+   for (int i = 0; i < nrects; ++i) {
+      const int32_t x1 = boxes[i].x1 - boxes[i].x1 % TILE_SIZE, y1 = boxes[i].y1 - boxes[i].y1 % TILE_SIZE;
+      const int32_t x2 = boxes[i].x2 + (TILE_SIZE - 1) - (boxes[i].x2 + (TILE_SIZE - 1)) % TILE_SIZE;
+      const int32_t y2 = boxes[i].y2 + (TILE_SIZE - 1) - (boxes[i].y2 + (TILE_SIZE - 1)) % TILE_SIZE;
+      pixman_region32_union_rect(&tiles, &tiles, x1, y1, x2 - x1, y2 - y1);
+   }
+
+   pixman_region32_intersect_rect(&tiles, &tiles, 0, 0, client->size.w, client->size.h);
+   pixman_region32_clear(&client->damage);
+
+   boxes = pixman_region32_rectangles(&tiles, &nrects);
+
+   if (nrects > MAX_READBACK_RECTS) {
+      boxes = pixman_region32_extents(&tiles);
+      nrects = 1;
+   }
+
+   for (int i = 0; i < nrects; ++i) {
+      const struct wlc_geometry g = { { boxes[i].x1, boxes[i].y1 }, { boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 } };
+      if (wlc_output_read_pixels_ptr(output, WLC_XRGB8888, &g, readback_done, client)) {
+         ++client->pending;
+      } else {
+         pixman_region32_union_rect(&client->damage, &client->damage, g.origin.x, g.origin.y, g.size.w, g.size.h);
+      }
+   }
+
+   pixman_region32_fini(&tiles);
+
+   // Request is answered once the readbacks are done
+   if (client->pending)
+      client->requested = false;
+}
+
+static xkb_keycode_t
+keycode_for_keysym(struct xkb_keymap *keymap, xkb_keysym_t keysym)
+{
+   assert(keymap);
+
+   // Clients send modifiers as their own key events, prefer the unshifted level
+   const xkb_keycode_t min = xkb_keymap_min_keycode(keymap), max = xkb_keymap_max_keycode(keymap);
+   for (xkb_level_index_t level = 0; level < 2; ++level) {
+      for (xkb_keycode_t key = min; key <= max; ++key) {
+         const xkb_keysym_t *syms;
+         const int nsyms = xkb_keymap_key_get_syms_by_level(keymap, key, 0, level, &syms);
+         for (int i = 0; i < nsyms; ++i) {
+            if (syms[i] == keysym)
+               return key;
+         }
+      }
+   }
+
+   return XKB_KEYCODE_INVALID;
+}
+
+static void
+client_key(struct client *client, bool down, uint32_t keysym)
+{
+   assert(client && client->vnc);
+
+   struct wlc_compositor *compositor;
+   except(compositor = wl_container_of(client->vnc, compositor, vnc));
+
+   if (!compositor->seat.keymap.keymap)
+      return;
+
+   const xkb_keycode_t keycode = keycode_for_keysym(compositor->seat.keymap.keymap, keysym);
+   if (keycode == XKB_KEYCODE_INVALID || keycode < 8 || keycode - 8 >= sizeof(client->keys) * 8) {
+      wlc_dlog(WLC_DBG_KEYBOARD, "VNC keysym 0x%x has no keycode", keysym);
+      return;
+   }
+
+   // Autorepeat of the remote is dropped, compositor repeats keys itself
+   const uint32_t code = keycode - 8;
+   const bool pressed = (client->keys[code / 8] & (1 << (code % 8)));
+   if (down == pressed)
+      return;
+
+   client->keys[code / 8] ^= (1 << (code % 8));
+
+   struct wlc_input_event ev = {0};
+   ev.type = WLC_INPUT_EVENT_KEY;
+   ev.time = wlc_get_time(NULL);
+   ev.key.code = code;
+   ev.key.state = (down ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED);
+   wl_signal_emit(&wlc_system_signals()->input, &ev);
+}
+
+static double
+pointer_abs_x(void *internal, uint32_t width)
+{
+   struct client *client = internal;
+   return (client->size.w ? (double)client->pointer.x * width / client->size.w : 0);
+}
+
+static double
+pointer_abs_y(void *internal, uint32_t height)
+{
+   struct client *client = internal;
+   return (client->size.h ? (double)client->pointer.y * height / client->size.h : 0);
+}
+
+static void
+client_pointer(struct client *client, uint8_t mask, uint16_t x, uint16_t y)
+{
+   assert(client);
+
+   struct wlc_input_event ev = {0};
+   ev.time = wlc_get_time(NULL);
+
+   if (x != client->pointer.x || y != client->pointer.y) {
+      client->pointer.x = x;
+      client->pointer.y = y;
+      ev.type = WLC_INPUT_EVENT_MOTION_ABSOLUTE;
+      ev.motion_abs.x = pointer_abs_x;
+      ev.motion_abs.y = pointer_abs_y;
+      ev.motion_abs.internal = client;
+      wl_signal_emit(&wlc_system_signals()->input, &ev);
+   }
+
+   const uint8_t changed = mask ^ client->pointer.buttons;
+   client->pointer.buttons = mask;
+
+   static const uint32_t buttons[] = { BTN_LEFT, BTN_MIDDLE, BTN_RIGHT };
+   for (uint32_t i = 0; i < LENGTH(buttons); ++i) {
+      if (!(changed & (1 << i)))
+         continue;
+
+      ev.type = WLC_INPUT_EVENT_BUTTON;
+      ev.button.code = buttons[i];
+      ev.button.state = (mask & (1 << i) ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED);
+      wl_signal_emit(&wlc_system_signals()->input, &ev);
+   }
+
+   // Buttons 4 - 7 are wheel steps up, down, left and right
+   for (uint32_t i = 3; i < 7; ++i) {
+      if (!(changed & mask & (1 << i)))
+         continue;
+
+      const bool vertical = (i < 5);
+      memset(&ev.scroll, 0, sizeof(ev.scroll));
+      ev.type = WLC_INPUT_EVENT_SCROLL;
+      ev.scroll.axis_bits = (vertical ? WLC_SCROLL_AXIS_VERTICAL : WLC_SCROLL_AXIS_HORIZONTAL);
+      ev.scroll.amount[!vertical] = (i % 2 ? -10 : 10);
+      wl_signal_emit(&wlc_system_signals()->input, &ev);
+   }
+}
+
+static void
+client_init(struct client *client)
+{
+   assert(client && client->vnc);
+
+   struct wlc_compositor *compositor;
+   except(compositor = wl_container_of(client->vnc, compositor, vnc));
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle(compositor->active.output, "output")) || !output->bsurface.display) {
+      wlc_log(WLC_LOG_WARN, "VNC client connected without an active output");
+      client_close(client);
+      return;
+   }
+
+   client->output = compositor->active.output;
+   client->size = output->mode;
+
+   // Updates are read back from the composited frame
+   // There is no cursor pseudo-encoding, remote side sees the cursor only when it's composited
+   wlc_output_capture(output, true);
+   wlc_output_capture_cursor(output, true);
+   pixman_region32_init_rect(&client->damage, 0, 0, client->size.w, client->size.h);
+
+   static const char name[] = "wlc";
+   put_u16(&client->out, client->size.w);
+   put_u16(&client->out, client->size.h);
+   put_pixel_format(&client->out, &client->format);
+   put_u32(&client->out, sizeof(name) - 1);
+   put_data(&client->out, name, sizeof(name) - 1);
+   client->state = STATE_NORMAL;
+}
+
+static void
+client_set_encodings(struct client *client, const uint8_t *data, uint16_t count)
+{
+   assert(client && data);
+
+   // Clients list encodings in their order of preference
+   client->encoding = RFB_ENCODING_RAW;
+   client->desktop_size = false;
+
+   bool chosen = false;
+   for (uint16_t i = 0; i < count; ++i) {
+      const int32_t encoding = get_u32(data + i * 4);
+
+      if (encoding == RFB_ENCODING_DESKTOP_SIZE)
+         client->desktop_size = true;
+
+      if (chosen || (encoding != RFB_ENCODING_RAW && encoding != RFB_ENCODING_ZLIB && encoding != RFB_ENCODING_ZRLE))
+         continue;
+
+      client->encoding = encoding;
+      chosen = true;
+   }
+
+   z_stream *zs = (client->encoding == RFB_ENCODING_ZRLE ? &client->z.zrle : &client->z.zlib);
+   bool *init = (client->encoding == RFB_ENCODING_ZRLE ? &client->z.zrle_init : &client->z.zlib_init);
+
+   // Latency matters more than ratio here
+   if (client->encoding != RFB_ENCODING_RAW && !*init && !(*init = (deflateInit(zs, Z_BEST_SPEED) == Z_OK))) {
+      wlc_log(WLC_LOG_WARN, "VNC client falls back to raw encoding");
+      client->encoding = RFB_ENCODING_RAW;
+   }
+}
+
+// Returns bytes of message handled, 0 when more are needed and -1 on protocol error
+static ssize_t
+client_message(struct client *client, const uint8_t *data, size_t size)
+{
+   assert(client && data);
+
+   switch (client->state) {
+      case STATE_VERSION:
+      {
+         if (size < 12)
+            return 0;
+
+         char version[13] = {0};
+         memcpy(version, data, 12);
+
+         uint32_t major, minor;
+         if (sscanf(version, "RFB %3u.%3u\n", &major, &minor) != 2 || major != 3)
+            return -1;
+
+         client->minor = (minor >= 8 ? 8 : (minor == 7 ? 7 : 3));
+
+         if (client->minor == 3) {
+            // 3.3 has no negotiation, server decides
+            put_u32(&client->out, RFB_SECURITY_NONE);
+            client->state = STATE_INIT;
+         } else {
+            put_u8(&client->out, 1);
+            put_u8(&client->out, RFB_SECURITY_NONE);
+            client->state = STATE_SECURITY;
+         }
+      }
+      return 12;
+
+      case STATE_SECURITY:
+         if (size < 1)
+            return 0;
+
+         if (data[0] != RFB_SECURITY_NONE)
+            return -1;
+
+         if (client->minor == 8)
+            put_u32(&client->out, 0);
+
+         client->state = STATE_INIT;
+         return 1;
+
+      case STATE_INIT:
+         if (size < 1)
+            return 0;
+
+         // Clients always share the output, shared flag is ignored
+         client_init(client);
+         return 1;
+
+      case STATE_NORMAL:
+         break;
+   }
+
+   if (size < 1)
+      return 0;
+
+   switch (data[0]) {
+      case RFB_SET_PIXEL_FORMAT:
+      {
+         if (size < 20)
+            return 0;
+
+         struct pixel_format format;
+         if (!get_pixel_format(&format, data + 4))
+            return -1;
+
+         client_set_pixel_format(client, &format);
+      }
+      return 20;
+
+      case RFB_SET_ENCODINGS:
+      {
+         if (size < 4)
+            return 0;
+
+         const uint16_t count = get_u16(data + 2);
+         if (4 + (size_t)count * 4 > MAX_MESSAGE_SIZE)
+            return -1;
+
+         if (size < 4 + (size_t)count * 4)
+            return 0;
+
+         client_set_encodings(client, data + 4, count);
+         return 4 + (size_t)count * 4;
+      }
+
+      case RFB_FRAMEBUFFER_UPDATE_REQUEST:
+         if (size < 10)
+            return 0;
+
+         if (!data[1])
+            pixman_region32_union_rect(&client->damage, &client->damage, get_u16(data + 2), get_u16(data + 4), get_u16(data + 6), get_u16(data + 8));
+
+         pixman_region32_intersect_rect(&client->damage, &client->damage, 0, 0, client->size.w, client->size.h);
+         client->requested = true;
+         client_update(client);
+         return 10;
+
+      case RFB_KEY_EVENT:
+         if (size < 8)
+            return 0;
+
+         client_key(client, data[1], get_u32(data + 4));
+         return 8;
+
+      case RFB_POINTER_EVENT:
+         if (size < 6)
+            return 0;
+
+         client_pointer(client, data[1], chck_min32(get_u16(data + 2), client->size.w), chck_min32(get_u16(data + 4), client->size.h));
+         return 6;
+
+      case RFB_CLIENT_CUT_TEXT:
+         if (size < 8)
+            return 0;
+
+         client->skip = get_u32(data + 4);
+         return 8;
+   }
+
+   return -1;
+}
+
+static void
+client_read(struct client *client)
+{
+   assert(client);
+
+   // One read per dispatch, the fd stays readable for the rest.
+   // Complete messages are parsed below, so input never holds more than one message and a read.
+   uint8_t *dst;
+   if (!(dst = buffer_grow(&client->in, MAX_MESSAGE_SIZE))) {
+      client_close(client);
+      return;
+   }
+
+   const ssize_t ret = recv(client->fd, dst, MAX_MESSAGE_SIZE, 0);
+   client->in.size -= MAX_MESSAGE_SIZE - (ret > 0 ? ret : 0);
+
+   if (ret == 0 || (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      client_close(client);
+      return;
+   }
+
+   size_t handled = 0;
+   while (!client->closed && handled < client->in.size) {
+      if (client->skip) {
+         const size_t skip = (client->skip < client->in.size - handled ? client->skip : client->in.size - handled);
+         client->skip -= skip;
+         handled += skip;
+         continue;
+      }
+
+      const ssize_t ret = client_message(client, client->in.data + handled, client->in.size - handled);
+
+      if (ret < 0) {
+         wlc_log(WLC_LOG_WARN, "VNC client sent invalid message");
+         client_close(client);
+         return;
+      }
+
+      if (!ret)
+         break;
+
+      handled += ret;
+   }
+
+   if (client->closed)
+      return;
+
+   buffer_consume(&client->in, handled);
+   client_flush(client);
+}
+
+static int
+client_event(int fd, uint32_t mask, void *data)
+{
+   (void)fd;
+   struct client *client = data;
+
+   if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+      client_close(client);
+   } else {
+      if (mask & WL_EVENT_READABLE)
+         client_read(client);
+
+      if (mask & WL_EVENT_WRITABLE)
+         client_flush(client);
+
+      // Sent everything, next update may start
+      if (!client->out.size)
+         client_update(client);
+   }
+
+   client_check_free(client);
+   return 0;
+}
+
+static void
+client_create(struct wlc_vnc *vnc, int fd)
+{
+   assert(vnc && fd >= 0);
+
+   struct client *client;
+   if (!(client = calloc(1, sizeof(struct client)))) {
+      close(fd);
+      return;
+   }
+
+   client->vnc = vnc;
+   client->fd = fd;
+   client->encoding = RFB_ENCODING_RAW;
+   pixman_region32_init(&client->damage);
+   wl_list_insert(&vnc->clients, &client->link);
+
+   // Server side format matches the readback, so the common case needs no conversion
+   client_set_pixel_format(client, &(struct pixel_format){
+      .bpp = 32,
+      .depth = 24,
+      .true_colour = true,
+      .max = { 255, 255, 255 },
+      .shift = { 16, 8, 0 },
+   });
+
+   if (!(client->source = wl_event_loop_add_fd(wlc_event_loop(), fd, WL_EVENT_READABLE, client_event, client))) {
+      client_close(client);
+      client_check_free(client);
+      return;
+   }
+
+   wlc_log(WLC_LOG_INFO, "VNC client connected");
+   put_data(&client->out, RFB_VERSION, sizeof(RFB_VERSION) - 1);
+   client_flush(client);
+   client_check_free(client);
+}
+
+static int
+accept_event(int fd, uint32_t mask, void *data)
+{
+   (void)mask;
+   struct wlc_vnc *vnc = data;
+
+   int cfd;
+   if ((cfd = accept(fd, NULL, NULL)) < 0) {
+      wlc_log(WLC_LOG_WARN, "Failed to accept VNC client (%m)");
+      return 0;
+   }
+
+   if (fcntl(cfd, F_SETFD, FD_CLOEXEC) < 0 || fcntl(cfd, F_SETFL, O_NONBLOCK) < 0) {
+      close(cfd);
+      return 0;
+   }
+
+   // Fails harmlessly on unix sockets
+   setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+   client_create(vnc, cfd);
+   return 0;
+}
+
+static void
+render_event(struct wl_listener *listener, void *data)
+{
+   struct wlc_vnc *vnc;
+   except(vnc = wl_container_of(listener, vnc, listener.render));
+
+   struct wlc_render_event *ev = data;
+   if (ev->type != WLC_RENDER_EVENT_DAMAGE)
+      return;
+
+   const wlc_handle output = convert_to_wlc_handle(ev->output);
+
+   struct client *c, *cn;
+   wl_list_for_each_safe(c, cn, &vnc->clients, link) {
+      if (c->output != output || c->state != STATE_NORMAL)
+         continue;
+
+      // Damage is read back while the frame is current
+      pixman_region32_union(&c->damage, &c->damage, ev->damage);
+      pixman_region32_intersect_rect(&c->damage, &c->damage, 0, 0, c->size.w, c->size.h);
+      client_update(c);
+      client_check_free(c);
+   }
+}
+
+static void
+output_event(struct wl_listener *listener, void *data)
+{
+   struct wlc_vnc *vnc;
+   except(vnc = wl_container_of(listener, vnc, listener.output));
+
+   struct wlc_output_event *ev = data;
+   if (ev->type != WLC_OUTPUT_EVENT_REMOVE)
+      return;
+
+   // Clients reconnect to get the new active output
+   const wlc_handle output = convert_to_wlc_handle(ev->remove.output);
+
+   struct client *c, *cn;
+   wl_list_for_each_safe(c, cn, &vnc->clients, link) {
+      if (c->output != output)
+         continue;
+
+      client_close(c);
+      client_check_free(c);
+   }
+}
+
+static int
+listen_unix(const char *path)
+{
+   assert(path);
+
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return -1;
+
+   strcpy(addr.sun_path, path);
+
+   int fd;
+   if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+      return -1;
+
+   unlink(path);
+
+   if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+static bool
+is_loopback(const struct sockaddr *addr)
+{
+   assert(addr);
+
+   if (addr->sa_family == AF_INET)
+      return ((ntohl(((const struct sockaddr_in*)addr)->sin_addr.s_addr) >> 24) == 127);
+
+   if (addr->sa_family == AF_INET6) {
+      const struct in6_addr *in6 = &((const struct sockaddr_in6*)addr)->sin6_addr;
+      return (IN6_IS_ADDR_LOOPBACK(in6) || (IN6_IS_ADDR_V4MAPPED(in6) && in6->s6_addr[12] == 127));
+   }
+
+   return false;
+}
+
+static int
+listen_tcp(const char *address)
+{
+   assert(address);
+
+   // [host:]port, host defaults to loopback
+   char host[256] = "localhost";
+   const char *port = address, *sep;
+   if ((sep = strrchr(address, ':'))) {
+      if ((size_t)(sep - address) >= sizeof(host))
+         return -1;
+
+      // Brackets of IPv6 addresses
+      const bool bracket = (*address == '[' && sep > address && sep[-1] == ']');
+      const size_t len = sep - address - (bracket ? 2 : 0);
+      memcpy(host, address + bracket, len);
+      host[len] = 0;
+      port = sep + 1;
+   }
+
+   const struct addrinfo hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_socktype = SOCK_STREAM,
+      .ai_flags = AI_PASSIVE,
+   };
+
+   struct addrinfo *res;
+   if (getaddrinfo((*host ? host : NULL), port, &hints, &res))
+      return -1;
+
+   int fd = -1;
+   bool refused = false;
+   for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+      // There is no authentication and clients inject input, never expose that to the network
+      if (!is_loopback(ai->ai_addr)) {
+         refused = true;
+         continue;
+      }
+
+      if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol)) < 0)
+         continue;
+
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, 4) < 0) {
+         close(fd);
+         fd = -1;
+      }
+   }
+
+   freeaddrinfo(res);
+
+   if (fd < 0 && refused)
+      wlc_log(WLC_LOG_WARN, "VNC server has no authentication, refusing to listen on non-loopback address '%s'. Use a unix socket or a tunnel.", address);
+
+   return fd;
+}
+
+void
+wlc_vnc_release(struct wlc_vnc *vnc)
+{
+   if (!vnc)
+      return;
+
+   if (vnc->listener.render.notify) {
+      wl_list_remove(&vnc->listener.render.link);
+      wl_list_remove(&vnc->listener.output.link);
+   }
+
+   // Clients with readbacks in flight are freed by the last one
+   if (vnc->clients.next) {
+      struct client *c, *cn;
+      wl_list_for_each_safe(c, cn, &vnc->clients, link) {
+         c->vnc = NULL;
+         client_close(c);
+         client_check_free(c);
+      }
+   }
+
+   if (vnc->source) {
+      wl_event_source_remove(vnc->source);
+      close(vnc->fd);
+
+      if (vnc->path)
+         unlink(vnc->path);
+   }
+
+   free(vnc->path);
+   memset(vnc, 0, sizeof(struct wlc_vnc));
+}
+
+bool
+wlc_vnc(struct wlc_vnc *vnc)
+{
+   memset(vnc, 0, sizeof(struct wlc_vnc));
+   wl_list_init(&vnc->clients);
+
+   const char *address;
+   if (!(address = getenv("WLC_VNC")) || !*address)
+      return true;
+
+   // Paths are unix sockets, anything else is [host:]port
+   if (*address == '/') {
+      if (!(vnc->path = strdup(address)))
+         goto fail;
+
+      vnc->fd = listen_unix(address);
+   } else {
+      vnc->fd = listen_tcp(address);
+   }
+
+   if (vnc->fd < 0)
+      goto listen_fail;
+
+   if (!(vnc->source = wl_event_loop_add_fd(wlc_event_loop(), vnc->fd, WL_EVENT_READABLE, accept_event, vnc))) {
+      close(vnc->fd);
+      goto fail;
+   }
+
+   vnc->listener.render.notify = render_event;
+   vnc->listener.output.notify = output_event;
+   wl_signal_add(&wlc_system_signals()->render, &vnc->listener.render);
+   wl_signal_add(&wlc_system_signals()->output, &vnc->listener.output);
+
+   wlc_log(WLC_LOG_INFO, "VNC server listening on %s", address);
+   return true;
+
+listen_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to listen for VNC clients on %s (%m)", address);
+fail:
+   wlc_vnc_release(vnc);
+   return false;
+}
@@ -0,0 +1,48 @@
+#ifndef _WLC_VNC_H_
+#define _WLC_VNC_H_
+
+#include <stdbool.h>
+#include <wlc/defines.h>
+
+#ifdef ENABLE_VNC
+
+#include <wayland-server.h>
+
+struct wlc_vnc {
+   // Connected RFB clients
+   struct wl_list clients;
+
+   // Listening socket, path is set for unix sockets and unlinked on release
+   struct wl_event_source *source;
+   char *path;
+   int fd;
+
+   struct {
+      struct wl_listener render;
+      struct wl_listener output;
+   } listener;
+};
+
+void wlc_vnc_release(struct wlc_vnc *vnc);
+WLC_NONULL bool wlc_vnc(struct wlc_vnc *vnc);
+
+#else /* !ENABLE_VNC */
+
+struct wlc_vnc {};
+
+static inline void
+wlc_vnc_release(struct wlc_vnc *vnc)
+{
+   (void)vnc;
+}
+
+WLC_NONULL static inline bool
+wlc_vnc(struct wlc_vnc *vnc)
+{
+   (void)vnc;
+   return true;
+}
+
+#endif /* ENABLE_VNC */
+
+#endif /* _WLC_VNC_H_ */
@@ -42,6 +42,27 @@ wlc_pixels_read(enum wlc_pixel_format format, const struct wlc_geometry *geometr
    wlc_render_read_pixels(&o->render, &o->context, format, geometry, out_geometry, out_data);
 }
 
+WLC_API bool
+wlc_output_read_pixels(wlc_handle output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const void *data, int32_t stride, void *arg), void *arg)
+{
+   assert(geometry && done);
+   return wlc_output_read_pixels_ptr(convert_from_wlc_handle(output, "output"), format, geometry, done, arg);
+}
+
+WLC_API bool
+wlc_output_export_dmabuf(wlc_handle output, void (*done)(wlc_handle output, const struct wlc_dmabuf_attributes *attributes, int32_t fence, void *arg), void *arg)
+{
+   assert(done);
+   return wlc_output_export_dmabuf_ptr(convert_from_wlc_handle(output, "output"), done, arg);
+}
+
+WLC_API void
+wlc_output_get_pixels(wlc_handle output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg)
+{
+   assert(pixels);
+   wlc_output_get_pixels_ptr(convert_from_wlc_handle(output, "output"), pixels, arg);
+}
+
 WLC_API void
 wlc_output_schedule_render(wlc_handle output)
 {
@@ -49,6 +70,8 @@ wlc_output_schedule_render(wlc_handle output)
    if (!(o = convert_from_wlc_handle(output, "output")))
       return;
 
+   // We don't know what the user is going to draw
+   wlc_output_damage_all(o);
    wlc_output_schedule_repaint(o);
 }
 
@@ -302,10 +302,16 @@ struct wlc_output_event {
 
 enum wlc_render_event_type {
    WLC_RENDER_EVENT_POINTER,
+   WLC_RENDER_EVENT_DAMAGE,
 };
 
 struct wlc_render_event {
    struct wlc_output *output;
+
+   // WLC_RENDER_EVENT_DAMAGE
+   // Damage of the drawn frame in framebuffer pixels, readbacks queued now are started with the frame.
+   struct pixman_region32 *damage;
+
    enum wlc_render_event_type type;
 };
 
@@ -360,6 +366,9 @@ die(const char *format, ...)
 /** Get current time anywhere. */
 uint32_t wlc_get_time(struct timespec *out_ts);
 
+/** Get current time in nanoseconds (CLOCK_MONOTONIC) anywhere. */
+uint64_t wlc_get_time_ns(void);
+
 /** Used to indicate whether TTY is activate, but effectively makes wlc compositor sleep. */
 void wlc_set_active(bool active);
 bool wlc_get_active(void);
@@ -7,6 +7,7 @@
 #include "x11.h"
 #endif
 #include "drm.h"
+#include "headless.h"
 
 bool
 wlc_backend_surface(struct wlc_backend_surface *surface, void (*destructor)(struct wlc_backend_surface*), size_t internal_size)
@@ -67,6 +68,7 @@ wlc_backend(struct wlc_backend *backend)
    memset(backend, 0, sizeof(struct wlc_backend));
 
    bool (*init[])(struct wlc_backend*) = {
+      wlc_headless,
 #ifdef ENABLE_X11_BACKEND
       wlc_x11,
 #endif
@@ -75,6 +77,7 @@ wlc_backend(struct wlc_backend *backend)
    };
 
    enum wlc_backend_type types[] = {
+      WLC_BACKEND_HEADLESS,
 #ifdef ENABLE_X11_BACKEND
       WLC_BACKEND_X11,
 #endif
@@ -3,9 +3,11 @@
 
 #include <wlc/wlc.h>
 #include <stdbool.h>
+#include <pixman.h>
 #include "EGL/egl.h"
 
 struct wlc_output;
+struct wl_resource;
 struct chck_pool;
 
 struct wlc_backend_surface {
@@ -18,6 +20,23 @@ struct wlc_backend_surface {
       WLC_NONULL void (*terminate)(struct wlc_backend_surface *surface);
       WLC_NONULL void (*sleep)(struct wlc_backend_surface *surface, bool sleep);
       WLC_NONULL bool (*page_flip)(struct wlc_backend_surface *surface);
+
+      // Software rendering, copies the damaged area of image to the next buffer shown by page_flip (NULL damage copies all)
+      WLC_NONULLV(1,2) bool (*put_pixels)(struct wlc_backend_surface *surface, pixman_image_t *image, pixman_region32_t *damage);
+
+      // Hardware cursor plane, shows image with hotspot at the position of move_cursor (framebuffer pixels).
+      // NULL image hides the cursor. Returns false when the image can't be shown and the cursor has to be composited.
+      WLC_NONULLV(1) bool (*set_cursor)(struct wlc_backend_surface *surface, pixman_image_t *image, const struct wlc_point *hotspot);
+      WLC_NONULL bool (*move_cursor)(struct wlc_backend_surface *surface, const struct wlc_point *pos);
+
+      // Direct scanout, flips client buffer instead of the next frame of the context.
+      // Returns false when the buffer can't be shown as is and the frame has to be composited.
+      WLC_NONULL bool (*scanout)(struct wlc_backend_surface *surface, struct wl_resource *buffer);
+
+      // Overlay planes, assigned buffers are shown at geometry (framebuffer pixels) above the next frame flipped.
+      // Each assignment is tested with the ones before it, false means the buffer has to be composited.
+      // NULL buffer drops the assignments that were not flipped yet.
+      WLC_NONULLV(1) bool (*assign_overlay)(struct wlc_backend_surface *surface, struct wl_resource *buffer, const struct wlc_geometry *geometry);
    } api;
 };
 
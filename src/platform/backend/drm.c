@@ -4,6 +4,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
@@ -17,6 +20,7 @@
 #include "backend.h"
 #include "compositor/compositor.h"
 #include "compositor/output.h"
+#include "compositor/presentation.h"
 #include "session/fd.h"
 
 // FIXME: Contains global state (event_source && fd)
@@ -31,6 +35,25 @@ struct drm_output_information {
    uint32_t width, height;
 };
 
+// Buffer of a plane for one frame, fb is owned by the bo (see destroy_bo_fb)
+struct drm_plane_fb {
+   struct gbm_bo *bo;
+   struct wlc_geometry geometry;
+   uint32_t fb;
+};
+
+// Planes are shared by all crtcs they can be used with, owner is the surface that has buffers on it.
+// Overlays hold the buffer assigned for next frame, the one in flight and the one on screen.
+struct drm_plane {
+   struct drm_surface *owner;
+   struct drm_plane_fb next, pending, current;
+   uint32_t id, possible_crtcs, type;
+
+   struct {
+      uint32_t type, fb_id, crtc_id, src_x, src_y, src_w, src_h, crtc_x, crtc_y, crtc_w, crtc_h;
+   } props;
+};
+
 struct drm_surface {
    struct gbm_device *device;
    struct gbm_surface *surface;
@@ -38,12 +61,42 @@ struct drm_surface {
    drmModeEncoder *encoder;
    drmModeCrtc *crtc;
 
+   // Locked buffers of the gbm surface, fd is owned by the bo (see create_fb)
+   // Imported bos are client buffers scanned out directly and destroyed on release
    struct drm_fb {
       struct gbm_bo *bo;
       uint32_t fd;
       uint32_t stride;
+      bool imported;
    } fb[NUM_FBS];
 
+   // Dumb buffers the software context copies its framebuffer into
+   struct drm_dumb {
+      pixman_image_t *image;
+      pixman_region32_t damage; // not yet copied from the framebuffer
+      void *map;
+      uint64_t size;
+      uint32_t handle, fb, stride;
+   } dumb[NUM_FBS];
+
+   // Cursor plane, pixels holds the last upload so unchanged images are not written again
+   struct {
+      struct gbm_bo *bo;
+      uint32_t *pixels, *staging;
+      struct wlc_point hotspot, pos;
+      uint32_t width, height;
+      bool visible, unsupported;
+   } cursor;
+
+   // Atomic modesetting, NULL primary means the legacy api is used
+   // fb is the primary fb on screen, overlays are tested against it
+   struct {
+      struct drm_plane *primary;
+      struct { uint32_t mode_id, active; } crtc;
+      struct { uint32_t crtc_id; } connector;
+      uint32_t crtc_index, mode_blob, fb;
+   } atomic;
+
    uint32_t stride;
    uint8_t index;
    bool flipping;
@@ -56,41 +109,115 @@ static struct {
 static struct {
    int fd;
    struct wl_event_source *event_source;
+   struct drm_plane *planes; // only with atomic modesetting
+   uint32_t num_planes;
+   struct chck_pool *outputs; // of the compositor, for probes finishing later
+   bool cursor;
+
+   // drmModeGetConnector may read EDID for a long time, so connectors are probed on a thread.
+   // Probed connectors are handed over under the mutex, fd is signaled when they are ready.
+   struct {
+      pthread_t thread;
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+      struct wl_event_source *event_source;
+      drmModeConnector **connectors;
+      uint32_t count;
+      int fd;
+      bool requested, quit, running;
+   } probe;
 } drm;
 
+static void
+release_plane_fb(struct drm_plane_fb *fb)
+{
+   assert(fb);
+
+   if (fb->bo)
+      gbm_bo_destroy(fb->bo);
+
+   memset(fb, 0, sizeof(struct drm_plane_fb));
+}
+
+static void
+drop_overlays(struct drm_surface *dsurface, bool flipped)
+{
+   assert(dsurface);
+
+   // Assignments go out with the frame that was flipped, otherwise they are composited again
+   for (uint32_t i = 0; i < drm.num_planes; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (p->owner != dsurface || p->type != DRM_PLANE_TYPE_OVERLAY)
+         continue;
+
+      if (flipped) {
+         assert(!p->pending.bo);
+         p->pending = p->next;
+         memset(&p->next, 0, sizeof(p->next));
+      } else {
+         release_plane_fb(&p->next);
+      }
+
+      if (!p->next.bo && !p->pending.bo && !p->current.bo)
+         p->owner = NULL;
+   }
+}
+
+static void
+present_overlays(struct drm_surface *dsurface)
+{
+   assert(dsurface);
+
+   for (uint32_t i = 0; i < drm.num_planes; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (p->owner != dsurface || p->type != DRM_PLANE_TYPE_OVERLAY)
+         continue;
+
+      release_plane_fb(&p->current);
+      p->current = p->pending;
+      memset(&p->pending, 0, sizeof(p->pending));
+
+      if (!p->next.bo && !p->current.bo)
+         p->owner = NULL;
+   }
+}
+
 static void
 release_fb(struct gbm_surface *surface, struct drm_fb *fb)
 {
    assert(surface && fb);
 
-   if (fb->fd > 0)
-      drmModeRmFB(drm.fd, fb->fd);
-
-   if (fb->bo)
+   // Fb stays registered with the bo, it's reused when gbm hands the bo out again
+   if (fb->bo && fb->imported) {
+      gbm_bo_destroy(fb->bo);
+   } else if (fb->bo) {
       gbm_surface_release_buffer(surface, fb->bo);
+   }
 
    fb->bo = NULL;
    fb->fd = 0;
+   fb->imported = false;
 }
 
 static void
 page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
 {
    assert(data);
-   (void)fd, (void)frame;
+   (void)fd;
    struct wlc_backend_surface *bsurface = data;
    struct drm_surface *dsurface = bsurface->internal;
 
    uint8_t next = (dsurface->index + 1) % NUM_FBS;
    release_fb(dsurface->surface, &dsurface->fb[next]);
    dsurface->index = next;
+   present_overlays(dsurface);
 
    struct timespec ts;
    ts.tv_sec = sec;
    ts.tv_nsec = usec * 1000;
 
    struct wlc_output *o;
-   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts);
+   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts, frame, WLC_PRESENTATION_VSYNC | WLC_PRESENTATION_HW_CLOCK | WLC_PRESENTATION_HW_COMPLETION);
    dsurface->flipping = false;
 }
 
@@ -106,6 +233,17 @@ drm_event(int fd, uint32_t mask, void *data)
    return 0;
 }
 
+static void
+destroy_bo_fb(struct gbm_bo *bo, void *data)
+{
+   (void)bo;
+   const uint32_t id = (uintptr_t)data;
+
+   // Bo may outlive the drm fd on shutdown, closing it already removed the fb
+   if (id && drm.fd > 0)
+      drmModeRmFB(drm.fd, id);
+}
+
 static bool
 create_fb(struct gbm_surface *surface, struct drm_fb *fb)
 {
@@ -117,15 +255,20 @@ create_fb(struct gbm_surface *surface, struct drm_fb *fb)
    if (!(fb->bo = gbm_surface_lock_front_buffer(surface)))
       goto failed_to_lock;
 
+   fb->stride = gbm_bo_get_stride(fb->bo);
+
+   // Swapchain buffers are registered once, the fb lives as long as the bo
+   if ((fb->fd = (uintptr_t)gbm_bo_get_user_data(fb->bo)))
+      return true;
+
    uint32_t width = gbm_bo_get_width(fb->bo);
    uint32_t height = gbm_bo_get_height(fb->bo);
    uint32_t handle = gbm_bo_get_handle(fb->bo).u32;
-   uint32_t stride = gbm_bo_get_stride(fb->bo);
 
-   if (drmModeAddFB(drm.fd, width, height, 24, 32, stride, handle, &fb->fd))
+   if (drmModeAddFB(drm.fd, width, height, 24, 32, fb->stride, handle, &fb->fd))
       goto failed_to_create_fb;
 
-   fb->stride = stride;
+   gbm_bo_set_user_data(fb->bo, (void*)(uintptr_t)fb->fd, destroy_bo_fb);
    return true;
 
 no_buffers:
@@ -141,6 +284,548 @@ fail:
    return false;
 }
 
+static void
+release_dumb(struct drm_dumb *dumb)
+{
+   assert(dumb);
+
+   if (dumb->image) {
+      pixman_image_unref(dumb->image);
+      pixman_region32_fini(&dumb->damage);
+   }
+
+   if (dumb->map)
+      munmap(dumb->map, dumb->size);
+
+   if (dumb->fb)
+      drmModeRmFB(drm.fd, dumb->fb);
+
+   if (dumb->handle) {
+      struct drm_mode_destroy_dumb destroy = { .handle = dumb->handle };
+      drmIoctl(drm.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+   }
+
+   memset(dumb, 0, sizeof(struct drm_dumb));
+}
+
+static bool
+create_dumb(struct drm_dumb *dumb, uint32_t width, uint32_t height)
+{
+   assert(dumb);
+
+   struct drm_mode_create_dumb create = { .width = width, .height = height, .bpp = 32 };
+   if (drmIoctl(drm.fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+      goto create_fail;
+
+   dumb->handle = create.handle;
+   dumb->stride = create.pitch;
+   dumb->size = create.size;
+
+   if (drmModeAddFB(drm.fd, width, height, 24, 32, dumb->stride, dumb->handle, &dumb->fb))
+      goto fb_fail;
+
+   struct drm_mode_map_dumb map = { .handle = dumb->handle };
+   if (drmIoctl(drm.fd, DRM_IOCTL_MODE_MAP_DUMB, &map))
+      goto map_fail;
+
+   if ((dumb->map = mmap(NULL, dumb->size, PROT_READ | PROT_WRITE, MAP_SHARED, drm.fd, map.offset)) == MAP_FAILED) {
+      dumb->map = NULL;
+      goto map_fail;
+   }
+
+   if (!(dumb->image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height, dumb->map, dumb->stride)))
+      goto map_fail;
+
+   // Contents are undefined, so the first copy is whole
+   pixman_region32_init_rect(&dumb->damage, 0, 0, width, height);
+   return true;
+
+create_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create dumb buffer: %m");
+   goto fail;
+fb_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create fb for dumb buffer: %m");
+   goto fail;
+map_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to map dumb buffer: %m");
+fail:
+   release_dumb(dumb);
+   return false;
+}
+
+static bool
+put_pixels(struct wlc_backend_surface *bsurface, pixman_image_t *image, pixman_region32_t *damage)
+{
+   assert(bsurface && bsurface->internal && image);
+   struct drm_surface *dsurface = bsurface->internal;
+
+   const int32_t width = pixman_image_get_width(image), height = pixman_image_get_height(image);
+
+   for (uint32_t i = 0; i < NUM_FBS; ++i) {
+      struct drm_dumb *dumb = &dsurface->dumb[i];
+      if (dumb->image && pixman_image_get_width(dumb->image) == width && pixman_image_get_height(dumb->image) == height)
+         continue;
+
+      release_dumb(dumb);
+
+      if (!create_dumb(dumb, width, height))
+         goto fail;
+   }
+
+   pixman_region32_t area;
+   pixman_region32_init_rect(&area, 0, 0, width, height);
+
+   if (damage)
+      pixman_region32_intersect(&area, &area, damage);
+
+   // Each buffer misses the damage of the frames since it was last written to
+   for (uint32_t i = 0; i < NUM_FBS; ++i)
+      pixman_region32_union(&dsurface->dumb[i].damage, &dsurface->dumb[i].damage, &area);
+
+   pixman_region32_fini(&area);
+
+   struct drm_dumb *dumb = &dsurface->dumb[dsurface->index];
+   pixman_image_set_clip_region32(dumb->image, &dumb->damage);
+   pixman_image_composite32(PIXMAN_OP_SRC, image, NULL, dumb->image, 0, 0, 0, 0, 0, 0, width, height);
+   pixman_image_set_clip_region32(dumb->image, NULL);
+   pixman_region32_clear(&dumb->damage);
+   return true;
+
+fail:
+   for (uint32_t i = 0; i < NUM_FBS; ++i)
+      release_dumb(&dsurface->dumb[i]);
+   return false;
+}
+
+static void
+release_cursor(struct drm_surface *dsurface)
+{
+   assert(dsurface);
+
+   if (dsurface->cursor.visible)
+      drmModeSetCursor(drm.fd, dsurface->crtc->crtc_id, 0, 0, 0);
+
+   if (dsurface->cursor.bo)
+      gbm_bo_destroy(dsurface->cursor.bo);
+
+   free(dsurface->cursor.pixels);
+   free(dsurface->cursor.staging);
+   memset(&dsurface->cursor, 0, sizeof(dsurface->cursor));
+}
+
+static bool
+create_cursor(struct drm_surface *dsurface)
+{
+   assert(dsurface && !dsurface->cursor.bo);
+
+   uint64_t width, height;
+   if (drmGetCap(drm.fd, DRM_CAP_CURSOR_WIDTH, &width) || !width)
+      width = 64;
+   if (drmGetCap(drm.fd, DRM_CAP_CURSOR_HEIGHT, &height) || !height)
+      height = 64;
+
+   dsurface->cursor.width = width;
+   dsurface->cursor.height = height;
+
+   if (!(dsurface->cursor.bo = gbm_bo_create(dsurface->device, width, height, GBM_FORMAT_ARGB8888, GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE)))
+      goto fail;
+
+   if (!(dsurface->cursor.pixels = calloc(width * height, sizeof(uint32_t))) || !(dsurface->cursor.staging = calloc(width * height, sizeof(uint32_t))))
+      goto fail;
+
+   // Contents of a new bo are undefined, start from the same transparent image as pixels
+   if (gbm_bo_write(dsurface->cursor.bo, dsurface->cursor.pixels, width * height * sizeof(uint32_t)))
+      goto fail;
+
+   return true;
+
+fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create %ux%u cursor bo, compositing the cursor", (uint32_t)width, (uint32_t)height);
+   release_cursor(dsurface);
+   return false;
+}
+
+static bool
+show_cursor(struct drm_surface *dsurface)
+{
+   assert(dsurface && dsurface->cursor.bo);
+   const uint32_t handle = gbm_bo_get_handle(dsurface->cursor.bo).u32;
+
+   // Hotspot is only a hint for virtual machines, we position the image ourselves
+   if (drmModeSetCursor2(drm.fd, dsurface->crtc->crtc_id, handle, dsurface->cursor.width, dsurface->cursor.height, dsurface->cursor.hotspot.x, dsurface->cursor.hotspot.y) &&
+       drmModeSetCursor(drm.fd, dsurface->crtc->crtc_id, handle, dsurface->cursor.width, dsurface->cursor.height))
+      return false;
+
+   return !drmModeMoveCursor(drm.fd, dsurface->crtc->crtc_id, dsurface->cursor.pos.x - dsurface->cursor.hotspot.x, dsurface->cursor.pos.y - dsurface->cursor.hotspot.y);
+}
+
+static bool
+set_cursor(struct wlc_backend_surface *bsurface, pixman_image_t *image, const struct wlc_point *hotspot)
+{
+   assert(bsurface && bsurface->internal);
+   struct drm_surface *dsurface = bsurface->internal;
+
+   if (!image) {
+      if (dsurface->cursor.visible)
+         drmModeSetCursor(drm.fd, dsurface->crtc->crtc_id, 0, 0, 0);
+
+      dsurface->cursor.visible = false;
+      return true;
+   }
+
+   assert(hotspot);
+
+   if (dsurface->cursor.unsupported || (!dsurface->cursor.bo && !create_cursor(dsurface)))
+      goto unsupported;
+
+   const uint32_t width = pixman_image_get_width(image), height = pixman_image_get_height(image);
+   if (width > dsurface->cursor.width || height > dsurface->cursor.height)
+      return false;
+
+   const size_t size = dsurface->cursor.width * dsurface->cursor.height * sizeof(uint32_t);
+
+   pixman_image_t *staging;
+   if (!(staging = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8, dsurface->cursor.width, dsurface->cursor.height, dsurface->cursor.staging, dsurface->cursor.width * sizeof(uint32_t))))
+      return false;
+
+   memset(dsurface->cursor.staging, 0, size);
+   pixman_image_composite32(PIXMAN_OP_SRC, image, NULL, staging, 0, 0, 0, 0, 0, 0, width, height);
+   pixman_image_unref(staging);
+
+   bool changed = (!dsurface->cursor.visible || !wlc_point_equals(&dsurface->cursor.hotspot, hotspot));
+
+   if (memcmp(dsurface->cursor.pixels, dsurface->cursor.staging, size)) {
+      if (gbm_bo_write(dsurface->cursor.bo, dsurface->cursor.staging, size))
+         goto unsupported;
+
+      memcpy(dsurface->cursor.pixels, dsurface->cursor.staging, size);
+      changed = true;
+   }
+
+   dsurface->cursor.hotspot = *hotspot;
+
+   if (changed && !show_cursor(dsurface))
+      goto unsupported;
+
+   dsurface->cursor.visible = true;
+   return true;
+
+unsupported:
+   if (!dsurface->cursor.unsupported)
+      wlc_log(WLC_LOG_WARN, "Cursor plane is not usable, compositing the cursor: %m");
+
+   if (dsurface->cursor.visible)
+      drmModeSetCursor(drm.fd, dsurface->crtc->crtc_id, 0, 0, 0);
+
+   dsurface->cursor.unsupported = true;
+   dsurface->cursor.visible = false;
+   return false;
+}
+
+static bool
+move_cursor(struct wlc_backend_surface *bsurface, const struct wlc_point *pos)
+{
+   assert(bsurface && bsurface->internal && pos);
+   struct drm_surface *dsurface = bsurface->internal;
+   dsurface->cursor.pos = *pos;
+
+   if (!dsurface->cursor.visible)
+      return false;
+
+   return !drmModeMoveCursor(drm.fd, dsurface->crtc->crtc_id, pos->x - dsurface->cursor.hotspot.x, pos->y - dsurface->cursor.hotspot.y);
+}
+
+static bool
+get_properties(uint32_t object, uint32_t type, const char *const names[], size_t count, uint32_t *out_ids, uint64_t *out_values)
+{
+   assert(names && out_ids);
+   memset(out_ids, 0, sizeof(uint32_t) * count);
+
+   drmModeObjectProperties *props;
+   if (!(props = drmModeObjectGetProperties(drm.fd, object, type)))
+      return false;
+
+   for (uint32_t i = 0; i < props->count_props; ++i) {
+      drmModePropertyRes *prop;
+      if (!(prop = drmModeGetProperty(drm.fd, props->props[i])))
+         continue;
+
+      for (size_t n = 0; n < count; ++n) {
+         if (strcmp(prop->name, names[n]))
+            continue;
+
+         out_ids[n] = prop->prop_id;
+
+         if (out_values)
+            out_values[n] = props->prop_values[i];
+      }
+
+      drmModeFreeProperty(prop);
+   }
+
+   drmModeFreeObjectProperties(props);
+
+   for (size_t n = 0; n < count; ++n) {
+      if (!out_ids[n])
+         return false;
+   }
+
+   return true;
+}
+
+static void
+add_plane(drmModeAtomicReq *req, struct drm_plane *plane, uint32_t crtc, uint32_t fb, const struct wlc_geometry *geometry)
+{
+   assert(req && plane);
+
+   drmModeAtomicAddProperty(req, plane->id, plane->props.fb_id, fb);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_id, (fb ? crtc : 0));
+
+   if (!fb)
+      return;
+
+   assert(geometry);
+
+   // Source is in 16.16 fixed point, buffers are shown unscaled
+   drmModeAtomicAddProperty(req, plane->id, plane->props.src_x, 0);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.src_y, 0);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.src_w, (uint64_t)geometry->size.w << 16);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.src_h, (uint64_t)geometry->size.h << 16);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_x, (uint64_t)(int64_t)geometry->origin.x);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_y, (uint64_t)(int64_t)geometry->origin.y);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_w, geometry->size.w);
+   drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_h, geometry->size.h);
+}
+
+static bool
+atomic_commit(struct wlc_backend_surface *bsurface, uint32_t fb, uint32_t flags)
+{
+   assert(bsurface && bsurface->internal);
+   struct drm_surface *dsurface = bsurface->internal;
+   assert(dsurface->atomic.primary);
+
+   struct wlc_output *o;
+   except((o = wl_container_of(bsurface, o, bsurface)));
+   const drmModeModeInfo *mode = &dsurface->connector->modes[o->active.mode];
+   const uint32_t crtc = dsurface->crtc->crtc_id;
+
+   drmModeAtomicReq *req;
+   if (!(req = drmModeAtomicAlloc()))
+      return false;
+
+   // Mode is set with the first frame, and again after sleep
+   uint32_t blob = 0;
+   if (!dsurface->stride) {
+      if (drmModeCreatePropertyBlob(drm.fd, mode, sizeof(*mode), &blob))
+         goto fail;
+
+      drmModeAtomicAddProperty(req, dsurface->connector->connector_id, dsurface->atomic.connector.crtc_id, crtc);
+      drmModeAtomicAddProperty(req, crtc, dsurface->atomic.crtc.mode_id, blob);
+      drmModeAtomicAddProperty(req, crtc, dsurface->atomic.crtc.active, 1);
+      flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+   }
+
+   add_plane(req, dsurface->atomic.primary, crtc, fb, &(struct wlc_geometry){ wlc_point_zero, { mode->hdisplay, mode->vdisplay } });
+
+   // Overlays without assignment are disabled
+   for (uint32_t i = 0; i < drm.num_planes; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (p->owner == dsurface && p->type == DRM_PLANE_TYPE_OVERLAY)
+         add_plane(req, p, crtc, p->next.fb, &p->next.geometry);
+   }
+
+   const bool committed = !drmModeAtomicCommit(drm.fd, req, flags, bsurface);
+   drmModeAtomicFree(req);
+
+   if (blob && committed && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+      if (dsurface->atomic.mode_blob)
+         drmModeDestroyPropertyBlob(drm.fd, dsurface->atomic.mode_blob);
+
+      dsurface->atomic.mode_blob = blob;
+   } else if (blob) {
+      drmModeDestroyPropertyBlob(drm.fd, blob);
+   }
+
+   return committed;
+
+fail:
+   drmModeAtomicFree(req);
+   return false;
+}
+
+static bool
+atomic_flip(struct wlc_backend_surface *bsurface, uint32_t fb)
+{
+   assert(bsurface && bsurface->internal);
+   struct drm_surface *dsurface = bsurface->internal;
+
+   // Primary plane, overlays and the mode change together
+   const bool flipped = atomic_commit(bsurface, fb, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK);
+   drop_overlays(dsurface, flipped);
+
+   if (flipped)
+      dsurface->atomic.fb = fb;
+
+   return flipped;
+}
+
+static struct gbm_bo*
+import_buffer(struct drm_surface *dsurface, struct wl_resource *buffer, const struct wlc_size *size, uint32_t *out_fb)
+{
+   assert(dsurface && buffer && size && out_fb);
+
+   struct gbm_bo *bo;
+   if (!(bo = gbm_bo_import(dsurface->device, GBM_BO_IMPORT_WL_BUFFER, buffer, GBM_BO_USE_SCANOUT)))
+      return NULL;
+
+   const uint32_t format = gbm_bo_get_format(bo);
+   if (gbm_bo_get_width(bo) != size->w || gbm_bo_get_height(bo) != size->h ||
+       (format != GBM_FORMAT_XRGB8888 && format != GBM_FORMAT_ARGB8888))
+      goto fail;
+
+   // Buffers shown directly are opaque, alpha is never blended with anything
+   const uint32_t handles[4] = { gbm_bo_get_handle(bo).u32 }, pitches[4] = { gbm_bo_get_stride(bo) }, offsets[4] = { 0 };
+   if (drmModeAddFB2(drm.fd, size->w, size->h, DRM_FORMAT_XRGB8888, handles, pitches, offsets, out_fb, 0))
+      goto fail;
+
+   gbm_bo_set_user_data(bo, (void*)(uintptr_t)*out_fb, destroy_bo_fb);
+   return bo;
+
+fail:
+   gbm_bo_destroy(bo);
+   return NULL;
+}
+
+static bool
+assign_overlay(struct wlc_backend_surface *bsurface, struct wl_resource *buffer, const struct wlc_geometry *geometry)
+{
+   assert(bsurface && bsurface->internal);
+   struct drm_surface *dsurface = bsurface->internal;
+
+   if (!buffer) {
+      drop_overlays(dsurface, false);
+      return true;
+   }
+
+   assert(geometry);
+
+   // Tests need the mode set and something on the primary plane
+   if (!dsurface->stride || !dsurface->atomic.fb)
+      return false;
+
+   struct drm_plane *plane = NULL;
+   for (uint32_t i = 0; i < drm.num_planes && !plane; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (p->type == DRM_PLANE_TYPE_OVERLAY && (p->possible_crtcs & (1 << dsurface->atomic.crtc_index)) && (!p->owner || p->owner == dsurface) && !p->next.bo)
+         plane = p;
+   }
+
+   if (!plane)
+      return false;
+
+   uint32_t fb;
+   struct gbm_bo *bo;
+   if (!(bo = import_buffer(dsurface, buffer, &geometry->size, &fb)))
+      return false;
+
+   plane->owner = dsurface;
+   plane->next = (struct drm_plane_fb){ bo, *geometry, fb };
+
+   if (!atomic_commit(bsurface, dsurface->atomic.fb, DRM_MODE_ATOMIC_TEST_ONLY)) {
+      wlc_dlog(WLC_DBG_RENDER, "-> Overlay plane %u rejected %ux%u+%d,%d", plane->id, geometry->size.w, geometry->size.h, geometry->origin.x, geometry->origin.y);
+      release_plane_fb(&plane->next);
+
+      if (!plane->pending.bo && !plane->current.bo)
+         plane->owner = NULL;
+
+      return false;
+   }
+
+   return true;
+}
+
+static void
+release_overlays(struct drm_surface *dsurface)
+{
+   assert(dsurface);
+
+   for (uint32_t i = 0; i < drm.num_planes; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (p->owner != dsurface || p->type != DRM_PLANE_TYPE_OVERLAY)
+         continue;
+
+      // Planes left enabled would make the next modeset fail, or show up on another crtc
+      if (p->pending.bo || p->current.bo)
+         drmModeSetPlane(drm.fd, p->id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+      release_plane_fb(&p->next);
+      release_plane_fb(&p->pending);
+      release_plane_fb(&p->current);
+      p->owner = NULL;
+   }
+
+   dsurface->atomic.fb = 0;
+}
+
+static void
+release_planes(struct drm_surface *dsurface)
+{
+   assert(dsurface);
+
+   release_overlays(dsurface);
+
+   if (dsurface->atomic.primary)
+      dsurface->atomic.primary->owner = NULL;
+
+   if (dsurface->atomic.mode_blob)
+      drmModeDestroyPropertyBlob(drm.fd, dsurface->atomic.mode_blob);
+
+   memset(&dsurface->atomic, 0, sizeof(dsurface->atomic));
+}
+
+static void
+setup_atomic(struct drm_surface *dsurface)
+{
+   assert(dsurface);
+
+   if (!drm.planes)
+      return;
+
+   drmModeRes *resources;
+   if (!(resources = drmModeGetResources(drm.fd)))
+      return;
+
+   int32_t index = -1;
+   for (int c = 0; c < resources->count_crtcs && index < 0; ++c) {
+      if (resources->crtcs[c] == dsurface->crtc->crtc_id)
+         index = c;
+   }
+
+   drmModeFreeResources(resources);
+
+   struct drm_plane *primary = NULL;
+   for (uint32_t i = 0; i < drm.num_planes && index >= 0 && !primary; ++i) {
+      struct drm_plane *p = &drm.planes[i];
+      if (!p->owner && p->type == DRM_PLANE_TYPE_PRIMARY && (p->possible_crtcs & (1 << index)))
+         primary = p;
+   }
+
+   static const char *const crtc_props[] = { "MODE_ID", "ACTIVE" };
+   static const char *const connector_props[] = { "CRTC_ID" };
+
+   if (!primary ||
+       !get_properties(dsurface->crtc->crtc_id, DRM_MODE_OBJECT_CRTC, crtc_props, LENGTH(crtc_props), (uint32_t*)&dsurface->atomic.crtc, NULL) ||
+       !get_properties(dsurface->connector->connector_id, DRM_MODE_OBJECT_CONNECTOR, connector_props, LENGTH(connector_props), (uint32_t*)&dsurface->atomic.connector, NULL)) {
+      wlc_log(WLC_LOG_WARN, "Crtc %u can't be used with atomic modesetting, using legacy api", dsurface->crtc->crtc_id);
+      memset(&dsurface->atomic, 0, sizeof(dsurface->atomic));
+      return;
+   }
+
+   primary->owner = dsurface;
+   dsurface->atomic.primary = primary;
+   dsurface->atomic.crtc_index = index;
+}
+
 static bool
 page_flip(struct wlc_backend_surface *bsurface)
 {
@@ -153,18 +838,40 @@ page_flip(struct wlc_backend_surface *bsurface)
    struct wlc_output *o;
    except((o = wl_container_of(bsurface, o, bsurface)));
 
-   if (!create_fb(dsurface->surface, fb))
-      return false;
+   uint32_t id, stride;
+   if (dsurface->dumb[dsurface->index].fb) {
+      // Software context, put_pixels has already filled the buffer
+      id = dsurface->dumb[dsurface->index].fb;
+      stride = dsurface->dumb[dsurface->index].stride;
+   } else {
+      if (!create_fb(dsurface->surface, fb))
+         return false;
+
+      id = fb->fd;
+      stride = fb->stride;
+   }
+
+   // Atomic commits change pitch without a modeset, the mode is only set after sleep
+   const bool modeset = (dsurface->atomic.primary ? !dsurface->stride : stride != dsurface->stride);
 
-   if (fb->stride != dsurface->stride) {
-      if (drmModeSetCrtc(drm.fd, dsurface->crtc->crtc_id, fb->fd, 0, 0, &dsurface->connector->connector_id, 1, &dsurface->connector->modes[o->active.mode]))
+   if (dsurface->atomic.primary) {
+      if (!atomic_flip(bsurface, id))
+         goto failed_to_page_flip;
+   } else {
+      if (modeset && drmModeSetCrtc(drm.fd, dsurface->crtc->crtc_id, id, 0, 0, &dsurface->connector->connector_id, 1, &dsurface->connector->modes[o->active.mode]))
          goto set_crtc_fail;
 
-      dsurface->stride = fb->stride;
+      if (drmModePageFlip(drm.fd, dsurface->crtc->crtc_id, id, DRM_MODE_PAGE_FLIP_EVENT, bsurface))
+         goto failed_to_page_flip;
    }
 
-   if (drmModePageFlip(drm.fd, dsurface->crtc->crtc_id, fb->fd, DRM_MODE_PAGE_FLIP_EVENT, bsurface))
-      goto failed_to_page_flip;
+   if (modeset) {
+      dsurface->stride = stride;
+
+      // Modeset after sleep, someone else may have used the cursor plane meanwhile
+      if (dsurface->cursor.visible && !show_cursor(dsurface))
+         dsurface->cursor.visible = false;
+   }
 
    dsurface->flipping = true;
    return true;
@@ -179,12 +886,56 @@ fail:
    return false;
 }
 
+static bool
+scanout(struct wlc_backend_surface *bsurface, struct wl_resource *buffer)
+{
+   assert(bsurface && bsurface->internal && buffer);
+   struct drm_surface *dsurface = bsurface->internal;
+   assert(!dsurface->flipping);
+
+   // Mode is set by page_flip, software context flips its own dumb buffers
+   if (!dsurface->stride || dsurface->dumb[dsurface->index].fb)
+      return false;
+
+   struct wlc_output *o;
+   except((o = wl_container_of(bsurface, o, bsurface)));
+
+   // Client covers the whole output, nothing is shown on the overlays
+   drop_overlays(dsurface, false);
+
+   uint32_t id;
+   struct gbm_bo *bo;
+   const drmModeModeInfo *mode = &dsurface->connector->modes[o->active.mode];
+   if (!(bo = import_buffer(dsurface, buffer, &(struct wlc_size){ mode->hdisplay, mode->vdisplay }, &id)))
+      goto fail;
+
+   // Some drivers can't flip to a different pitch or tiling, composite instead of doing a modeset
+   if (dsurface->atomic.primary ? !atomic_flip(bsurface, id) : drmModePageFlip(drm.fd, dsurface->crtc->crtc_id, id, DRM_MODE_PAGE_FLIP_EVENT, bsurface)) {
+      gbm_bo_destroy(bo);
+      goto fail;
+   }
+
+   struct drm_fb *fb = &dsurface->fb[dsurface->index];
+   release_fb(dsurface->surface, fb);
+   fb->bo = bo;
+   fb->fd = id;
+   fb->stride = gbm_bo_get_stride(bo);
+   fb->imported = true;
+   dsurface->flipping = true;
+   return true;
+
+fail:
+   wlc_dlog(WLC_DBG_RENDER, "-> Buffer can't be scanned out, compositing");
+   return false;
+}
+
 static void
 surface_sleep(struct wlc_backend_surface *bsurface, bool sleep)
 {
    struct drm_surface *dsurface = bsurface->internal;
 
    if (sleep) {
+      release_overlays(dsurface);
       drmModeSetCrtc(drm.fd, dsurface->crtc->crtc_id, 0, 0, 0, NULL, 0, NULL);
       dsurface->stride = 0;
    }
@@ -196,9 +947,18 @@ surface_release(struct wlc_backend_surface *bsurface)
    struct drm_surface *dsurface = bsurface->internal;
    struct drm_fb *fb = &dsurface->fb[dsurface->index];
    release_fb(dsurface->surface, fb);
+   release_cursor(dsurface);
+   release_planes(dsurface);
 
    drmModeSetCrtc(drm.fd, dsurface->crtc->crtc_id, dsurface->crtc->buffer_id, dsurface->crtc->x, dsurface->crtc->y, &dsurface->connector->connector_id, 1, &dsurface->crtc->mode);
 
+   // Buffer that was on screen is free now as well
+   for (uint32_t i = 0; i < NUM_FBS; ++i)
+      release_fb(dsurface->surface, &dsurface->fb[i]);
+
+   for (uint32_t i = 0; i < NUM_FBS; ++i)
+      release_dumb(&dsurface->dumb[i]);
+
    if (dsurface->crtc)
       drmModeFreeCrtc(dsurface->crtc);
 
@@ -232,6 +992,18 @@ add_output(struct gbm_device *device, struct gbm_surface *surface, struct drm_ou
    bsurface.window = (EGLNativeWindowType)surface;
    bsurface.api.sleep = surface_sleep;
    bsurface.api.page_flip = page_flip;
+   bsurface.api.put_pixels = put_pixels;
+   bsurface.api.scanout = scanout;
+
+   setup_atomic(dsurface);
+
+   if (dsurface->atomic.primary)
+      bsurface.api.assign_overlay = assign_overlay;
+
+   if (drm.cursor) {
+      bsurface.api.set_cursor = set_cursor;
+      bsurface.api.move_cursor = move_cursor;
+   }
 
    struct wlc_output_event ev = { .add = { &bsurface, &info->info }, .type = WLC_OUTPUT_EVENT_ADD };
    wl_signal_emit(&wlc_system_signals()->output, &ev);
@@ -297,24 +1069,69 @@ wlc_connector_for_drm_connector(uint32_t type)
    return WLC_CONNECTOR_UNKNOWN;
 }
 
+static void
+release_connectors(drmModeConnector **connectors, uint32_t count)
+{
+   if (!connectors)
+      return;
+
+   for (uint32_t c = 0; c < count; ++c) {
+      if (connectors[c])
+         drmModeFreeConnector(connectors[c]);
+   }
+
+   free(connectors);
+}
+
+static drmModeConnector**
+probe_connectors(int fd, uint32_t *out_count)
+{
+   assert(out_count);
+   *out_count = 0;
+
+   // Runs on the probe thread, don't log here
+   drmModeRes *resources;
+   if (!(resources = drmModeGetResources(fd)))
+      return NULL;
+
+   drmModeConnector **connectors;
+   if (!(connectors = calloc(resources->count_connectors + 1, sizeof(drmModeConnector*)))) {
+      drmModeFreeResources(resources);
+      return NULL;
+   }
+
+   // Failed connectors are left NULL, query_drm reports them
+   for (int c = 0; c < resources->count_connectors; ++c)
+      connectors[c] = drmModeGetConnector(fd, resources->connectors[c]);
+
+   *out_count = resources->count_connectors;
+   drmModeFreeResources(resources);
+   return connectors;
+}
+
 static bool
-query_drm(int fd, struct chck_iter_pool *out_infos)
+query_drm(int fd, drmModeConnector **connectors, uint32_t count, struct chck_iter_pool *out_infos)
 {
+   assert(connectors);
+
    drmModeRes *resources;
    if (!(resources = drmModeGetResources(fd))) {
       wlc_log(WLC_LOG_WARN, "Failed to get drm resources");
       goto resources_fail;
    }
 
-   for (int c = 0; c < resources->count_connectors; c++) {
+   // Connectors are taken by the infos that use them, the rest is released by caller
+   for (uint32_t c = 0; c < count; c++) {
       drmModeConnector *connector;
-      if (!(connector = drmModeGetConnector(fd, resources->connectors[c]))) {
-         wlc_log(WLC_LOG_WARN, "Failed to get connector %d", c);
+      if (!(connector = connectors[c])) {
+         wlc_log(WLC_LOG_WARN, "Failed to get connector %u", c);
          continue;
       }
 
+      connectors[c] = NULL;
+
       if (connector->connection != DRM_MODE_CONNECTED || connector->count_modes <= 0) {
-         wlc_log(WLC_LOG_WARN, "Connector %d is not connected or has no modes", c);
+         wlc_log(WLC_LOG_WARN, "Connector %u is not connected or has no modes", c);
          drmModeFreeConnector(connector);
          continue;
       }
@@ -322,14 +1139,14 @@ query_drm(int fd, struct chck_iter_pool *out_infos)
       int32_t crtc_id;
       drmModeEncoder *encoder;
       if (!(encoder = find_encoder_for_connector(fd, resources, connector, &crtc_id))) {
-         wlc_log(WLC_LOG_WARN, "Failed to find encoder for connector %d", c);
+         wlc_log(WLC_LOG_WARN, "Failed to find encoder for connector %u", c);
          drmModeFreeConnector(connector);
          continue;
       }
 
       drmModeCrtc *crtc;
       if (!(crtc = drmModeGetCrtc(drm.fd, crtc_id))) {
-         wlc_log(WLC_LOG_WARN, "Failed to get crtc for connector %d (with id: %d)", c, crtc_id);
+         wlc_log(WLC_LOG_WARN, "Failed to get crtc for connector %u (with id: %d)", c, crtc_id);
          drmModeFreeEncoder(encoder);
          drmModeFreeConnector(connector);
          continue;
@@ -373,7 +1190,7 @@ query_drm(int fd, struct chck_iter_pool *out_infos)
             info->height = connector->modes[i].vdisplay;
          }
 
-         wlc_log(WLC_LOG_INFO, "MODE: (%d) %ux%u@%u %s", c, mode.width, mode.height, mode.refresh, (mode.flags & WL_OUTPUT_MODE_CURRENT ? "*" : (mode.flags & WL_OUTPUT_MODE_PREFERRED ? "!" : "")));
+         wlc_log(WLC_LOG_INFO, "MODE: (%u) %ux%u@%u %s", c, mode.width, mode.height, mode.refresh, (mode.flags & WL_OUTPUT_MODE_CURRENT ? "*" : (mode.flags & WL_OUTPUT_MODE_PREFERRED ? "!" : "")));
          wlc_output_information_add_mode(&info->info, &mode);
       }
 
@@ -382,29 +1199,74 @@ query_drm(int fd, struct chck_iter_pool *out_infos)
       info->connector = connector;
    }
 
+   drmModeFreeResources(resources);
    return true;
 
 resources_fail:
    wlc_log(WLC_LOG_WARN, "drmModeGetResources failed");
-   memset(&drm, 0, sizeof(drm));
    return false;
 }
 
 static void
-terminate(void)
+init_atomic(void)
 {
-   if (drm.event_source)
-      wl_event_source_remove(drm.event_source);
+   bool atomic = true;
+   chck_cstr_to_bool(getenv("WLC_DRM_ATOMIC"), &atomic);
 
-   if (gbm.device)
-      gbm_device_destroy(gbm.device);
+   if (!atomic || drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1))
+      goto legacy;
 
-   wlc_fd_close(drm.fd);
+   if (drmSetClientCap(drm.fd, DRM_CLIENT_CAP_ATOMIC, 1))
+      goto no_atomic;
 
-   memset(&drm, 0, sizeof(drm));
-   memset(&gbm, 0, sizeof(gbm));
+   drmModePlaneRes *res;
+   if (!(res = drmModeGetPlaneResources(drm.fd)))
+      goto no_planes;
 
-   wlc_log(WLC_LOG_INFO, "Closed drm");
+   if (!res->count_planes || !(drm.planes = calloc(res->count_planes, sizeof(struct drm_plane)))) {
+      drmModeFreePlaneResources(res);
+      goto no_planes;
+   }
+
+   static const char *const props[] = {
+      "type", "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H"
+   };
+
+   for (uint32_t i = 0; i < res->count_planes; ++i) {
+      drmModePlane *plane;
+      if (!(plane = drmModeGetPlane(drm.fd, res->planes[i])))
+         continue;
+
+      struct drm_plane *p = &drm.planes[drm.num_planes];
+      p->id = plane->plane_id;
+      p->possible_crtcs = plane->possible_crtcs;
+      drmModeFreePlane(plane);
+
+      uint64_t values[LENGTH(props)];
+      if (!get_properties(p->id, DRM_MODE_OBJECT_PLANE, props, LENGTH(props), (uint32_t*)&p->props, values))
+         continue;
+
+      p->type = values[0];
+      drm.num_planes++;
+   }
+
+   drmModeFreePlaneResources(res);
+
+   if (!drm.num_planes) {
+      free(drm.planes);
+      drm.planes = NULL;
+      goto no_planes;
+   }
+
+   wlc_log(WLC_LOG_INFO, "Using atomic modesetting (%u planes)", drm.num_planes);
+   return;
+
+no_planes:
+   drmSetClientCap(drm.fd, DRM_CLIENT_CAP_ATOMIC, 0);
+no_atomic:
+   drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
+legacy:
+   wlc_log(WLC_LOG_INFO, "Using legacy modesetting");
 }
 
 static bool
@@ -433,11 +1295,18 @@ info_exists_for_drm_surface(struct chck_iter_pool *infos, struct drm_surface *ds
 }
 
 static uint32_t
-update_outputs(struct chck_pool *outputs)
+add_outputs(struct chck_pool *outputs, drmModeConnector **connectors, uint32_t count)
 {
+   assert(connectors);
+
    struct chck_iter_pool infos;
-   if (!chck_iter_pool(&infos, 4, 0, sizeof(struct drm_output_information)) || !query_drm(drm.fd, &infos))
+   if (!chck_iter_pool(&infos, 4, 0, sizeof(struct drm_output_information)))
+      return 0;
+
+   if (!query_drm(drm.fd, connectors, count, &infos)) {
+      chck_iter_pool_release(&infos);
       return 0;
+   }
 
    if (outputs) {
       struct wlc_output *o;
@@ -451,7 +1320,7 @@ update_outputs(struct chck_pool *outputs)
       }
    }
 
-   uint32_t count = 0;
+   uint32_t added = 0;
    struct drm_output_information *info;
    chck_iter_pool_for_each(&infos, info) {
       if (outputs && output_exists_for_connector(outputs, info->connector))
@@ -461,17 +1330,194 @@ update_outputs(struct chck_pool *outputs)
       if (!(surface = gbm_surface_create(gbm.device, info->width, info->height, GBM_BO_FORMAT_XRGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING)))
          continue;
 
-      count += (add_output(gbm.device, surface, info) ? 1 : 0);
+      added += (add_output(gbm.device, surface, info) ? 1 : 0);
    }
 
    chck_iter_pool_release(&infos);
-   return count;
+   return added;
+}
+
+static void*
+probe_thread(void *data)
+{
+   (void)data;
+
+   pthread_mutex_lock(&drm.probe.mutex);
+
+   while (true) {
+      while (!drm.probe.requested && !drm.probe.quit)
+         pthread_cond_wait(&drm.probe.cond, &drm.probe.mutex);
+
+      if (drm.probe.quit)
+         break;
+
+      drm.probe.requested = false;
+      pthread_mutex_unlock(&drm.probe.mutex);
+
+      uint32_t count;
+      drmModeConnector **connectors = probe_connectors(drm.fd, &count);
+
+      pthread_mutex_lock(&drm.probe.mutex);
+
+      // Another hotplug came in while probing, only the newest state is handed over
+      if (drm.probe.requested || drm.probe.quit || !connectors) {
+         release_connectors(connectors, count);
+         continue;
+      }
+
+      release_connectors(drm.probe.connectors, drm.probe.count);
+      drm.probe.connectors = connectors;
+      drm.probe.count = count;
+      eventfd_write(drm.probe.fd, 1);
+   }
+
+   pthread_mutex_unlock(&drm.probe.mutex);
+   return NULL;
+}
+
+static int
+probe_event(int fd, uint32_t mask, void *data)
+{
+   (void)mask, (void)data;
+
+   eventfd_t value;
+   eventfd_read(fd, &value);
+
+   pthread_mutex_lock(&drm.probe.mutex);
+   uint32_t count = drm.probe.count;
+   drmModeConnector **connectors = drm.probe.connectors;
+   drm.probe.connectors = NULL;
+   drm.probe.count = 0;
+   pthread_mutex_unlock(&drm.probe.mutex);
+
+   if (!connectors)
+      return 0;
+
+   // Not drm master anymore, activation probes again
+   if (wlc_get_active()) {
+      const uint32_t added = add_outputs(drm.outputs, connectors, count);
+      wlc_log(WLC_LOG_INFO, "Probed %u connectors, added %u outputs", count, added);
+   }
+
+   release_connectors(connectors, count);
+   return 0;
+}
+
+static bool
+start_probe_thread(void)
+{
+   if ((drm.probe.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+      goto eventfd_fail;
+
+   if (!(drm.probe.event_source = wl_event_loop_add_fd(wlc_event_loop(), drm.probe.fd, WL_EVENT_READABLE, probe_event, NULL)))
+      goto fail;
+
+   pthread_mutex_init(&drm.probe.mutex, NULL);
+   pthread_cond_init(&drm.probe.cond, NULL);
+
+   if (pthread_create(&drm.probe.thread, NULL, probe_thread, NULL)) {
+      pthread_cond_destroy(&drm.probe.cond);
+      pthread_mutex_destroy(&drm.probe.mutex);
+      goto thread_fail;
+   }
+
+   drm.probe.running = true;
+   return true;
+
+eventfd_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create eventfd: %m");
+   goto fail;
+thread_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create connector probe thread");
+fail:
+   if (drm.probe.event_source)
+      wl_event_source_remove(drm.probe.event_source);
+
+   if (drm.probe.fd >= 0)
+      close(drm.probe.fd);
+
+   drm.probe.event_source = NULL;
+   drm.probe.fd = -1;
+   return false;
+}
+
+static void
+stop_probe_thread(void)
+{
+   if (drm.probe.running) {
+      // Waits for the probe in progress, if any
+      pthread_mutex_lock(&drm.probe.mutex);
+      drm.probe.quit = true;
+      pthread_cond_signal(&drm.probe.cond);
+      pthread_mutex_unlock(&drm.probe.mutex);
+      pthread_join(drm.probe.thread, NULL);
+
+      release_connectors(drm.probe.connectors, drm.probe.count);
+      pthread_cond_destroy(&drm.probe.cond);
+      pthread_mutex_destroy(&drm.probe.mutex);
+   }
+
+   if (drm.probe.event_source)
+      wl_event_source_remove(drm.probe.event_source);
+
+   if (drm.probe.fd >= 0)
+      close(drm.probe.fd);
+
+   memset(&drm.probe, 0, sizeof(drm.probe));
+   drm.probe.fd = -1;
+}
+
+static uint32_t
+update_outputs(struct chck_pool *outputs)
+{
+   drm.outputs = outputs;
+
+   if (!drm.probe.running) {
+      // No probe thread, block the loop like before
+      uint32_t count, added = 0;
+      drmModeConnector **connectors;
+      if ((connectors = probe_connectors(drm.fd, &count)))
+         added = add_outputs(outputs, connectors, count);
+
+      release_connectors(connectors, count);
+      return added;
+   }
+
+   // Outputs are added when the probe finishes, see probe_event
+   pthread_mutex_lock(&drm.probe.mutex);
+   drm.probe.requested = true;
+   pthread_cond_signal(&drm.probe.cond);
+   pthread_mutex_unlock(&drm.probe.mutex);
+   return 0;
+}
+
+static void
+terminate(void)
+{
+   stop_probe_thread();
+
+   if (drm.event_source)
+      wl_event_source_remove(drm.event_source);
+
+   free(drm.planes);
+
+   if (gbm.device)
+      gbm_device_destroy(gbm.device);
+
+   wlc_fd_close(drm.fd);
+
+   memset(&drm, 0, sizeof(drm));
+   memset(&gbm, 0, sizeof(gbm));
+
+   wlc_log(WLC_LOG_INFO, "Closed drm");
 }
 
 bool
 wlc_drm(struct wlc_backend *backend)
 {
-   drm.fd = -1;
+   drm.fd = drm.probe.fd = -1;
+   drm.cursor = true;
+   chck_cstr_to_bool(getenv("WLC_HW_CURSOR"), &drm.cursor);
 
    const char *device = getenv("WLC_DRM_DEVICE");
    device = (chck_cstr_is_empty(device) ? "card0" : device);
@@ -487,6 +1533,8 @@ wlc_drm(struct wlc_backend *backend)
    if (drm.fd < 0)
       goto card_open_fail;
 
+   init_atomic();
+
    /* GBM will load a dri driver, but even though they need symbols from
     * libglapi, in some version of Mesa they are not linked to it. Since
     * only the gl-renderer module links to it, the call above won't make
@@ -500,6 +1548,9 @@ wlc_drm(struct wlc_backend *backend)
    if (!(drm.event_source = wl_event_loop_add_fd(wlc_event_loop(), drm.fd, WL_EVENT_READABLE, drm_event, NULL)))
       goto fail;
 
+   // Without the thread connectors are probed on the loop
+   start_probe_thread();
+
    backend->api.update_outputs = update_outputs;
    backend->api.terminate = terminate;
    return true;
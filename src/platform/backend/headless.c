@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <wayland-server.h>
+#include <chck/math/math.h>
+#include <chck/string/string.h>
+#include "internal.h"
+#include "headless.h"
+#include "backend.h"
+#include "compositor/output.h"
+
+// Outputs without any display behind them, for tests and remote sessions.
+// Frames are drawn in memory by the software renderer, and presented at a fixed rate.
+
+enum {
+   HEADLESS_WIDTH = 1024,
+   HEADLESS_HEIGHT = 768,
+   HEADLESS_REFRESH = 60 * 1000, // mHz
+};
+
+struct headless_surface {
+   struct wl_event_source *vblank;
+};
+
+static int
+vblank(void *data)
+{
+   struct wlc_backend_surface *bsurface = data;
+   assert(bsurface);
+
+   struct timespec ts;
+   wlc_get_time(&ts);
+   struct wlc_output *o;
+   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts, 0, 0);
+   return 1;
+}
+
+static bool
+page_flip(struct wlc_backend_surface *bsurface)
+{
+   assert(bsurface);
+   struct headless_surface *hsurface = bsurface->internal;
+
+   if (!hsurface->vblank && !(hsurface->vblank = wl_event_loop_add_timer(wlc_event_loop(), vblank, bsurface)))
+      return false;
+
+   return (wl_event_source_timer_update(hsurface->vblank, 1000 * 1000 / HEADLESS_REFRESH) == 0);
+}
+
+static bool
+put_pixels(struct wlc_backend_surface *bsurface, pixman_image_t *image, pixman_region32_t *damage)
+{
+   // Nothing to show the frame on, it stays in the framebuffer of the context
+   (void)bsurface, (void)image, (void)damage;
+   return true;
+}
+
+static void
+surface_release(struct wlc_backend_surface *bsurface)
+{
+   struct headless_surface *hsurface = bsurface->internal;
+
+   if (hsurface->vblank)
+      wl_event_source_remove(hsurface->vblank);
+}
+
+static bool
+add_output(uint32_t id)
+{
+   struct wlc_backend_surface bsurface;
+   if (!wlc_backend_surface(&bsurface, surface_release, sizeof(struct headless_surface)))
+      return false;
+
+   // Outputs only take surfaces with a display, there's no EGL display to give so any unique pointer does
+   bsurface.display = (EGLNativeDisplayType)bsurface.internal;
+   bsurface.api.page_flip = page_flip;
+   bsurface.api.put_pixels = put_pixels;
+
+   struct wlc_output_information info;
+   wlc_output_information(&info);
+   chck_string_set_cstr(&info.make, "wlc", false);
+   chck_string_set_cstr(&info.model, "Headless", false);
+   info.scale = 1;
+   info.connector = WLC_CONNECTOR_WLC;
+   info.connector_id = id;
+
+   struct wlc_output_mode mode = {0};
+   mode.refresh = HEADLESS_REFRESH;
+   mode.width = HEADLESS_WIDTH;
+   mode.height = HEADLESS_HEIGHT;
+   mode.flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+   wlc_output_information_add_mode(&info, &mode);
+
+   struct wlc_output_event ev = { .add = { &bsurface, &info }, .type = WLC_OUTPUT_EVENT_ADD };
+   wl_signal_emit(&wlc_system_signals()->output, &ev);
+   return true;
+}
+
+static uint32_t
+update_outputs(struct chck_pool *outputs)
+{
+   uint32_t alive = 0;
+   if (outputs) {
+      struct wlc_output *o;
+      chck_pool_for_each(outputs, o) {
+         if (o->bsurface.api.page_flip == page_flip)
+            ++alive;
+      }
+   }
+
+   const char *env;
+   uint32_t wanted = 1;
+   if ((env = getenv("WLC_OUTPUTS"))) {
+      chck_cstr_to_u32(env, &wanted);
+      wanted = chck_maxu32(wanted, 1);
+   }
+
+   uint32_t count = 0;
+   for (uint32_t i = alive; i < wanted; ++i)
+      count += (add_output(1 + i) ? 1 : 0);
+
+   return count;
+}
+
+bool
+wlc_headless(struct wlc_backend *backend)
+{
+   bool enabled = false;
+   chck_cstr_to_bool(getenv("WLC_HEADLESS"), &enabled);
+
+   if (!enabled)
+      return false;
+
+   backend->api.update_outputs = update_outputs;
+   wlc_log(WLC_LOG_INFO, "Using headless backend");
+   return true;
+}
@@ -38,6 +38,7 @@ static struct {
    xcb_connection_t *connection;
    xcb_screen_t *screen;
    xcb_cursor_t cursor;
+   xcb_gcontext_t gc;
    xcb_atom_t atoms[ATOM_LAST];
    uint8_t xkb_event_base;
 
@@ -50,7 +51,53 @@ page_flip(struct wlc_backend_surface *bsurface)
    struct timespec ts;
    wlc_get_time(&ts);
    struct wlc_output *o;
-   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts);
+   // No vblank information available, the frame is considered presented right away
+   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts, 0, 0);
+   return true;
+}
+
+static bool
+put_pixels(struct wlc_backend_surface *bsurface, pixman_image_t *image, pixman_region32_t *damage)
+{
+   assert(bsurface && image);
+
+   const int32_t width = pixman_image_get_width(image), height = pixman_image_get_height(image);
+   const uint32_t stride = pixman_image_get_stride(image);
+   const uint8_t *data = (uint8_t*)pixman_image_get_data(image);
+
+   pixman_region32_t area;
+   pixman_region32_init_rect(&area, 0, 0, width, height);
+
+   if (damage)
+      pixman_region32_intersect(&area, &area, damage);
+
+   // Requests have limited size, so rectangles are sent in bands of rows
+   const uint32_t max_bytes = xcb_get_maximum_request_length(x11.connection) * 4 - sizeof(xcb_put_image_request_t);
+
+   int nrects;
+   pixman_box32_t *rects = pixman_region32_rectangles(&area, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const uint32_t w = rects[i].x2 - rects[i].x1, h = rects[i].y2 - rects[i].y1;
+      const uint32_t row_bytes = w * 4;
+      const uint32_t band = chck_minu32(max_bytes / row_bytes, h);
+
+      uint8_t *packed;
+      if (!band || !(packed = malloc(band * row_bytes)))
+         continue;
+
+      for (uint32_t y = 0; y < h; y += band) {
+         const uint32_t rows = chck_minu32(band, h - y);
+         for (uint32_t r = 0; r < rows; ++r)
+            memcpy(packed + r * row_bytes, data + (rects[i].y1 + y + r) * stride + rects[i].x1 * 4, row_bytes);
+
+         xcb_put_image(x11.connection, XCB_IMAGE_FORMAT_Z_PIXMAP, bsurface->window, x11.gc, w, rows, rects[i].x1, rects[i].y1 + y, 0, x11.screen->root_depth, rows * row_bytes, packed);
+      }
+
+      free(packed);
+   }
+
+   pixman_region32_fini(&area);
+   xcb_flush(x11.connection);
    return true;
 }
 
@@ -71,6 +118,10 @@ add_output(xcb_window_t window, struct wlc_output_information *info)
    bsurface.display = x11.display;
    bsurface.api.page_flip = page_flip;
 
+   // Framebuffer of the software context is XRGB8888
+   if (x11.gc && x11.screen->root_depth == 24)
+      bsurface.api.put_pixels = put_pixels;
+
    struct wlc_output_event ev = { .add = { &bsurface, info }, .type = WLC_OUTPUT_EVENT_ADD };
    wl_signal_emit(&wlc_system_signals()->output, &ev);
    return true;
@@ -154,8 +205,10 @@ x11_event(int fd, uint32_t mask, void *data)
          {
             xcb_expose_event_t *ev = (xcb_expose_event_t*)event;
             struct wlc_output *output;
-            if ((output = output_for_window(&compositor->outputs.pool, ev->window)))
+            if ((output = output_for_window(&compositor->outputs.pool, ev->window))) {
+               wlc_output_damage_all(output);
                wlc_output_schedule_repaint(output);
+            }
          }
          break;
 
@@ -452,6 +505,9 @@ setup_xkb(void)
 static void
 terminate(void)
 {
+   if (x11.gc)
+      xcb_free_gc(x11.connection, x11.gc);
+
    if (x11.cursor)
       xcb_free_cursor(x11.connection, x11.cursor);
 
@@ -515,6 +571,9 @@ wlc_x11(struct wlc_backend *backend)
    xcb_free_gc(x11.connection, gc);
    xcb_free_pixmap(x11.connection, pixmap);
 
+   if ((x11.gc = xcb_generate_id(x11.connection)))
+      xcb_create_gc(x11.connection, x11.gc, x11.screen->root, 0, NULL);
+
    if (!setup_xkb())
       goto could_not_use_xkb_extension;
 
@@ -1,9 +1,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <chck/string/string.h>
 #include "internal.h"
 #include "context.h"
 #include "egl.h"
+#include "framebuffer.h"
+#include "platform/backend/backend.h"
 
 void*
 wlc_context_get_proc_address(struct wlc_context *context, const char *procname)
@@ -16,6 +19,18 @@ wlc_context_get_proc_address(struct wlc_context *context, const char *procname)
    return context->api.get_proc_address(context->context, procname);
 }
 
+const void*
+wlc_context_get_share_group(struct wlc_context *context)
+{
+   assert(context);
+
+   // NULL means objects are private to this context
+   if (!context->context || !context->api.share_group)
+      return NULL;
+
+   return context->api.share_group(context->context);
+}
+
 EGLBoolean
 wlc_context_query_buffer(struct wlc_context *context, struct wl_resource *buffer, EGLint attribute, EGLint *value)
 {
@@ -49,6 +64,46 @@ wlc_context_destroy_image(struct wlc_context *context, EGLImageKHR image)
    return context->api.destroy_image(context->context, image);
 }
 
+bool
+wlc_context_export_image(struct wlc_context *context, EGLImageKHR image, struct wlc_dmabuf_attributes *out_attributes)
+{
+   assert(context && image && out_attributes);
+
+   if (!context->api.export_image)
+      return false;
+
+   return context->api.export_image(context->context, image, out_attributes);
+}
+
+int32_t
+wlc_context_create_fence(struct wlc_context *context)
+{
+   assert(context);
+
+   if (!context->api.create_fence)
+      return -1;
+
+   return context->api.create_fence(context->context);
+}
+
+bool
+wlc_context_has_framebuffer(struct wlc_context *context)
+{
+   assert(context);
+   return (context->api.framebuffer != NULL);
+}
+
+pixman_image_t*
+wlc_context_get_framebuffer(struct wlc_context *context, const struct wlc_size *size)
+{
+   assert(context && size);
+
+   if (!context->api.framebuffer)
+      return NULL;
+
+   return context->api.framebuffer(context->context, size);
+}
+
 bool
 wlc_context_bind(struct wlc_context *context)
 {
@@ -76,12 +131,23 @@ wlc_context_bind_to_wl_display(struct wlc_context *context, struct wl_display *d
 }
 
 void
-wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface)
+wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface, pixman_region32_t *damage)
 {
    assert(context);
 
    if (context->api.swap)
-      context->api.swap(context->context, bsurface);
+      context->api.swap(context->context, bsurface, damage);
+}
+
+int32_t
+wlc_context_get_buffer_age(struct wlc_context *context)
+{
+   assert(context);
+
+   if (!context->api.buffer_age)
+      return 0;
+
+   return context->api.buffer_age(context->context);
 }
 
 void
@@ -104,10 +170,17 @@ wlc_context(struct wlc_context *context, struct wlc_backend_surface *surface)
 
    void* (*constructor[])(struct wlc_backend_surface*, struct wlc_context_api*) = {
       wlc_egl,
+      wlc_framebuffer,
       NULL
    };
 
-   for (uint32_t i = 0; constructor[i]; ++i) {
+   // Software renderer only draws to framebuffer in memory, don't bother with EGL.
+   // Surfaces without a window (headless) have nothing for EGL to draw on either.
+   bool pixman = false;
+   chck_cstr_to_bool(getenv("WLC_PIXMAN"), &pixman);
+   const uint32_t first = (pixman || !surface->window ? 1 : 0);
+
+   for (uint32_t i = first; constructor[i]; ++i) {
       if ((context->context = constructor[i](surface, &context->api)))
          return true;
    }
@@ -2,6 +2,10 @@
 #define _WLC_CONTEXT_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+#include <wlc/geometry.h>
+#include <wlc/wlc-render.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
@@ -13,13 +17,20 @@ struct wlc_context_api {
    WLC_NONULL void (*terminate)(struct ctx *context);
    WLC_NONULL bool (*bind)(struct ctx *context);
    WLC_NONULL bool (*bind_to_wl_display)(struct ctx *context, struct wl_display *display);
-   WLC_NONULL void (*swap)(struct ctx *context, struct wlc_backend_surface *bsurface);
+   WLC_NONULLV(1,2) void (*swap)(struct ctx *context, struct wlc_backend_surface *bsurface, pixman_region32_t *damage);
+   WLC_NONULL int32_t (*buffer_age)(struct ctx *context);
    WLC_NONULL void* (*get_proc_address)(struct ctx *context, const char *procname);
+   WLC_NONULL const void* (*share_group)(struct ctx *context);
 
    // EGL
    WLC_NONULL EGLBoolean (*query_buffer)(struct ctx *context, struct wl_resource *buffer, EGLint attribute, EGLint *value);
    WLC_NONULL EGLImageKHR (*create_image)(struct ctx *context, EGLenum target, EGLClientBuffer buffer, const EGLint *attrib_list);
    WLC_NONULL EGLBoolean (*destroy_image)(struct ctx *context, EGLImageKHR image);
+   WLC_NONULL bool (*export_image)(struct ctx *context, EGLImageKHR image, struct wlc_dmabuf_attributes *out_attributes);
+   WLC_NONULL int32_t (*create_fence)(struct ctx *context);
+
+   // Software
+   WLC_NONULL pixman_image_t* (*framebuffer)(struct ctx *context, const struct wlc_size *size);
 };
 
 struct wlc_context {
@@ -28,12 +39,18 @@ struct wlc_context {
 };
 
 WLC_NONULL void* wlc_context_get_proc_address(struct wlc_context *context, const char *procname);
+WLC_NONULL const void* wlc_context_get_share_group(struct wlc_context *context);
 WLC_NONULL EGLBoolean wlc_context_query_buffer(struct wlc_context *context, struct wl_resource *buffer, EGLint attribute, EGLint *value);
 WLC_NONULL EGLImageKHR wlc_context_create_image(struct wlc_context *context, EGLenum target, EGLClientBuffer buffer, const EGLint *attrib_list);
 WLC_NONULL EGLBoolean wlc_context_destroy_image(struct wlc_context *context, EGLImageKHR image);
+WLC_NONULL bool wlc_context_export_image(struct wlc_context *context, EGLImageKHR image, struct wlc_dmabuf_attributes *out_attributes); // fds are owned by caller
+WLC_NONULL int32_t wlc_context_create_fence(struct wlc_context *context); // sync_file fd of commands issued so far, -1 if unsupported
+WLC_NONULL bool wlc_context_has_framebuffer(struct wlc_context *context);
+WLC_NONULL pixman_image_t* wlc_context_get_framebuffer(struct wlc_context *context, const struct wlc_size *size);
 WLC_NONULL bool wlc_context_bind(struct wlc_context *context);
 WLC_NONULL bool wlc_context_bind_to_wl_display(struct wlc_context *context, struct wl_display *display);
-WLC_NONULL void wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface);
+WLC_NONULLV(1,2) void wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface, pixman_region32_t *damage);
+WLC_NONULL int32_t wlc_context_get_buffer_age(struct wlc_context *context);
 void wlc_context_release(struct wlc_context *context);
 WLC_NONULL bool wlc_context(struct wlc_context *context, struct wlc_backend_surface *bsurface);
 
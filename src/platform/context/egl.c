@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include <GLES2/gl2.h>
 #include <wayland-server.h>
 #include <chck/string/string.h>
 #include "internal.h"
@@ -14,7 +15,16 @@
 #include "compositor/output.h"
 #include "platform/backend/backend.h"
 
+// Contexts on the same display share GL objects, so client textures are valid on every output
+struct share_group {
+   EGLDisplay display;
+   EGLConfig config;
+   uint32_t references;
+};
+
 struct ctx {
+   struct wl_list link;
+   struct share_group *group;
    const char *extensions;
    struct wl_display *wl_display;
    EGLDisplay display;
@@ -22,6 +32,7 @@ struct ctx {
    EGLSurface surface;
    EGLConfig config;
    bool flip_failed;
+   bool buffer_age;
 
    struct {
       // Needed for EGL hw surfaces
@@ -31,6 +42,13 @@ struct ctx {
       PFNEGLBINDWAYLANDDISPLAYWL eglBindWaylandDisplayWL;
       PFNEGLUNBINDWAYLANDDISPLAYWL eglUnbindWaylandDisplayWL;
       PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC eglSwapBuffersWithDamage;
+
+      // Frame export (EGL_MESA_image_dma_buf_export, EGL_ANDROID_native_fence_sync)
+      PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC eglExportDMABUFImageQueryMESA;
+      PFNEGLEXPORTDMABUFIMAGEMESAPROC eglExportDMABUFImageMESA;
+      PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+      PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+      PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
    } api;
 };
 
@@ -97,6 +115,9 @@ egl_call(const char *func, uint32_t line, const char *eglfunc)
 
 #define EGL_CALL(x) x; egl_call(__PRETTY_FUNCTION__, __LINE__, __STRING(x))
 
+static struct wl_list contexts = { &contexts, &contexts };
+static struct ctx *bound = NULL;
+
 WLC_PURE static bool
 has_extension(const struct ctx *context, const char *extension)
 {
@@ -125,6 +146,7 @@ terminate(struct ctx *context)
    assert(context);
 
    EGL_CALL(eglMakeCurrent(context->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT));
+   bound = NULL;
 
    if (context->surface) {
       EGL_CALL(eglDestroySurface(context->display, context->surface));
@@ -134,6 +156,12 @@ terminate(struct ctx *context)
       EGL_CALL(eglDestroyContext(context->display, context->context));
    }
 
+   // Objects of the group live as long as any of its contexts
+   if (context->group && --context->group->references == 0)
+      free(context->group);
+
+   wl_list_remove(&context->link);
+
    // XXX: This is shared on all backends
 #if 0
    if (context->display) {
@@ -157,6 +185,8 @@ create_context(struct wlc_backend_surface *bsurface)
    if (!(context = calloc(1, sizeof(struct ctx))))
       return NULL;
 
+   wl_list_init(&context->link);
+
    if (!(context->display = eglGetDisplay(bsurface->display)))
       goto egl_fail;
 
@@ -195,20 +225,56 @@ create_context(struct wlc_backend_surface *bsurface)
    if (!context->config)
       goto egl_fail;
 
-   const EGLint context_attribs[] = {
-      EGL_CONTEXT_CLIENT_VERSION, 2,
-      EGL_NONE
-   };
+   EGLContext share_context = EGL_NO_CONTEXT;
+   struct share_group *group = NULL;
+   {
+      struct ctx *c;
+      wl_list_for_each(c, &contexts, link) {
+         if (c->group->display != context->display || c->group->config != context->config)
+            continue;
+
+         share_context = c->context;
+         group = c->group;
+         break;
+      }
+   }
 
-   if ((context->context = eglCreateContext(context->display, context->config, EGL_NO_CONTEXT, context_attribs)) == EGL_NO_CONTEXT)
+   // GLES3 is preferred, the renderer falls back to GLES2 when it doesn't get it
+   for (EGLint version = 3; version >= 2 && context->context == EGL_NO_CONTEXT; --version) {
+      const EGLint context_attribs[] = {
+         EGL_CONTEXT_CLIENT_VERSION, version,
+         EGL_NONE
+      };
+
+      context->context = eglCreateContext(context->display, context->config, share_context, context_attribs);
+   }
+
+   if (context->context == EGL_NO_CONTEXT)
       goto egl_fail;
 
+   if (!group) {
+      if (!(group = calloc(1, sizeof(struct share_group))))
+         goto egl_fail;
+
+      group->display = context->display;
+      group->config = context->config;
+   }
+
+   context->group = group;
+   context->group->references++;
+   wl_list_insert(&contexts, &context->link);
+
+   if (share_context != EGL_NO_CONTEXT)
+      wlc_log(WLC_LOG_INFO, "EGL context shares objects with %u other context(s)", context->group->references - 1);
+
    if ((context->surface = eglCreateWindowSurface(context->display, context->config, bsurface->window, NULL)) == EGL_NO_SURFACE)
       goto egl_fail;
 
    if (!eglMakeCurrent(context->display, context->surface, context->surface, context->context))
       goto egl_fail;
 
+   bound = context;
+
    EGLint render_buffer;
    if (!eglQueryContext(context->display, context->context, EGL_RENDER_BUFFER, &render_buffer))
       goto egl_fail;
@@ -260,13 +326,25 @@ create_context(struct wlc_backend_surface *bsurface)
    }
 
    if (has_extension(context, "EGL_EXT_swap_buffers_with_damage")) {
-      // FIXME: get hw that supports this feature
-      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamage");
-   } else {
-      // FIXME: get hw that supports this feature
-      // wlc_log(WLC_LOG_WARN, "EGL_EXT_swap_buffers_with_damage not supported. Performance could be affected.");
+      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+   } else if (has_extension(context, "EGL_KHR_swap_buffers_with_damage")) {
+      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
    }
 
+   if (has_extension(context, "EGL_MESA_image_dma_buf_export")) {
+      context->api.eglExportDMABUFImageQueryMESA = (void*)eglGetProcAddress("eglExportDMABUFImageQueryMESA");
+      context->api.eglExportDMABUFImageMESA = (void*)eglGetProcAddress("eglExportDMABUFImageMESA");
+   }
+
+   if (has_extension(context, "EGL_ANDROID_native_fence_sync") && has_extension(context, "EGL_KHR_fence_sync")) {
+      context->api.eglCreateSyncKHR = (void*)eglGetProcAddress("eglCreateSyncKHR");
+      context->api.eglDestroySyncKHR = (void*)eglGetProcAddress("eglDestroySyncKHR");
+      context->api.eglDupNativeFenceFDANDROID = (void*)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+   }
+
+   if (!(context->buffer_age = has_extension(context, "EGL_EXT_buffer_age")))
+      wlc_log(WLC_LOG_WARN, "EGL_EXT_buffer_age not supported, every frame will be fully repainted.");
+
    EGL_CALL(eglSwapInterval(context->display, 1));
    return context;
 
@@ -283,7 +361,6 @@ egl_fail:
 static bool
 bind(struct ctx *context)
 {
-   static struct ctx *bound = NULL;
    assert(context);
 
    if (context == bound)
@@ -315,8 +392,40 @@ bind_to_wl_display(struct ctx *context, struct wl_display *wl_display)
    return (context->wl_display ? true : false);
 }
 
+static EGLBoolean
+swap_with_damage(struct ctx *context, pixman_region32_t *damage)
+{
+   assert(context && damage);
+
+   EGLint height;
+   if (!eglQuerySurface(context->display, context->surface, EGL_HEIGHT, &height)) {
+      EGLBoolean ret = EGL_CALL(eglSwapBuffers(context->display, context->surface));
+      return ret;
+   }
+
+   // Too many rectangles just cost time on the driver side, send extents instead
+   int nrects;
+   pixman_box32_t *boxes = pixman_region32_rectangles(damage, &nrects);
+   if (nrects > 32) {
+      boxes = pixman_region32_extents(damage);
+      nrects = 1;
+   }
+
+   // EGL wants the rectangles with origin at bottom left
+   EGLint rects[32 * 4];
+   for (int i = 0; i < nrects; ++i) {
+      rects[i * 4 + 0] = boxes[i].x1;
+      rects[i * 4 + 1] = height - boxes[i].y2;
+      rects[i * 4 + 2] = boxes[i].x2 - boxes[i].x1;
+      rects[i * 4 + 3] = boxes[i].y2 - boxes[i].y1;
+   }
+
+   EGLBoolean ret = EGL_CALL(context->api.eglSwapBuffersWithDamage(context->display, context->surface, rects, nrects));
+   return ret;
+}
+
 static void
-swap(struct ctx *context, struct wlc_backend_surface *bsurface)
+swap(struct ctx *context, struct wlc_backend_surface *bsurface, pixman_region32_t *damage)
 {
    assert(context);
 
@@ -327,13 +436,33 @@ swap(struct ctx *context, struct wlc_backend_surface *bsurface)
       abort();
    }
 
-   if (!context->flip_failed)
-      ret = EGL_CALL(eglSwapBuffers(context->display, context->surface));
+   if (!context->flip_failed) {
+      if (damage && context->api.eglSwapBuffersWithDamage) {
+         ret = swap_with_damage(context, damage);
+      } else {
+         ret = EGL_CALL(eglSwapBuffers(context->display, context->surface));
+      }
+   }
 
    if (ret == EGL_TRUE && bsurface->api.page_flip)
       context->flip_failed = !bsurface->api.page_flip(bsurface);
 }
 
+static int32_t
+buffer_age(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->buffer_age || !bind(context))
+      return 0;
+
+   EGLint age;
+   if (!eglQuerySurface(context->display, context->surface, EGL_BUFFER_AGE_EXT, &age))
+      return 0;
+
+   return age;
+}
+
 static void*
 get_proc_address(struct ctx *context, const char *procname)
 {
@@ -342,6 +471,13 @@ get_proc_address(struct ctx *context, const char *procname)
    return eglGetProcAddress(procname);
 }
 
+static const void*
+share_group(struct ctx *context)
+{
+   assert(context);
+   return context->group;
+}
+
 static EGLBoolean
 query_buffer(struct ctx *context, struct wl_resource *buffer, EGLint attribute, EGLint *value)
 {
@@ -369,6 +505,58 @@ destroy_image(struct ctx *context, EGLImageKHR image)
    return EGL_FALSE;
 }
 
+static bool
+export_image(struct ctx *context, EGLImageKHR image, struct wlc_dmabuf_attributes *out_attributes)
+{
+   assert(context && image && out_attributes);
+
+   if (!context->api.eglExportDMABUFImageQueryMESA || !context->api.eglExportDMABUFImageMESA)
+      return false;
+
+   int fourcc, num_planes;
+   EGLuint64KHR modifier;
+   EGLBoolean ret = EGL_CALL(context->api.eglExportDMABUFImageQueryMESA(context->display, image, &fourcc, &num_planes, &modifier));
+   if (!ret || num_planes < 1 || num_planes > WLC_DMABUF_MAX_PLANES)
+      return false;
+
+   int fds[WLC_DMABUF_MAX_PLANES];
+   EGLint strides[WLC_DMABUF_MAX_PLANES], offsets[WLC_DMABUF_MAX_PLANES];
+   ret = EGL_CALL(context->api.eglExportDMABUFImageMESA(context->display, image, fds, strides, offsets));
+   if (!ret)
+      return false;
+
+   out_attributes->format = fourcc;
+   out_attributes->modifier = modifier;
+   out_attributes->num_planes = num_planes;
+
+   for (int i = 0; i < num_planes; ++i) {
+      out_attributes->fd[i] = fds[i];
+      out_attributes->stride[i] = strides[i];
+      out_attributes->offset[i] = offsets[i];
+   }
+
+   return true;
+}
+
+static int32_t
+create_fence(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->api.eglDupNativeFenceFDANDROID)
+      return -1;
+
+   EGLSyncKHR sync = EGL_CALL(context->api.eglCreateSyncKHR(context->display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL));
+   if (sync == EGL_NO_SYNC_KHR)
+      return -1;
+
+   // The fence fd only exists once the commands have been flushed
+   glFlush();
+   const int32_t fd = EGL_CALL(context->api.eglDupNativeFenceFDANDROID(context->display, sync));
+   EGL_CALL(context->api.eglDestroySyncKHR(context->display, sync));
+   return (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID ? -1 : fd);
+}
+
 void*
 wlc_egl(struct wlc_backend_surface *bsurface, struct wlc_context_api *api)
 {
@@ -382,9 +570,13 @@ wlc_egl(struct wlc_backend_surface *bsurface, struct wlc_context_api *api)
    api->bind = bind;
    api->bind_to_wl_display = bind_to_wl_display;
    api->swap = swap;
+   api->buffer_age = buffer_age;
    api->get_proc_address = get_proc_address;
+   api->share_group = share_group;
    api->destroy_image = destroy_image;
    api->create_image = create_image;
    api->query_buffer = query_buffer;
+   api->export_image = export_image;
+   api->create_fence = create_fence;
    return context;
 }
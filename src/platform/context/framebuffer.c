@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <pixman.h>
+#include "internal.h"
+#include "framebuffer.h"
+#include "context.h"
+#include "platform/backend/backend.h"
+
+// Framebuffer in memory for the software renderer.
+// Damaged area of it is handed to the backend on swap, so contents are kept between frames.
+
+struct ctx {
+   pixman_image_t *image;
+   int32_t age;
+   bool flip_failed;
+};
+
+static void
+terminate(struct ctx *context)
+{
+   assert(context);
+
+   if (context->image)
+      pixman_image_unref(context->image);
+
+   free(context);
+}
+
+static bool
+bind(struct ctx *context)
+{
+   (void)context;
+   return true;
+}
+
+static void
+swap(struct ctx *context, struct wlc_backend_surface *bsurface, pixman_region32_t *damage)
+{
+   assert(context && bsurface);
+
+   if (!context->image || context->flip_failed || !bsurface->api.put_pixels(bsurface, context->image, damage))
+      return;
+
+   context->age = 1;
+
+   if (bsurface->api.page_flip)
+      context->flip_failed = !bsurface->api.page_flip(bsurface);
+}
+
+static int32_t
+buffer_age(struct ctx *context)
+{
+   assert(context);
+   return context->age;
+}
+
+static pixman_image_t*
+framebuffer(struct ctx *context, const struct wlc_size *size)
+{
+   assert(context && size);
+
+   if (context->image && (uint32_t)pixman_image_get_width(context->image) == size->w && (uint32_t)pixman_image_get_height(context->image) == size->h)
+      return context->image;
+
+   if (context->image)
+      pixman_image_unref(context->image);
+
+   // Contents are lost, next frame is drawn whole
+   context->age = 0;
+
+   if (!(context->image = pixman_image_create_bits(PIXMAN_x8r8g8b8, size->w, size->h, NULL, 0)))
+      wlc_log(WLC_LOG_WARN, "Failed to allocate %ux%u framebuffer", size->w, size->h);
+
+   return context->image;
+}
+
+void*
+wlc_framebuffer(struct wlc_backend_surface *bsurface, struct wlc_context_api *api)
+{
+   assert(bsurface && api);
+
+   if (!bsurface->api.put_pixels)
+      return NULL;
+
+   struct ctx *context;
+   if (!(context = calloc(1, sizeof(struct ctx))))
+      return NULL;
+
+   api->terminate = terminate;
+   api->bind = bind;
+   api->swap = swap;
+   api->buffer_age = buffer_age;
+   api->framebuffer = framebuffer;
+
+   wlc_log(WLC_LOG_INFO, "Framebuffer context created");
+   return context;
+}
@@ -0,0 +1,9 @@
+#ifndef _WLC_FRAMEBUFFER_H_
+#define _WLC_FRAMEBUFFER_H_
+
+struct wlc_context_api;
+struct wlc_backend_surface;
+
+void* wlc_framebuffer(struct wlc_backend_surface *bsurface, struct wlc_context_api *api);
+
+#endif /* _WLC_FRAMEBUFFER_H_ */
@@ -1,17 +1,27 @@
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <wayland-server.h>
 #include <chck/string/string.h>
 #include "internal.h"
+#include "macros.h"
 #include "gles2.h"
+#include "cursor.h"
 #include "render.h"
 #include "platform/context/egl.h"
 #include "platform/context/context.h"
 #include "compositor/view.h"
+#include "compositor/output.h"
 #include "xwayland/xwm.h"
 #include "resources/types/surface.h"
 #include "resources/types/xdg-surface.h"
@@ -19,8 +29,6 @@
 
 static bool DRAW_OPAQUE = false;
 
-static const GLubyte cursor_palette[];
-
 enum program_type {
    PROGRAM_RGB,
    PROGRAM_RGBA,
@@ -40,6 +48,59 @@ enum {
    UNIFORM_LAST,
 };
 
+// Quads drawn with a single draw call at most, indices are GLushort
+#define BATCH_QUADS 256
+
+// Uploads smaller than this are cheaper to send straight from client memory, than to hand to the upload thread
+#define STAGING_MIN_BYTES (64 * 1024)
+
+// Small SHM surfaces are packed into shared atlas pages, so they can be drawn in a single batch
+#define ATLAS_SIZE 1024
+#define ATLAS_CELL 32
+#define ATLAS_CELLS (ATLAS_SIZE / ATLAS_CELL)
+#define ATLAS_MAX_SURFACE 256
+#define ATLAS_MAX_PAGES 4
+static_assert_x(ATLAS_CELLS <= 32, atlas_rows_fit_bitmask);
+
+// Exported frames rotate through this many buffers, so consumers have a few frames to finish with one
+#define EXPORT_BUFFERS 3
+static_assert_x(ATLAS_MAX_SURFACE + 1 <= ATLAS_SIZE, atlas_fits_surface);
+
+// GLES3 pixel buffer objects, only GLES2 headers are included
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#  define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#  define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#  define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_BGRA8_EXT
+#  define GL_BGRA8_EXT 0x93A1
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#  define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#  define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#  define GL_MAP_READ_BIT 0x0001
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#  define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#  define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#  define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#  define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+
 enum {
    TEXTURE_BLACK,
    TEXTURE_CURSOR,
@@ -59,9 +120,25 @@ static const struct {
    GLenum type;
 } format_map[] = {
    { GL_RGBA, GL_UNSIGNED_BYTE }, // WLC_RGBA8888
+   { GL_BGRA_EXT, GL_UNSIGNED_BYTE }, // WLC_BGRA8888
+   { GL_BGRA_EXT, GL_UNSIGNED_BYTE }, // WLC_XRGB8888
+};
+
+struct vertex {
+   GLfloat x, y, u, v;
+};
+
+// Quad drawn as an instance of a 4 vertex strip (GLES3)
+struct instance {
+   GLfloat x1, y1, x2, y2;
+   GLfloat u1, v1, u2, v2;
 };
 
 struct ctx {
+   bool gles3; // instanced quads and immutable texture storage
+   struct wl_list link;
+   struct wlc_context bound; // copy, the owner may move it around
+   const void *group; // contexts in same group share textures
    const char *extensions;
 
    struct ctx_program *program;
@@ -71,24 +148,174 @@ struct ctx {
       GLuint uniforms[UNIFORM_LAST];
    } programs[PROGRAM_LAST];
 
+   // Shadow of the GL state, so redundant state changes are never sent to the driver
+   struct {
+      GLuint program;
+      GLuint textures[3];
+      GLuint active;
+      bool blend;
+   } state;
+
+   // Quads sharing program, textures and filtering are drawn together
+   struct {
+      union {
+         struct vertex vertices[BATCH_QUADS * 4];
+         struct instance instances[BATCH_QUADS];
+      };
+      GLuint textures[3];
+      GLuint vbo, ibo, corners, vao;
+      GLuint quads;
+      enum program_type program;
+      bool opaque;
+   } batch;
+
+   // Paints outside of this region are dropped, so covered pixels are never filled
+   struct {
+      pixman_region32_t region;
+      bool enabled;
+   } clip;
+
    struct wlc_size resolution, mode;
    GLuint textures[TEXTURE_LAST];
+   GLenum filters[TEXTURE_LAST];
    GLuint clear_fbo;
    GLenum internal_format;
    GLenum preferred_type;
    bool fakefb_dirty;
+   bool scissor;
+   bool read_bgra; // framebuffer can be read as GL_BGRA_EXT
+
+   // Imported client buffers
+   struct wl_list imports;
+
+   // Texture atlas pages
+   struct wl_list atlases;
+
+   // SHM uploads being copied by the upload thread, in the order they were queued (GLES3)
+   struct wl_list uploads;
+
+   // Pixel buffer object of a finished upload, kept for the next one
+   GLuint staging;
+
+   // Textures exported as dmabufs, finished frames are copied into them on the GPU
+   struct {
+      struct export {
+         GLuint texture;
+         void *image;
+         struct wlc_dmabuf_attributes attributes;
+      } buffers[EXPORT_BUFFERS];
+      struct wlc_size size;
+      uint32_t next;
+      bool unsupported;
+   } exports;
+
+   // Linked programs are cached on disk, so we don't need to compile GLSL on every start
+   struct {
+      struct chck_string path;
+      uint64_t key;
+   } cache;
 
    struct {
       PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+      PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+      PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
+      // GLES3, only GLES2 headers are included
+      void* (GL_APIENTRYP glMapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+      GLboolean (GL_APIENTRYP glUnmapBuffer)(GLenum target);
+      void (GL_APIENTRYP glGenVertexArrays)(GLsizei n, GLuint *arrays);
+      void (GL_APIENTRYP glBindVertexArray)(GLuint array);
+      void (GL_APIENTRYP glDeleteVertexArrays)(GLsizei n, const GLuint *arrays);
+      void (GL_APIENTRYP glVertexAttribDivisor)(GLuint index, GLuint divisor);
+      void (GL_APIENTRYP glDrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+      void (GL_APIENTRYP glTexStorage2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+      void* (GL_APIENTRYP glFenceSync)(GLenum condition, GLbitfield flags);
+      GLenum (GL_APIENTRYP glClientWaitSync)(void *sync, GLbitfield flags, uint64_t timeout);
+      void (GL_APIENTRYP glDeleteSync)(void *sync);
    } api;
 };
 
+// Client buffer imported as EGLImages, kept until the wl_buffer is destroyed so re-attaching it is free
+struct import {
+   struct wl_list link;
+   struct wl_listener destroy;
+   struct ctx *context;
+   struct wl_resource *buffer;
+   void *images[3];
+   GLuint textures[3];
+   struct wlc_size size;
+   enum wlc_surface_format format;
+   uint32_t references;
+   bool y_inverted;
+};
+
+// Texture atlas page, kept by a context in the share group like imports
+struct atlas {
+   struct wl_list link;
+   struct ctx *context;
+   GLuint texture;
+   GLenum filter;
+   uint32_t rows[ATLAS_CELLS]; // bitmask of used cells on each row
+};
+
+// Framebuffer read into a pixel buffer object, mapped once its fence has signaled (GLES3).
+// Without pixel buffer objects it's read to memory right away.
+struct readback {
+   GLuint pbo;
+   void *fence;
+   const void *map;
+   uint8_t *data; // copy in memory, when read synchronously or swizzled
+   bool swizzle; // read as GL_RGBA, R and B need to be swapped
+};
+
+// SHM upload copied into a mapped pixel buffer object on the upload thread (GLES3).
+// The texture keeps its old content and the client buffer is held until the copy has landed,
+// the fence tells when the driver has finished with the buffer object.
+struct upload {
+   struct wl_list link; // in context->uploads
+   struct wl_list queue; // in uploader.queue, until the thread picks it up
+   struct wl_listener destroy;
+   struct wl_shm_buffer *shm_buffer;
+   struct wl_shm_pool *pool;
+   wlc_resource surface, buffer;
+   pixman_region32_t damage;
+   struct wlc_point offset;
+   uint8_t *map; // until the copy has landed
+   void *fence;
+   GLuint pbo;
+   GLint pitch, bpp;
+   GLenum gl_format, gl_pixel_type;
+   bool copied; // under uploader.mutex
+};
+
+// Part of the texture sampled, normalized
+struct uv {
+   GLfloat x1, y1, x2, y2;
+};
+
 struct paint {
+   const struct uv *uv; // NULL for whole texture
    struct wlc_geometry visible;
    enum program_type program;
    bool filter;
+   bool opaque; // drawn without blending
 };
 
+static struct wl_list contexts = { &contexts, &contexts };
+
+// Copying large SHM uploads blocks the loop, so it's done on a thread shared by all contexts.
+// Uploads are handed over under the mutex, fd is signaled and done broadcast when a copy finishes.
+static struct {
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond, done;
+   struct wl_event_source *event_source;
+   struct wl_list queue;
+   int fd;
+   bool quit, running, failed;
+} uploader = { .fd = -1 };
+
+#ifndef NDEBUG
+
 static const char*
 gl_error_string(const GLenum error)
 {
@@ -123,6 +350,13 @@ gl_call(const char *func, uint32_t line, const char *glfunc)
 
 #define GL_CALL(x) x; gl_call(__PRETTY_FUNCTION__, __LINE__, __STRING(x))
 
+#else
+
+// glGetError forces synchronization with the driver, only check errors on debug builds
+#define GL_CALL(x) x
+
+#endif
+
 WLC_PURE static bool
 has_extension(const struct ctx *context, const char *extension)
 {
@@ -151,7 +385,124 @@ set_program(struct ctx *context, enum program_type type)
    assert(context && type >= 0 && type < PROGRAM_LAST);
 
    context->program = &context->programs[type];
+
+   if (context->state.program == context->program->obj)
+      return;
+
    GL_CALL(glUseProgram(context->program->obj));
+   context->state.program = context->program->obj;
+}
+
+static void
+active_texture(struct ctx *context, GLuint unit)
+{
+   assert(context && unit < 3);
+
+   if (context->state.active == unit)
+      return;
+
+   GL_CALL(glActiveTexture(GL_TEXTURE0 + unit));
+   context->state.active = unit;
+}
+
+static void
+bind_texture(struct ctx *context, GLuint unit, GLuint texture)
+{
+   assert(context && unit < 3);
+
+   // Always leave the unit active, callers may operate on the bound texture
+   active_texture(context, unit);
+
+   if (context->state.textures[unit] == texture)
+      return;
+
+   GL_CALL(glBindTexture(GL_TEXTURE_2D, texture));
+   context->state.textures[unit] = texture;
+}
+
+WLC_PURE static bool
+shares_objects(const struct ctx *a, const struct ctx *b)
+{
+   assert(a && b);
+   return (a == b || (a->group && a->group == b->group));
+}
+
+static void
+delete_textures(struct ctx *context, GLuint nmemb, GLuint *textures)
+{
+   assert(context && textures);
+
+   // Deleted names may be reused by any context in the group, so forget them everywhere
+   struct ctx *c;
+   wl_list_for_each(c, &contexts, link) {
+      if (!shares_objects(context, c))
+         continue;
+
+      for (GLuint i = 0; i < nmemb; ++i) {
+         for (GLuint u = 0; u < 3; ++u) {
+            if (c->state.textures[u] == textures[i])
+               c->state.textures[u] = 0;
+         }
+      }
+   }
+
+   GL_CALL(glDeleteTextures(nmemb, textures));
+}
+
+static void
+set_filter(struct ctx *context, GLuint unit, GLuint texture, GLenum *filter, GLenum wanted)
+{
+   assert(context && filter);
+
+   // Filtering is texture state, so it only needs to be set when it changes
+   if (*filter == wanted)
+      return;
+
+   bind_texture(context, unit, texture);
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, wanted));
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, wanted));
+   *filter = wanted;
+}
+
+static void
+flush_batch(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->batch.quads)
+      return;
+
+   set_program(context, context->batch.program);
+
+   if (context->state.blend == context->batch.opaque) {
+      if (context->batch.opaque) {
+         GL_CALL(glDisable(GL_BLEND));
+      } else {
+         GL_CALL(glEnable(GL_BLEND));
+      }
+
+      context->state.blend = !context->batch.opaque;
+   }
+
+   for (GLuint i = 0; i < 3; ++i) {
+      if (!context->batch.textures[i])
+         break;
+
+      bind_texture(context, i, context->batch.textures[i]);
+   }
+
+   // Orphan the previous storage, so we don't stall on draws that still use it
+   if (context->gles3) {
+      GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(context->batch.instances), NULL, GL_STREAM_DRAW));
+      GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, 0, context->batch.quads * sizeof(struct instance), context->batch.instances));
+      GL_CALL(context->api.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, context->batch.quads));
+   } else {
+      GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(context->batch.vertices), NULL, GL_STREAM_DRAW));
+      GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, 0, context->batch.quads * 4 * sizeof(struct vertex), context->batch.vertices));
+      GL_CALL(glDrawElements(GL_TRIANGLES, context->batch.quads * 6, GL_UNSIGNED_SHORT, NULL));
+   }
+
+   context->batch.quads = 0;
 }
 
 static GLuint
@@ -178,8 +529,243 @@ create_shader(const char *source, GLenum shader_type)
    return shader;
 }
 
+static GLuint
+link_program(const char *vert_source, const char *frag_source)
+{
+   assert(vert_source && frag_source);
+
+   GLuint vert = create_shader(vert_source, GL_VERTEX_SHADER);
+   GLuint frag = create_shader(frag_source, GL_FRAGMENT_SHADER);
+   GLuint program = glCreateProgram();
+   GL_CALL(glAttachShader(program, vert));
+   GL_CALL(glAttachShader(program, frag));
+   GL_CALL(glBindAttribLocation(program, 0, "pos"));
+   GL_CALL(glBindAttribLocation(program, 1, "uv"));
+   GL_CALL(glBindAttribLocation(program, 2, "corner"));
+   GL_CALL(glLinkProgram(program));
+   GL_CALL(glDeleteShader(vert));
+   GL_CALL(glDeleteShader(frag));
+
+   GLint status;
+   GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+   if (!status) {
+      GLsizei len;
+      char log[1024];
+      GL_CALL(glGetProgramInfoLog(program, sizeof(log), &len, log));
+      wlc_log(WLC_LOG_ERROR, "Linking:\n%*s\n", len, log);
+      abort();
+   }
+
+   return program;
+}
+
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+   // FNV-1a, terminator included so concatenated strings can't collide
+   do {
+      hash = (hash ^ (uint8_t)*str) * 0x100000001b3;
+   } while (*str++);
+   return hash;
+}
+
+static bool
+mkdir_parents(char *path)
+{
+   assert(path);
+
+   for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+      *p = 0;
+      const bool ok = (mkdir(path, 0700) == 0 || errno == EEXIST);
+      *p = '/';
+
+      if (!ok)
+         return false;
+   }
+
+   return (mkdir(path, 0700) == 0 || errno == EEXIST);
+}
+
+static void
+program_cache_init(struct ctx *context, struct wlc_context *bound)
+{
+   assert(context && bound);
+
+   if (!has_extension(context, "GL_OES_get_program_binary"))
+      return;
+
+   GLint formats = 0;
+   GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats));
+   if (formats <= 0)
+      return;
+
+   if (!(context->api.glGetProgramBinaryOES = wlc_context_get_proc_address(bound, "glGetProgramBinaryOES")) ||
+       !(context->api.glProgramBinaryOES = wlc_context_get_proc_address(bound, "glProgramBinaryOES")))
+      return;
+
+   const char *xdg_cache, *home;
+   if ((xdg_cache = getenv("XDG_CACHE_HOME")) && xdg_cache[0] == '/') {
+      chck_string_set_format(&context->cache.path, "%s/wlc", xdg_cache);
+   } else if ((home = getenv("HOME"))) {
+      chck_string_set_format(&context->cache.path, "%s/.cache/wlc", home);
+   } else {
+      return;
+   }
+
+   if (chck_string_is_empty(&context->cache.path) || !mkdir_parents(context->cache.path.data)) {
+      wlc_log(WLC_LOG_WARN, "gles2: Could not create program cache directory %s", context->cache.path.data);
+      chck_string_release(&context->cache.path);
+      return;
+   }
+
+   // Binaries are only valid for the exact driver that produced them
+   const char *keys[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+   context->cache.key = 0xcbf29ce484222325;
+   for (uint32_t i = 0; i < LENGTH(keys); ++i)
+      context->cache.key = hash_string(context->cache.key, (keys[i] ? keys[i] : ""));
+}
+
+static bool
+program_cache_file(struct ctx *context, const char *vert_source, const char *frag_source, struct chck_string *out_file)
+{
+   assert(context && vert_source && frag_source && out_file);
+
+   if (chck_string_is_empty(&context->cache.path))
+      return false;
+
+   const uint64_t key = hash_string(hash_string(context->cache.key, vert_source), frag_source);
+   return chck_string_set_format(out_file, "%s/program-%016" PRIx64 ".bin", context->cache.path.data, key);
+}
+
+static GLuint
+program_cache_load(struct ctx *context, const char *file)
+{
+   assert(context && file);
+
+   FILE *f;
+   if (!(f = fopen(file, "rb")))
+      return 0;
+
+   GLuint program = 0;
+   void *binary = NULL;
+
+   GLenum format;
+   long size;
+   if (fread(&format, sizeof(format), 1, f) != 1 || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f) - (long)sizeof(format)) <= 0)
+      goto fail;
+
+   if (!(binary = malloc(size)) || fseek(f, sizeof(format), SEEK_SET) != 0 || fread(binary, 1, size, f) != (size_t)size)
+      goto fail;
+
+   program = glCreateProgram();
+   GL_CALL(context->api.glProgramBinaryOES(program, format, binary, size));
+
+   // Driver may reject binaries after update, in that case we just compile again
+   GLint status;
+   GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+   if (!status) {
+      GL_CALL(glDeleteProgram(program));
+      program = 0;
+   }
+
+fail:
+   free(binary);
+   fclose(f);
+   return program;
+}
+
+static void
+program_cache_store(struct ctx *context, const char *file, GLuint program)
+{
+   assert(context && file);
+
+   GLint size = 0;
+   GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &size));
+   if (size <= 0)
+      return;
+
+   void *binary;
+   if (!(binary = malloc(size)))
+      return;
+
+   GLenum format;
+   GLsizei len = 0;
+   GL_CALL(context->api.glGetProgramBinaryOES(program, size, &len, &format, binary));
+
+   struct chck_string tmp = {0};
+   FILE *f = NULL;
+   if (len <= 0 || !chck_string_set_format(&tmp, "%s.%d", file, getpid()) || !(f = fopen(tmp.data, "wb")))
+      goto fail;
+
+   // Write to temporary file first, so other instances never see partial binaries
+   const bool written = (fwrite(&format, sizeof(format), 1, f) == 1 && fwrite(binary, 1, len, f) == (size_t)len);
+
+   if (fclose(f) != 0 || !written || rename(tmp.data, file) != 0) {
+      wlc_log(WLC_LOG_WARN, "gles2: Failed to write program cache %s", file);
+      unlink(tmp.data);
+   }
+
+fail:
+   chck_string_release(&tmp);
+   free(binary);
+}
+
+static GLuint
+create_program(struct ctx *context, const char *vert_source, const char *frag_source)
+{
+   assert(context && vert_source && frag_source);
+
+   struct chck_string file = {0};
+   if (!program_cache_file(context, vert_source, frag_source, &file))
+      return link_program(vert_source, frag_source);
+
+   GLuint program;
+   if (!(program = program_cache_load(context, file.data))) {
+      program = link_program(vert_source, frag_source);
+      program_cache_store(context, file.data, program);
+   }
+
+   chck_string_release(&file);
+   return program;
+}
+
+static bool
+load_gles3(struct ctx *context, struct wlc_context *bound)
+{
+   assert(context && bound);
+
+   const struct {
+      const char *name;
+      void **proc;
+   } procs[] = {
+      { "glMapBufferRange", (void**)&context->api.glMapBufferRange },
+      { "glUnmapBuffer", (void**)&context->api.glUnmapBuffer },
+      { "glGenVertexArrays", (void**)&context->api.glGenVertexArrays },
+      { "glBindVertexArray", (void**)&context->api.glBindVertexArray },
+      { "glDeleteVertexArrays", (void**)&context->api.glDeleteVertexArrays },
+      { "glVertexAttribDivisor", (void**)&context->api.glVertexAttribDivisor },
+      { "glDrawArraysInstanced", (void**)&context->api.glDrawArraysInstanced },
+      { "glTexStorage2D", (void**)&context->api.glTexStorage2D },
+      { "glFenceSync", (void**)&context->api.glFenceSync },
+      { "glClientWaitSync", (void**)&context->api.glClientWaitSync },
+      { "glDeleteSync", (void**)&context->api.glDeleteSync },
+   };
+
+   for (uint32_t i = 0; i < LENGTH(procs); ++i) {
+      if (!(*procs[i].proc = wlc_context_get_proc_address(bound, procs[i].name)))
+         goto fail;
+   }
+
+   return true;
+
+fail:
+   for (uint32_t i = 0; i < LENGTH(procs); ++i)
+      *procs[i].proc = NULL;
+   return false;
+}
+
 static struct ctx*
-create_context(void)
+create_context(struct wlc_context *bound, bool gles3)
 {
    const char *vert_shader =
       "#version 100\n"
@@ -199,6 +785,26 @@ create_context(void)
       "  v_uv = uv;\n"
       "}\n";
 
+   // Quad rectangle and its texture coordinates come per instance
+   const char *vert_shader_instanced =
+      "#version 100\n"
+      "precision mediump float;\n"
+      "uniform vec2 resolution;\n"
+      "attribute vec2 corner;\n"
+      "attribute vec4 pos;\n"
+      "attribute vec4 uv;\n"
+      "varying vec2 v_uv;\n"
+      "void main() {\n"
+      "  mat4 ortho = mat4("
+      "    2.0/resolution.x,         0,          0, 0,"
+      "            0,        -2.0/resolution.y,  0, 0,"
+      "            0,                0,         -1, 0,"
+      "           -1,                1,          0, 1"
+      "  );\n"
+      "  gl_Position = ortho * vec4(mix(pos.xy, pos.zw, corner), 0.0, 1.0);\n"
+      "  v_uv = mix(uv.xy, uv.zw, corner);\n"
+      "}\n";
+
    const char *frag_shader_dummy =
       "#version 100\n"
       "precision mediump float;\n"
@@ -300,12 +906,39 @@ create_context(void)
    if (!(context = calloc(1, sizeof(struct ctx))))
       return NULL;
 
+   wl_list_init(&context->imports);
+   wl_list_init(&context->atlases);
+   wl_list_init(&context->uploads);
+   wl_list_init(&context->link);
+   pixman_region32_init(&context->clip.region);
+   context->bound = *bound;
+   context->group = wlc_context_get_share_group(bound);
+
    const char *str;
    str = (const char*)GL_CALL(glGetString(GL_VERSION));
    wlc_log(WLC_LOG_INFO, "GL version: %s", str ? str : "(null)");
    str = (const char*)GL_CALL(glGetString(GL_VENDOR));
    wlc_log(WLC_LOG_INFO, "GL vendor: %s", str ? str : "(null)");
 
+   {
+      // Drivers commonly hand out GLES3 contexts for GLES2 requests, use the extra features if so
+      int major = 0;
+      str = (const char*)GL_CALL(glGetString(GL_VERSION));
+      const bool loaded = (str && sscanf(str, "OpenGL ES %d", &major) == 1 && major >= 3 && load_gles3(context, bound));
+
+      if (gles3 && !loaded) {
+         wlc_log(WLC_LOG_INFO, "gles3: Context is not GLES3 capable");
+         pixman_region32_fini(&context->clip.region);
+         free(context);
+         return NULL;
+      }
+
+      context->gles3 = gles3;
+
+      if (!context->api.glMapBufferRange)
+         wlc_log(WLC_LOG_INFO, "gles2: No pixel buffer objects, SHM uploads are synchronous");
+   }
+
    /** TODO: Should be available in GLES3 */
 #if 0
    GL_CALL(glGetInternalFormativ(GL_TEXTURE_2D, GL_RGBA, GL_TEXTURE_IMAGE_FORMAT, 1, &context->preferred_format));
@@ -322,46 +955,31 @@ create_context(void)
       frag_shader_egl = frag_shader_dummy;
    }
 
+   context->read_bgra = has_extension(context, "GL_EXT_read_format_bgra");
+
    if (!has_extension(context, "GL_EXT_texture_format_BGRA8888")) {
       wlc_log(WLC_LOG_WARN, "gles2: GL_EXT_texture_format_BGRA8888 is not available, rendering for many surfaces will most likely be broken");
    }
 
+   program_cache_init(context, bound);
+
+   const char *vert = (context->gles3 ? vert_shader_instanced : vert_shader);
    const struct {
       const char *vert;
       const char *frag;
    } map[PROGRAM_LAST] = {
-      { vert_shader, frag_shader_rgb }, // PROGRAM_RGB
-      { vert_shader, frag_shader_rgba }, // PROGRAM_RGBA
-      { vert_shader, frag_shader_egl }, // PROGRAM_EGL
-      { vert_shader, frag_shader_y_uv }, // PROGRAM_Y_UV
-      { vert_shader, frag_shader_y_u_v }, // PROGRAM_Y_U_V
-      { vert_shader, frag_shader_y_xuxv }, // PROGRAM_Y_XUXV
-      { vert_shader, frag_shader_cursor }, // PROGRAM_CURSOR
+      { vert, frag_shader_rgb }, // PROGRAM_RGB
+      { vert, frag_shader_rgba }, // PROGRAM_RGBA
+      { vert, frag_shader_egl }, // PROGRAM_EGL
+      { vert, frag_shader_y_uv }, // PROGRAM_Y_UV
+      { vert, frag_shader_y_u_v }, // PROGRAM_Y_U_V
+      { vert, frag_shader_y_xuxv }, // PROGRAM_Y_XUXV
+      { vert, frag_shader_cursor }, // PROGRAM_CURSOR
    };
 
    for (GLuint i = 0; i < PROGRAM_LAST; ++i) {
-      GLuint vert = create_shader(map[i].vert, GL_VERTEX_SHADER);
-      GLuint frag = create_shader(map[i].frag, GL_FRAGMENT_SHADER);
-      context->programs[i].obj = glCreateProgram();
-      GL_CALL(glAttachShader(context->programs[i].obj, vert));
-      GL_CALL(glAttachShader(context->programs[i].obj, frag));
-      GL_CALL(glLinkProgram(context->programs[i].obj));
-      GL_CALL(glDeleteShader(vert));
-      GL_CALL(glDeleteShader(frag));
-
-      GLint status;
-      GL_CALL(glGetProgramiv(context->programs[i].obj, GL_LINK_STATUS, &status));
-      if (!status) {
-         GLsizei len;
-         char log[1024];
-         GL_CALL(glGetProgramInfoLog(context->programs[i].obj, sizeof(log), &len, log));
-         wlc_log(WLC_LOG_ERROR, "Linking:\n%*s\n", len, log);
-         abort();
-      }
-
+      context->programs[i].obj = create_program(context, map[i].vert, map[i].frag);
       set_program(context, i);
-      GL_CALL(glBindAttribLocation(context->programs[i].obj, 0, "pos"));
-      GL_CALL(glBindAttribLocation(context->programs[i].obj, 1, "uv"));
 
       for (int u = 0; u < UNIFORM_LAST; ++u) {
          context->programs[i].uniforms[u] = GL_CALL(glGetUniformLocation(context->programs[i].obj, uniform_names[u]));
@@ -379,7 +997,7 @@ create_context(void)
       const void *data;
    } images[TEXTURE_LAST] = {
       { GL_LUMINANCE, 1, 1, GL_UNSIGNED_BYTE, NULL }, // TEXTURE_BLACK
-      { GL_LUMINANCE, 14, 14, GL_UNSIGNED_BYTE, cursor_palette }, // TEXTURE_CURSOR
+      { GL_LUMINANCE, CURSOR_SIZE, CURSOR_SIZE, GL_UNSIGNED_BYTE, cursor_palette }, // TEXTURE_CURSOR
       { GL_RGBA, 0, 0, GL_UNSIGNED_BYTE, NULL }, // TEXTURE_FAKEFB
    };
 
@@ -387,14 +1005,58 @@ create_context(void)
    GL_CALL(glGenTextures(TEXTURE_LAST, context->textures));
 
    for (GLuint i = 0; i < TEXTURE_LAST; ++i) {
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[i]));
+      bind_texture(context, 0, context->textures[i]);
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, images[i].format, images[i].w, images[i].h, 0, images[i].format, images[i].type, images[i].data));
    }
 
-   GL_CALL(glEnableVertexAttribArray(0));
-   GL_CALL(glEnableVertexAttribArray(1));
+   if (context->gles3) {
+      const GLfloat corners[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+
+      GLuint buffers[2];
+      GL_CALL(context->api.glGenVertexArrays(1, &context->batch.vao));
+      GL_CALL(context->api.glBindVertexArray(context->batch.vao));
+      GL_CALL(glGenBuffers(2, buffers));
+      context->batch.vbo = buffers[0];
+      context->batch.corners = buffers[1];
+
+      GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, context->batch.corners));
+      GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW));
+      GL_CALL(glEnableVertexAttribArray(2));
+      GL_CALL(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL));
+
+      // Vertex array and instance buffer stay bound for the lifetime of the context
+      GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, context->batch.vbo));
+      GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(context->batch.instances), NULL, GL_STREAM_DRAW));
+      GL_CALL(glEnableVertexAttribArray(0));
+      GL_CALL(glEnableVertexAttribArray(1));
+      GL_CALL(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(struct instance), (void*)offsetof(struct instance, x1)));
+      GL_CALL(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct instance), (void*)offsetof(struct instance, u1)));
+      GL_CALL(context->api.glVertexAttribDivisor(0, 1));
+      GL_CALL(context->api.glVertexAttribDivisor(1, 1));
+   } else {
+      GLushort indices[BATCH_QUADS * 6];
+      for (GLushort i = 0; i < BATCH_QUADS; ++i) {
+         const GLushort q[6] = { i * 4 + 0, i * 4 + 1, i * 4 + 2, i * 4 + 2, i * 4 + 1, i * 4 + 3 };
+         memcpy(&indices[i * 6], q, sizeof(q));
+      }
+
+      GLuint buffers[2];
+      GL_CALL(glGenBuffers(2, buffers));
+      context->batch.vbo = buffers[0];
+      context->batch.ibo = buffers[1];
+
+      // Buffers stay bound for the lifetime of the context
+      GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, context->batch.ibo));
+      GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW));
+      GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, context->batch.vbo));
+      GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(context->batch.vertices), NULL, GL_STREAM_DRAW));
+      GL_CALL(glEnableVertexAttribArray(0));
+      GL_CALL(glEnableVertexAttribArray(1));
+      GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)offsetof(struct vertex, x)));
+      GL_CALL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)offsetof(struct vertex, u)));
+   }
 
    GL_CALL(glGenFramebuffers(1, &context->clear_fbo));
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, context->clear_fbo));
@@ -402,6 +1064,7 @@ create_context(void)
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 
    GL_CALL(glEnable(GL_BLEND));
+   context->state.blend = true;
    GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
    GL_CALL(glClearColor(0.0, 0.0, 0.0, 0.0));
    return context;
@@ -410,9 +1073,20 @@ create_context(void)
 static void
 clear_fakefb(struct ctx *context)
 {
-   // assumes texture already bound!
+   flush_batch(context);
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, context->clear_fbo));
+
+   // fakefb must be cleared whole, not only the damaged area
+   if (context->scissor) {
+      GL_CALL(glDisable(GL_SCISSOR_TEST));
+   }
+
    GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+
+   if (context->scissor) {
+      GL_CALL(glEnable(GL_SCISSOR_TEST));
+   }
+
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 }
 
@@ -422,102 +1096,816 @@ resolution(struct ctx *context, const struct wlc_size *mode, const struct wlc_si
    assert(context && resolution);
 
    if (!wlc_size_equals(&context->resolution, resolution)) {
+      flush_batch(context);
+
       for (GLuint i = 0; i < PROGRAM_LAST; ++i) {
          set_program(context, i);
          GL_CALL(glUniform2fv(context->program->uniforms[UNIFORM_RESOLUTION], 1, (GLfloat[]){ resolution->w, resolution->h }));
       }
 
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[TEXTURE_FAKEFB]));
+      bind_texture(context, 0, context->textures[TEXTURE_FAKEFB]);
       GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, resolution->w, resolution->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL));
       clear_fakefb(context);
       context->resolution = *resolution;
    }
 
    if (!wlc_size_equals(&context->mode, mode)) {
+      flush_batch(context);
       GL_CALL(glViewport(0, 0, mode->w, mode->h));
       context->mode = *mode;
    }
 }
 
 static void
-surface_gen_textures(struct wlc_surface *surface, const GLuint num_textures)
+surface_gen_textures(struct ctx *context, struct wlc_surface *surface, const GLuint num_textures)
 {
-   assert(surface);
+   assert(context && surface);
 
    for (GLuint i = 0; i < num_textures; ++i) {
       if (surface->textures[i])
          continue;
 
       GL_CALL(glGenTextures(1, &surface->textures[i]));
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, surface->textures[i]));
+      bind_texture(context, 0, surface->textures[i]);
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+      surface->filters[i] = 0;
    }
 }
 
 static void
-surface_flush_textures(struct wlc_surface *surface)
+import_free(struct import *import, struct ctx *context)
 {
-   assert(surface);
+   assert(import && context && shares_objects(import->context, context));
 
-   for (GLuint i = 0; i < 3; ++i) {
-      if (surface->textures[i]) {
-         GL_CALL(glDeleteTextures(1, &surface->textures[i]));
+   // Called outside of rendering as well, so make sure we touch the right GL context
+   if (wlc_context_bind(&context->bound)) {
+      flush_batch(context);
+
+      for (GLuint i = 0; i < 3; ++i) {
+         if (import->images[i])
+            wlc_context_destroy_image(&context->bound, import->images[i]);
+
+         if (import->textures[i])
+            delete_textures(context, 1, &import->textures[i]);
       }
    }
 
-   memset(surface->textures, 0, sizeof(surface->textures));
+   wl_list_remove(&import->link);
+   wl_list_remove(&import->destroy.link);
+   free(import);
 }
 
 static void
-surface_flush_images(struct wlc_context *context, struct wlc_surface *surface)
+import_unref(struct import *import, struct ctx *context)
 {
-   assert(surface);
+   assert(import && import->references > 0);
 
-   for (GLuint i = 0; i < 3; ++i) {
-      if (surface->images[i])
-         wlc_context_destroy_image(context, surface->images[i]);
+   // Destroyed buffer is kept alive while surfaces still show it
+   if (--import->references == 0 && !import->destroy.notify)
+      import_free(import, context);
+}
+
+static void
+cb_import_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+   (void)data;
+   struct import *import;
+   import = wl_container_of(listener, import, destroy);
+
+   wl_list_remove(&import->destroy.link);
+   wl_list_init(&import->destroy.link);
+   import->destroy.notify = NULL;
+   import->buffer = NULL;
+
+   if (!import->references)
+      import_free(import, import->context);
+}
+
+static struct import*
+import_for_buffer(struct ctx *context, struct wl_resource *buffer)
+{
+   assert(context && buffer);
+
+   // Imports made by any context in the group are usable here
+   struct ctx *c;
+   wl_list_for_each(c, &contexts, link) {
+      if (!shares_objects(context, c))
+         continue;
+
+      struct import *import;
+      wl_list_for_each(import, &c->imports, link) {
+         if (import->buffer == buffer)
+            return import;
+      }
+   }
+
+   return NULL;
+}
+
+static GLenum
+storage_format(struct ctx *context, GLenum gl_format, GLenum gl_pixel_type)
+{
+   assert(context);
+
+   if (!context->gles3)
+      return GL_NONE;
+
+   if (gl_format == GL_RGB && gl_pixel_type == GL_UNSIGNED_SHORT_5_6_5)
+      return GL_RGB565;
+
+   // Sized BGRA is only defined together with texture storage extension
+   if (gl_format == GL_BGRA_EXT && gl_pixel_type == GL_UNSIGNED_BYTE && has_extension(context, "GL_EXT_texture_storage"))
+      return GL_BGRA8_EXT;
+
+   return GL_NONE;
+}
+
+static void
+texture_storage(struct ctx *context, GLenum gl_format, GLenum gl_pixel_type, GLsizei w, GLsizei h)
+{
+   assert(context);
+
+   // Immutable storage lets the driver skip completeness and reallocation checks
+   const GLenum sized = storage_format(context, gl_format, gl_pixel_type);
+   if (sized != GL_NONE) {
+      GL_CALL(context->api.glTexStorage2D(GL_TEXTURE_2D, 1, sized, w, h));
+   } else {
+      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, gl_format, w, h, 0, gl_format, gl_pixel_type, NULL));
+   }
+}
+
+static struct atlas*
+atlas_create(struct ctx *context)
+{
+   assert(context);
+
+   struct atlas *atlas;
+   if (!(atlas = calloc(1, sizeof(struct atlas))))
+      return NULL;
+
+   atlas->context = context;
+   GL_CALL(glGenTextures(1, &atlas->texture));
+   bind_texture(context, 0, atlas->texture);
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+   texture_storage(context, GL_BGRA_EXT, GL_UNSIGNED_BYTE, ATLAS_SIZE, ATLAS_SIZE);
+   wl_list_insert(context->atlases.prev, &atlas->link);
+   wlc_dlog(WLC_DBG_RENDER, "-> Created %ux%u texture atlas", ATLAS_SIZE, ATLAS_SIZE);
+   return atlas;
+}
+
+static void
+atlas_free(struct atlas *atlas)
+{
+   assert(atlas);
+   delete_textures(atlas->context, 1, &atlas->texture);
+   wl_list_remove(&atlas->link);
+   free(atlas);
+}
+
+static uint32_t
+atlas_cells(uint32_t size)
+{
+   // Keep a texel free to the next slot
+   return (size + 1 + ATLAS_CELL - 1) / ATLAS_CELL;
+}
+
+static bool
+atlas_find(struct atlas *atlas, uint32_t cw, uint32_t ch, struct wlc_point *out_cell)
+{
+   assert(atlas && cw > 0 && cw <= ATLAS_CELLS && ch > 0 && ch <= ATLAS_CELLS && out_cell);
+
+   const uint32_t mask = (cw == ATLAS_CELLS ? ~(uint32_t)0 : ((uint32_t)1 << cw) - 1);
+   for (uint32_t y = 0; y + ch <= ATLAS_CELLS; ++y) {
+      for (uint32_t x = 0; x + cw <= ATLAS_CELLS; ++x) {
+         bool fits = true;
+         for (uint32_t r = y; r < y + ch && fits; ++r)
+            fits = !(atlas->rows[r] & (mask << x));
+
+         if (!fits)
+            continue;
+
+         for (uint32_t r = y; r < y + ch; ++r)
+            atlas->rows[r] |= (mask << x);
+
+         *out_cell = (struct wlc_point){ x, y };
+         return true;
+      }
    }
 
-   memset(surface->images, 0, sizeof(surface->images));
+   return false;
+}
+
+static bool
+atlas_alloc(struct ctx *context, struct wlc_surface *surface, const struct wlc_size *size)
+{
+   assert(context && surface && size && !surface->atlas);
+
+   const uint32_t cw = atlas_cells(size->w), ch = atlas_cells(size->h);
+
+   uint32_t count = 0;
+   struct atlas *atlas;
+   struct wlc_point cell;
+   wl_list_for_each(atlas, &context->atlases, link) {
+      if (atlas_find(atlas, cw, ch, &cell))
+         goto found;
+      ++count;
+   }
+
+   if (count >= ATLAS_MAX_PAGES || !(atlas = atlas_create(context)) || !atlas_find(atlas, cw, ch, &cell))
+      return false;
+
+found:
+   surface->atlas = atlas;
+   surface->atlas_origin = (struct wlc_point){ cell.x * ATLAS_CELL, cell.y * ATLAS_CELL };
+   surface->textures[0] = atlas->texture;
+   return true;
+}
+
+static void
+atlas_release(struct wlc_surface *surface)
+{
+   assert(surface && surface->atlas);
+
+   struct atlas *atlas = surface->atlas;
+   const uint32_t cw = atlas_cells(surface->storage.size.w), ch = atlas_cells(surface->storage.size.h);
+   const uint32_t mask = (cw == ATLAS_CELLS ? ~(uint32_t)0 : ((uint32_t)1 << cw) - 1);
+   const uint32_t x = surface->atlas_origin.x / ATLAS_CELL, y = surface->atlas_origin.y / ATLAS_CELL;
+
+   for (uint32_t r = y; r < y + ch; ++r)
+      atlas->rows[r] &= ~(mask << x);
+
+   // Pages are kept around, small surfaces come and go all the time
+   surface->atlas = NULL;
+   surface->atlas_origin = wlc_point_zero;
+}
+
+static void
+uploads_cancel(struct wlc_surface *surface)
+{
+   assert(surface);
+
+   // Uploads in flight were meant for the old textures, they still release their buffers when they land
+   struct ctx *c;
+   wl_list_for_each(c, &contexts, link) {
+      struct upload *upload;
+      wl_list_for_each(upload, &c->uploads, link) {
+         if (upload->surface == convert_to_wlc_resource(surface))
+            upload->surface = 0;
+      }
+   }
+}
+
+static void
+surface_flush_textures(struct ctx *context, struct wlc_surface *surface)
+{
+   assert(context && surface);
+   uploads_cancel(surface);
+
+   if (surface->import) {
+      // Textures belong to the imported buffer
+      import_unref(surface->import, context);
+      surface->import = NULL;
+   } else if (surface->atlas) {
+      atlas_release(surface);
+   } else {
+      for (GLuint i = 0; i < 3; ++i) {
+         if (surface->textures[i])
+            delete_textures(context, 1, &surface->textures[i]);
+      }
+   }
+
+   memset(surface->textures, 0, sizeof(surface->textures));
+   memset(surface->filters, 0, sizeof(surface->filters));
+   memset(&surface->storage, 0, sizeof(surface->storage));
 }
 
 static void
 surface_destroy(struct ctx *context, struct wlc_context *bound, struct wlc_surface *surface)
 {
-   (void)context;
    assert(context && bound && surface);
-   surface_flush_textures(surface);
-   surface_flush_images(bound, surface);
+   flush_batch(context);
+   surface_flush_textures(context, surface);
    wlc_dlog(WLC_DBG_RENDER, "-> Destroyed surface");
 }
 
+static void
+upload_copy(struct upload *upload)
+{
+   assert(upload && upload->map);
+
+   // Access is guarded per thread, truncated pools can't take the compositor down from here either
+   wl_shm_buffer_begin_access(upload->shm_buffer);
+   const uint8_t *data = wl_shm_buffer_get_data(upload->shm_buffer);
+
+   // Rectangles are packed tightly, the unpack alignment is 1
+   int nrects;
+   uint8_t *dst = upload->map;
+   const pixman_box32_t *rects = pixman_region32_rectangles(&upload->damage, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const size_t row = (size_t)(rects[i].x2 - rects[i].x1) * upload->bpp;
+      for (int32_t y = rects[i].y1; y < rects[i].y2; ++y, dst += row)
+         memcpy(dst, data + ((size_t)y * upload->pitch + rects[i].x1) * upload->bpp, row);
+   }
+
+   wl_shm_buffer_end_access(upload->shm_buffer);
+}
+
+static void*
+upload_thread(void *data)
+{
+   (void)data;
+
+   pthread_mutex_lock(&uploader.mutex);
+
+   while (true) {
+      while (wl_list_empty(&uploader.queue) && !uploader.quit)
+         pthread_cond_wait(&uploader.cond, &uploader.mutex);
+
+      if (uploader.quit)
+         break;
+
+      // Only the copy happens here, GL calls and resources stay on the loop
+      struct upload *upload = wl_container_of(uploader.queue.next, upload, queue);
+      wl_list_remove(&upload->queue);
+      wl_list_init(&upload->queue);
+      pthread_mutex_unlock(&uploader.mutex);
+
+      upload_copy(upload);
+
+      pthread_mutex_lock(&uploader.mutex);
+      upload->copied = true;
+      pthread_cond_broadcast(&uploader.done);
+      eventfd_write(uploader.fd, 1);
+   }
+
+   pthread_mutex_unlock(&uploader.mutex);
+   return NULL;
+}
+
+static void
+upload_wait(struct upload *upload, bool cancel)
+{
+   assert(upload);
+
+   pthread_mutex_lock(&uploader.mutex);
+
+   // Not picked up by the thread yet, so there's nothing to land
+   if (cancel && !wl_list_empty(&upload->queue)) {
+      wl_list_remove(&upload->queue);
+      wl_list_init(&upload->queue);
+      upload->surface = 0;
+      upload->copied = true;
+   }
+
+   while (!upload->copied)
+      pthread_cond_wait(&uploader.done, &uploader.mutex);
+
+   pthread_mutex_unlock(&uploader.mutex);
+}
+
+static void
+upload_release_buffer(struct upload *upload)
+{
+   assert(upload);
+
+   wl_list_remove(&upload->destroy.link);
+   wl_list_init(&upload->destroy.link);
+
+   if (upload->pool) {
+      wl_shm_pool_unref(upload->pool);
+      upload->pool = NULL;
+   }
+
+   // wl_buffer.release is sent once the surface doesn't hold it either
+   wlc_buffer_dispose(convert_from_wlc_resource(upload->buffer, "buffer"));
+   upload->buffer = 0;
+   upload->shm_buffer = NULL;
+}
+
+static void
+cb_upload_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+   (void)data;
+   struct upload *upload;
+   upload = wl_container_of(listener, upload, destroy);
+
+   // Copy in progress reads through the wl_shm_buffer, which is freed after us
+   upload_wait(upload, true);
+   wl_list_remove(&upload->destroy.link);
+   wl_list_init(&upload->destroy.link);
+   upload->shm_buffer = NULL;
+}
+
+static void
+upload_free(struct ctx *context, struct upload *upload)
+{
+   assert(context && upload);
+
+   if (upload->map) {
+      GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pbo));
+      GL_CALL(context->api.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+      GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+   }
+
+   if (upload->fence) {
+      GL_CALL(context->api.glDeleteSync(upload->fence));
+   }
+
+   // Next upload orphans the storage anyway
+   if (!context->staging) {
+      context->staging = upload->pbo;
+   } else {
+      GL_CALL(glDeleteBuffers(1, &upload->pbo));
+   }
+
+   upload_release_buffer(upload);
+   pixman_region32_fini(&upload->damage);
+   wl_list_remove(&upload->link);
+   free(upload);
+}
+
+static void
+upload_land(struct ctx *context, struct upload *upload)
+{
+   assert(context && upload && upload->map);
+
+   // Texture may be part of the pending batch
+   flush_batch(context);
+
+   GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pbo));
+   const GLboolean unmapped = GL_CALL(context->api.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+   upload->map = NULL;
+
+   struct wlc_surface *surface;
+   if (unmapped && (surface = convert_from_wlc_resource(upload->surface, "surface"))) {
+      bind_texture(context, 0, surface->textures[0]);
+
+      int nrects;
+      GLintptr pos = 0;
+      const pixman_box32_t *rects = pixman_region32_rectangles(&upload->damage, &nrects);
+      for (int i = 0; i < nrects; ++i) {
+         const GLsizei w = rects[i].x2 - rects[i].x1, h = rects[i].y2 - rects[i].y1;
+         GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, upload->offset.x + rects[i].x1, upload->offset.y + rects[i].y1, w, h, upload->gl_format, upload->gl_pixel_type, (const void*)pos));
+         pos += (GLintptr)w * h * upload->bpp;
+      }
+
+      // Frames painted meanwhile showed the old content
+      pixman_region32_union(&surface->commit.damage, &surface->commit.damage, &upload->damage);
+      wlc_output_schedule_repaint(convert_from_wlc_resource(surface->output, "output"));
+   }
+
+   GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+   upload->fence = GL_CALL(context->api.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+   // Client's pixels are in the buffer object now, it can have its buffer back
+   upload_release_buffer(upload);
+}
+
+static void
+uploads_land(struct ctx *context)
+{
+   assert(context);
+
+   struct upload *upload, *tmp;
+   wl_list_for_each_safe(upload, tmp, &context->uploads, link) {
+      if (upload->map) {
+         pthread_mutex_lock(&uploader.mutex);
+         const bool copied = upload->copied;
+         pthread_mutex_unlock(&uploader.mutex);
+
+         // Copies finish in order, nothing after this has landed either
+         if (!copied)
+            break;
+
+         upload_land(context, upload);
+      }
+
+      if (upload->fence) {
+         const GLenum status = GL_CALL(context->api.glClientWaitSync(upload->fence, 0, 0));
+         if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+      }
+
+      upload_free(context, upload);
+   }
+}
+
+static void
+uploads_flush(struct ctx *context, struct wlc_surface *surface)
+{
+   assert(context && surface);
+
+   // Uploads still in flight would overwrite newer content when they land
+   struct upload *upload;
+   wl_list_for_each(upload, &context->uploads, link) {
+      if (upload->surface != convert_to_wlc_resource(surface) || !upload->map)
+         continue;
+
+      upload_wait(upload, false);
+      upload_land(context, upload);
+   }
+}
+
+static bool
+surface_has_uploads(struct ctx *context, struct wlc_surface *surface)
+{
+   assert(context && surface);
+
+   struct upload *upload;
+   wl_list_for_each(upload, &context->uploads, link) {
+      if (upload->surface == convert_to_wlc_resource(surface) && upload->map)
+         return true;
+   }
+
+   return false;
+}
+
+static int
+upload_event(int fd, uint32_t mask, void *data)
+{
+   (void)mask, (void)data;
+
+   eventfd_t value;
+   eventfd_read(fd, &value);
+
+   // Called outside of rendering, so make sure we touch the right GL context
+   struct ctx *c;
+   wl_list_for_each(c, &contexts, link) {
+      if (!wl_list_empty(&c->uploads) && wlc_context_bind(&c->bound))
+         uploads_land(c);
+   }
+
+   return 0;
+}
+
+static bool
+uploader_start(void)
+{
+   if (uploader.running)
+      return true;
+
+   // Uploads work without the thread, don't try again for every one of them
+   if (uploader.failed)
+      return false;
+
+   uploader.failed = true;
+   wl_list_init(&uploader.queue);
+
+   if ((uploader.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+      goto eventfd_fail;
+
+   if (!(uploader.event_source = wl_event_loop_add_fd(wlc_event_loop(), uploader.fd, WL_EVENT_READABLE, upload_event, NULL)))
+      goto fail;
+
+   pthread_mutex_init(&uploader.mutex, NULL);
+   pthread_cond_init(&uploader.cond, NULL);
+   pthread_cond_init(&uploader.done, NULL);
+
+   if (pthread_create(&uploader.thread, NULL, upload_thread, NULL)) {
+      pthread_cond_destroy(&uploader.done);
+      pthread_cond_destroy(&uploader.cond);
+      pthread_mutex_destroy(&uploader.mutex);
+      goto thread_fail;
+   }
+
+   uploader.failed = false;
+   uploader.running = true;
+   return true;
+
+eventfd_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create eventfd: %m");
+   goto fail;
+thread_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create upload thread");
+fail:
+   if (uploader.event_source)
+      wl_event_source_remove(uploader.event_source);
+
+   if (uploader.fd >= 0)
+      close(uploader.fd);
+
+   uploader.event_source = NULL;
+   uploader.fd = -1;
+   return false;
+}
+
+static void
+uploader_stop(void)
+{
+   if (uploader.running) {
+      // Contexts are gone, so is everything they queued
+      pthread_mutex_lock(&uploader.mutex);
+      uploader.quit = true;
+      pthread_cond_signal(&uploader.cond);
+      pthread_mutex_unlock(&uploader.mutex);
+      pthread_join(uploader.thread, NULL);
+
+      pthread_cond_destroy(&uploader.done);
+      pthread_cond_destroy(&uploader.cond);
+      pthread_mutex_destroy(&uploader.mutex);
+   }
+
+   if (uploader.event_source)
+      wl_event_source_remove(uploader.event_source);
+
+   if (uploader.fd >= 0)
+      close(uploader.fd);
+
+   memset(&uploader, 0, sizeof(uploader));
+   uploader.fd = -1;
+}
+
 static bool
-shm_attach(struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm_buffer *shm_buffer)
+upload_queue(struct ctx *context, struct wlc_surface *surface, struct wlc_buffer *buffer, const struct wlc_point *offset, pixman_region32_t *damage, GLint pitch, GLint bpp, GLenum gl_format, GLenum gl_pixel_type)
 {
-   assert(surface && buffer && shm_buffer);
+   assert(context && surface && buffer && offset && damage);
+
+   if (!context->api.glMapBufferRange || !context->api.glFenceSync)
+      return false;
+
+   int nrects;
+   const pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+
+   GLsizeiptr size = 0;
+   for (int i = 0; i < nrects; ++i)
+      size += (GLsizeiptr)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1) * bpp;
+
+   // Small uploads go in order behind the ones of the surface still in flight
+   if ((size < STAGING_MIN_BYTES && !surface_has_uploads(context, surface)) || !uploader_start())
+      return false;
+
+   struct wl_resource *wl_buffer;
+   if (!(wl_buffer = convert_to_wl_resource(buffer, "buffer")))
+      return false;
+
+   struct upload *upload;
+   if (!(upload = calloc(1, sizeof(struct upload))))
+      return false;
+
+   if (context->staging) {
+      upload->pbo = context->staging;
+      context->staging = 0;
+   } else {
+      GL_CALL(glGenBuffers(1, &upload->pbo));
+   }
+
+   // Orphan the previous storage, so we never wait for the driver to finish reading it
+   GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pbo));
+   GL_CALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW));
+   upload->map = GL_CALL(context->api.glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+   GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+   if (!upload->map) {
+      GL_CALL(glDeleteBuffers(1, &upload->pbo));
+      free(upload);
+      return false;
+   }
+
+   upload->surface = convert_to_wlc_resource(surface);
+   upload->offset = *offset;
+   upload->pitch = pitch;
+   upload->bpp = bpp;
+   upload->gl_format = gl_format;
+   upload->gl_pixel_type = gl_pixel_type;
+   pixman_region32_init(&upload->damage);
+   pixman_region32_copy(&upload->damage, damage);
+
+   // Referenced pool is not remapped by resizes, the buffer isn't released until the copy has landed
+   upload->shm_buffer = buffer->shm_buffer;
+   upload->pool = wl_shm_buffer_ref_pool(buffer->shm_buffer);
+   upload->buffer = wlc_buffer_use(buffer);
+   upload->destroy.notify = cb_upload_buffer_destroyed;
+   wl_resource_add_destroy_listener(wl_buffer, &upload->destroy);
+   wl_list_init(&upload->queue);
+   wl_list_insert(context->uploads.prev, &upload->link);
+
+   pthread_mutex_lock(&uploader.mutex);
+   wl_list_insert(uploader.queue.prev, &upload->queue);
+   pthread_cond_signal(&uploader.cond);
+   pthread_mutex_unlock(&uploader.mutex);
+   return true;
+}
+
+static void
+upload_direct(const struct wlc_point *offset, const pixman_box32_t *rects, int nrects, const uint8_t *data, GLint pitch, GLenum gl_format, GLenum gl_pixel_type)
+{
+   assert(offset && rects && data);
+
+   GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
+
+   for (int i = 0; i < nrects; ++i) {
+      GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, rects[i].x1));
+      GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, rects[i].y1));
+      GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, offset->x + rects[i].x1, offset->y + rects[i].y1, rects[i].x2 - rects[i].x1, rects[i].y2 - rects[i].y1, gl_format, gl_pixel_type, data));
+   }
+
+   GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0));
+   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
+   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
+}
+
+static void
+shm_upload(struct ctx *context, struct wlc_surface *surface, struct wlc_buffer *buffer, GLint pitch, GLint bpp, GLenum gl_format, GLenum gl_pixel_type)
+{
+   assert(context && surface && buffer);
+
+   // Textures of imported buffers can't be uploaded to
+   if (surface->import)
+      surface_flush_textures(context, surface);
+
+   const bool reuse = (surface->textures[0] && surface->storage.format == gl_format && wlc_size_equals(&surface->storage.size, &buffer->size));
+
+   pixman_region32_t damage;
+   pixman_region32_init_rect(&damage, 0, 0, buffer->size.w, buffer->size.h);
+
+   if (reuse) {
+      pixman_region32_intersect(&damage, &damage, &surface->commit.buffer_damage);
+
+      // Too many rects cost more in calls than the extra pixels
+      if (pixman_region32_n_rects(&damage) > 16) {
+         pixman_box32_t e = *pixman_region32_extents(&damage);
+         pixman_region32_reset(&damage, &e);
+      }
+   }
+
+   if (!reuse) {
+      uploads_cancel(surface);
+      const bool small = (gl_format == GL_BGRA_EXT && buffer->size.w <= ATLAS_MAX_SURFACE && buffer->size.h <= ATLAS_MAX_SURFACE);
+
+      // Slot or texture of the old size is of no use anymore, immutable storage can't be resized either
+      const bool immutable = (storage_format(context, gl_format, gl_pixel_type) != GL_NONE);
+      if (surface->atlas || ((small || immutable) && surface->textures[0]))
+         surface_flush_textures(context, surface);
+
+      if (small)
+         atlas_alloc(context, surface, &buffer->size);
+
+      if (!surface->atlas) {
+         surface_gen_textures(context, surface, 1);
+         bind_texture(context, 0, surface->textures[0]);
+         texture_storage(context, gl_format, gl_pixel_type, buffer->size.w, buffer->size.h);
+      }
+
+      surface->storage.size = buffer->size;
+      surface->storage.format = gl_format;
+   }
+
+   bind_texture(context, 0, surface->textures[0]);
+
+   int nrects;
+   const pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+
+   if (nrects > 0) {
+      // Staged uploads cost nothing here, the texture keeps showing the old content until the copy has landed.
+      // New storage has nothing to show meanwhile, so it's filled right away.
+      const struct wlc_point *offset = &surface->atlas_origin;
+      const bool staged = (reuse && upload_queue(context, surface, buffer, offset, &damage, pitch, bpp, gl_format, gl_pixel_type));
+
+      if (!staged) {
+         uploads_flush(context, surface);
+         bind_texture(context, 0, surface->textures[0]);
+         wl_shm_buffer_begin_access(buffer->shm_buffer);
+         upload_direct(offset, rects, nrects, wl_shm_buffer_get_data(buffer->shm_buffer), pitch, gl_format, gl_pixel_type);
+         wl_shm_buffer_end_access(buffer->shm_buffer);
+      }
+
+      wlc_dlog(WLC_DBG_RENDER, "-> %s %s upload (%ux%u)", (reuse ? "Partial" : "Full"), (staged ? "staged" : "direct"), buffer->size.w, buffer->size.h);
+   }
+
+   pixman_region32_fini(&damage);
+}
+
+static bool
+shm_attach(struct ctx *context, struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm_buffer *shm_buffer)
+{
+   assert(context && surface && buffer && shm_buffer);
 
    buffer->shm_buffer = shm_buffer;
    buffer->size.w = wl_shm_buffer_get_width(shm_buffer);
    buffer->size.h = wl_shm_buffer_get_height(shm_buffer);
 
-   GLint pitch;
+   GLint pitch, bpp;
    GLenum gl_format, gl_pixel_type;
    switch (wl_shm_buffer_get_format(shm_buffer)) {
       case WL_SHM_FORMAT_XRGB8888:
-         pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
+         bpp = 4;
+         pitch = wl_shm_buffer_get_stride(shm_buffer) / bpp;
          gl_format = GL_BGRA_EXT;
          gl_pixel_type = GL_UNSIGNED_BYTE;
          surface->format = SURFACE_RGB;
          break;
       case WL_SHM_FORMAT_ARGB8888:
-         pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
+         bpp = 4;
+         pitch = wl_shm_buffer_get_stride(shm_buffer) / bpp;
          gl_format = GL_BGRA_EXT;
          gl_pixel_type = GL_UNSIGNED_BYTE;
          surface->format = SURFACE_RGBA;
          break;
       case WL_SHM_FORMAT_RGB565:
-         pitch = wl_shm_buffer_get_stride(shm_buffer) / 2;
+         bpp = 2;
+         pitch = wl_shm_buffer_get_stride(shm_buffer) / bpp;
          gl_format = GL_RGB;
          gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
          surface->format = SURFACE_RGB;
@@ -530,39 +1918,60 @@ shm_attach(struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm
    struct wlc_view *view;
    if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
       wlc_x11_window_set_surface_format(surface, &view->x11);
-
-   surface_gen_textures(surface, 1);
-   GL_CALL(glBindTexture(GL_TEXTURE_2D, surface->textures[0]));
-   GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
-   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
-   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
-   wl_shm_buffer_begin_access(buffer->shm_buffer);
-   void *data = wl_shm_buffer_get_data(buffer->shm_buffer);
-   GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, gl_format, pitch, buffer->size.h, 0, gl_format, gl_pixel_type, data));
-   wl_shm_buffer_end_access(buffer->shm_buffer);
-   GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0));
-
-   return true;
+
+   shm_upload(context, surface, buffer, pitch, bpp, gl_format, gl_pixel_type);
+   return true;
+}
+
+static void
+import_attach(struct ctx *context, struct wlc_surface *surface, struct wlc_buffer *buffer, struct import *import)
+{
+   assert(context && surface && buffer && import);
+
+   buffer->legacy_buffer = convert_to_wl_resource(buffer, "buffer");
+   buffer->size = import->size;
+   buffer->y_inverted = import->y_inverted;
+
+   if (surface->import != import) {
+      import->references++;
+      surface_flush_textures(context, surface);
+      memcpy(surface->textures, import->textures, sizeof(surface->textures));
+      surface->import = import;
+   }
+
+   surface->format = import->format;
+
+   struct wlc_view *view;
+   if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
+      wlc_x11_window_set_surface_format(surface, &view->x11);
 }
 
-static bool
-egl_attach(struct ctx *context, struct wlc_context *ectx, struct wlc_surface *surface, struct wlc_buffer *buffer, EGLint format)
+static struct import*
+egl_import(struct ctx *context, struct wlc_context *ectx, struct wl_resource *buffer, EGLint format)
 {
-   assert(context && surface && buffer);
+   assert(context && ectx && buffer);
 
    if (!context->api.glEGLImageTargetTexture2DOES) {
       if (!has_extension(context, "GL_OES_EGL_image_external") ||
           !(context->api.glEGLImageTargetTexture2DOES = wlc_context_get_proc_address(ectx, "glEGLImageTargetTexture2DOES"))) {
          wlc_log(WLC_LOG_WARN, "No GL_OES_EGL_image_external available");
-         return false;
+         return NULL;
       }
       assert(context->api.glEGLImageTargetTexture2DOES);
    }
 
-   buffer->legacy_buffer = convert_to_wl_resource(buffer, "buffer");
-   wlc_context_query_buffer(ectx, buffer->legacy_buffer, EGL_WIDTH, (EGLint*)&buffer->size.w);
-   wlc_context_query_buffer(ectx, buffer->legacy_buffer, EGL_HEIGHT, (EGLint*)&buffer->size.h);
-   wlc_context_query_buffer(ectx, buffer->legacy_buffer, EGL_WAYLAND_Y_INVERTED_WL, (EGLint*)&buffer->y_inverted);
+   struct import *import;
+   if (!(import = calloc(1, sizeof(struct import))))
+      return NULL;
+
+   import->context = context;
+   import->y_inverted = true;
+   wl_list_init(&import->link);
+   wl_list_init(&import->destroy.link);
+
+   wlc_context_query_buffer(ectx, buffer, EGL_WIDTH, (EGLint*)&import->size.w);
+   wlc_context_query_buffer(ectx, buffer, EGL_HEIGHT, (EGLint*)&import->size.h);
+   wlc_context_query_buffer(ectx, buffer, EGL_WAYLAND_Y_INVERTED_WL, (EGLint*)&import->y_inverted);
 
    GLuint num_planes;
    GLenum target = GL_TEXTURE_2D;
@@ -571,50 +1980,61 @@ egl_attach(struct ctx *context, struct wlc_context *ectx, struct wlc_surface *su
       case EGL_TEXTURE_RGBA:
       default:
          num_planes = 1;
-         surface->format = SURFACE_RGBA;
+         import->format = SURFACE_RGBA;
          break;
       case 0x31DA:
          num_planes = 1;
-         surface->format = SURFACE_EGL;
+         import->format = SURFACE_EGL;
          target = GL_TEXTURE_EXTERNAL_OES;
          break;
       case EGL_TEXTURE_Y_UV_WL:
          num_planes = 2;
-         surface->format = SURFACE_Y_UV;
+         import->format = SURFACE_Y_UV;
          break;
       case EGL_TEXTURE_Y_U_V_WL:
          num_planes = 3;
-         surface->format = SURFACE_Y_U_V;
+         import->format = SURFACE_Y_U_V;
          break;
       case EGL_TEXTURE_Y_XUXV_WL:
          num_planes = 2;
-         surface->format = SURFACE_Y_XUXV;
+         import->format = SURFACE_Y_XUXV;
          break;
    }
 
-   struct wlc_view *view;
-   if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
-      wlc_x11_window_set_surface_format(surface, &view->x11);
-
    if (num_planes > 3) {
       wlc_log(WLC_LOG_WARN, "planes > 3 in egl surfaces not supported, nor should be possible");
-      return false;
+      goto fail;
    }
 
-   surface_flush_images(ectx, surface);
-   surface_gen_textures(surface, num_planes);
-
    for (GLuint i = 0; i < num_planes; ++i) {
       EGLint attribs[] = { EGL_WAYLAND_PLANE_WL, i, EGL_NONE };
-      if (!(surface->images[i] = wlc_context_create_image(ectx, EGL_WAYLAND_BUFFER_WL, buffer->legacy_buffer, attribs)))
-         return false;
+      if (!(import->images[i] = wlc_context_create_image(ectx, EGL_WAYLAND_BUFFER_WL, buffer, attribs)))
+         goto fail;
+
+      GL_CALL(glGenTextures(1, &import->textures[i]));
+
+      if (target == GL_TEXTURE_2D) {
+         bind_texture(context, i, import->textures[i]);
+      } else {
+         active_texture(context, i);
+         GL_CALL(glBindTexture(target, import->textures[i]));
+      }
 
-      GL_CALL(glActiveTexture(GL_TEXTURE0 + i));
-      GL_CALL(glBindTexture(target, surface->textures[i]));
-      GL_CALL(context->api.glEGLImageTargetTexture2DOES(target, surface->images[i]));
+      GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+      GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+      GL_CALL(context->api.glEGLImageTargetTexture2DOES(target, import->images[i]));
    }
 
-   return true;
+   import->buffer = buffer;
+   import->destroy.notify = cb_import_buffer_destroyed;
+   wl_resource_add_destroy_listener(buffer, &import->destroy);
+   wl_list_insert(&context->imports, &import->link);
+   wlc_dlog(WLC_DBG_RENDER, "-> Imported buffer (%ux%u)", import->size.w, import->size.h);
+   return import;
+
+fail:
+   import_free(import, context);
+   return NULL;
 }
 
 static bool
@@ -628,19 +2048,31 @@ surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surfac
       return true;
    }
 
+   // Textures may be part of the pending batch
+   flush_batch(context);
+
    EGLint format;
    bool attached = false;
 
+   struct import *import;
    struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(wl_buffer);
    if (shm_buffer) {
-      attached = shm_attach(surface, buffer, shm_buffer);
+      attached = shm_attach(context, surface, buffer, shm_buffer);
+   } else if ((import = import_for_buffer(context, wl_buffer))) {
+      import_attach(context, surface, buffer, import);
+      attached = true;
    } else if (wlc_context_query_buffer(bound, (void*)wl_buffer, EGL_TEXTURE_FORMAT, &format)) {
-      attached = egl_attach(context, bound, surface, buffer, format);
+      if ((import = egl_import(context, bound, wl_buffer, format))) {
+         import_attach(context, surface, buffer, import);
+         attached = true;
+      }
    } else {
       /* unknown buffer */
       wlc_log(WLC_LOG_WARN, "Unknown buffer");
    }
 
+   pixman_region32_clear(&surface->commit.buffer_damage);
+
    if (attached)
       wlc_dlog(WLC_DBG_RENDER, "-> Attached surface (%" PRIuWLC ") with buffer of size (%ux%u)", convert_to_wlc_resource(surface), buffer->size.w, buffer->size.h);
 
@@ -648,43 +2080,110 @@ surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surfac
 }
 
 static void
-texture_paint(struct ctx *context, GLuint *textures, GLuint nmemb, const struct wlc_geometry *geometry, struct paint *settings)
+batch_quad(struct ctx *context, const struct wlc_geometry *geometry, const struct uv *uv, const pixman_box32_t *box)
 {
-   const GLfloat vertices[8] = {
-      geometry->origin.x + geometry->size.w, geometry->origin.y,
-      geometry->origin.x, geometry->origin.y,
-      geometry->origin.x + geometry->size.w, geometry->origin.y + geometry->size.h,
-      geometry->origin.x, geometry->origin.y + geometry->size.h,
-   };
+   assert(context && geometry && box);
+
+   if (context->batch.quads >= BATCH_QUADS)
+      flush_batch(context);
+
+   // Texture coordinates of the part of geometry the box covers
+   const struct uv whole = { 0, 0, 1, 1 }, *t = (uv ? uv : &whole);
+   const GLfloat sw = (t->x2 - t->x1) / geometry->size.w, sh = (t->y2 - t->y1) / geometry->size.h;
+   const GLfloat u1 = t->x1 + (box->x1 - geometry->origin.x) * sw;
+   const GLfloat u2 = t->x1 + (box->x2 - geometry->origin.x) * sw;
+   const GLfloat v1 = t->y1 + (box->y1 - geometry->origin.y) * sh;
+   const GLfloat v2 = t->y1 + (box->y2 - geometry->origin.y) * sh;
+
+   if (context->gles3) {
+      context->batch.instances[context->batch.quads++] = (struct instance){ box->x1, box->y1, box->x2, box->y2, u1, v1, u2, v2 };
+      return;
+   }
 
-   const GLfloat coords[8] = {
-      1, 0,
-      0, 0,
-      1, 1,
-      0, 1
+   const struct vertex quad[4] = {
+      { box->x2, box->y1, u2, v1 },
+      { box->x1, box->y1, u1, v1 },
+      { box->x2, box->y2, u2, v2 },
+      { box->x1, box->y2, u1, v2 },
    };
 
-   set_program(context, settings->program);
+   memcpy(&context->batch.vertices[context->batch.quads * 4], quad, sizeof(quad));
+   context->batch.quads++;
+}
 
-   for (GLuint i = 0; i < nmemb; ++i) {
-      if (!textures[i])
-         break;
+static void
+texture_paint_region(struct ctx *context, GLuint *textures, GLenum *filters, GLuint nmemb, const struct wlc_geometry *geometry, pixman_region32_t *region, struct paint *settings)
+{
+   assert(context && textures && filters && nmemb <= 3 && geometry && settings);
 
-      GL_CALL(glActiveTexture(GL_TEXTURE0 + i));
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, textures[i]));
+   if (geometry->size.w == 0 || geometry->size.h == 0)
+      return;
 
-      if (settings->filter || !wlc_size_equals(&context->resolution, &context->mode)) {
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-      } else {
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-      }
+   pixman_region32_t area;
+   pixman_region32_init_rect(&area, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+
+   if (region)
+      pixman_region32_intersect(&area, &area, region);
+
+   if (context->clip.enabled)
+      pixman_region32_intersect(&area, &area, &context->clip.region);
+
+   int nrects;
+   const pixman_box32_t *rects = pixman_region32_rectangles(&area, &nrects);
+
+   if (nrects == 0) {
+      pixman_region32_fini(&area);
+      return;
+   }
+
+   const GLenum filter = (settings->filter || !wlc_size_equals(&context->resolution, &context->mode) ? GL_LINEAR : GL_NEAREST);
+
+   GLuint used[3] = { 0, 0, 0 };
+   bool changed = (settings->program != context->batch.program || settings->opaque != context->batch.opaque);
+   for (GLuint i = 0; i < nmemb && textures[i]; ++i) {
+      used[i] = textures[i];
+      changed = changed || (filters[i] != filter);
+   }
+
+   changed = changed || memcmp(used, context->batch.textures, sizeof(used));
+
+   if (changed) {
+      flush_batch(context);
+
+      for (GLuint i = 0; i < 3 && used[i]; ++i)
+         set_filter(context, i, used[i], &filters[i], filter);
+
+      memcpy(context->batch.textures, used, sizeof(used));
+      context->batch.program = settings->program;
+      context->batch.opaque = settings->opaque;
+   }
+
+   for (int i = 0; i < nrects; ++i)
+      batch_quad(context, geometry, settings->uv, &rects[i]);
+
+   pixman_region32_fini(&area);
+}
+
+static void
+texture_paint(struct ctx *context, GLuint *textures, GLenum *filters, GLuint nmemb, const struct wlc_geometry *geometry, struct paint *settings)
+{
+   texture_paint_region(context, textures, filters, nmemb, geometry, NULL, settings);
+}
+
+WLC_CONST static bool
+program_is_opaque(enum program_type program)
+{
+   // These programs always output alpha of 1.0
+   switch (program) {
+      case PROGRAM_RGB:
+      case PROGRAM_Y_UV:
+      case PROGRAM_Y_U_V:
+      case PROGRAM_Y_XUXV:
+         return true;
+      default: break;
    }
 
-   GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices));
-   GL_CALL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, coords));
-   GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+   return false;
 }
 
 static void
@@ -694,19 +2193,71 @@ surface_paint_internal(struct ctx *context, struct wlc_surface *surface, const s
 
    const struct wlc_geometry *g = geometry;
 
+   struct uv uv;
+   GLenum *filters = surface->filters;
+   if (surface->atlas) {
+      // Inset by half a texel, so filtering never samples the neighbouring slots
+      const struct wlc_point *o = &surface->atlas_origin;
+      const struct wlc_size *s = &surface->storage.size;
+      uv = (struct uv){ (o->x + 0.5f) / ATLAS_SIZE, (o->y + 0.5f) / ATLAS_SIZE, (o->x + s->w - 0.5f) / ATLAS_SIZE, (o->y + s->h - 0.5f) / ATLAS_SIZE };
+      filters = &((struct atlas*)surface->atlas)->filter;
+   }
+
    if (!wlc_size_equals(&surface->size, &geometry->size)) {
       if (wlc_geometry_equals(&settings->visible, geometry)) {
          settings->filter = true;
       } else {
          // black borders are requested
+         const struct wlc_geometry *v = &settings->visible;
+         pixman_region32_t strips, visible;
+         pixman_region32_init_rect(&strips, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+         pixman_region32_init_rect(&visible, v->origin.x, v->origin.y, v->size.w, v->size.h);
+         pixman_region32_subtract(&strips, &strips, &visible);
+         pixman_region32_fini(&visible);
+
          struct paint settings2 = *settings;
-         settings2.program = (settings2.program == PROGRAM_RGBA || settings2.program == PROGRAM_RGB ? settings2.program : PROGRAM_RGB);
-         texture_paint(context, &context->textures[TEXTURE_BLACK], 1, geometry, &settings2);
+         settings2.uv = NULL;
+         settings2.program = PROGRAM_RGB;
+         settings2.opaque = true;
+         texture_paint_region(context, &context->textures[TEXTURE_BLACK], &context->filters[TEXTURE_BLACK], 1, geometry, &strips, &settings2);
+         pixman_region32_fini(&strips);
          g = &settings->visible;
       }
    }
 
-   texture_paint(context, surface->textures, 3, g, settings);
+   if (surface->atlas)
+      settings->uv = &uv;
+
+   if (program_is_opaque(settings->program)) {
+      settings->opaque = true;
+      texture_paint(context, surface->textures, filters, 3, g, settings);
+      return;
+   }
+
+   // Opaque quads are drawn with blending disabled, the rest of the surface is blended
+   pixman_region32_t opaque;
+   pixman_region32_init(&opaque);
+
+   if (wlc_size_equals(&surface->size, &g->size)) {
+      pixman_region32_copy(&opaque, &surface->commit.opaque);
+      pixman_region32_translate(&opaque, g->origin.x, g->origin.y);
+   }
+
+   if (pixman_region32_not_empty(&opaque)) {
+      settings->opaque = true;
+      texture_paint_region(context, surface->textures, filters, 3, g, &opaque, settings);
+
+      pixman_region32_t translucent;
+      pixman_region32_init_rect(&translucent, g->origin.x, g->origin.y, g->size.w, g->size.h);
+      pixman_region32_subtract(&translucent, &translucent, &opaque);
+      settings->opaque = false;
+      texture_paint_region(context, surface->textures, filters, 3, g, &translucent, settings);
+      pixman_region32_fini(&translucent);
+   } else {
+      texture_paint(context, surface->textures, filters, 3, g, settings);
+   }
+
+   pixman_region32_fini(&opaque);
 }
 
 static void
@@ -740,8 +2291,10 @@ view_paint(struct ctx *context, struct wlc_view *view)
       wlc_view_get_opaque(view, &geometry);
       settings.visible = geometry;
       settings.program = PROGRAM_CURSOR;
+      flush_batch(context);
       GL_CALL(glBlendFunc(GL_ONE, GL_DST_COLOR));
-      texture_paint(context, &context->textures[TEXTURE_BLACK], 1, &geometry, &settings);
+      texture_paint(context, &context->textures[TEXTURE_BLACK], &context->filters[TEXTURE_BLACK], 1, &geometry, &settings);
+      flush_batch(context);
       GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
    }
 }
@@ -753,8 +2306,8 @@ pointer_paint(struct ctx *context, const struct wlc_point *pos)
    struct paint settings;
    memset(&settings, 0, sizeof(settings));
    settings.program = PROGRAM_CURSOR;
-   struct wlc_geometry g = { *pos, { 14, 14 } };
-   texture_paint(context, &context->textures[TEXTURE_CURSOR], 1, &g, &settings);
+   struct wlc_geometry g = { *pos, { CURSOR_SIZE, CURSOR_SIZE } };
+   texture_paint(context, &context->textures[TEXTURE_CURSOR], &context->filters[TEXTURE_CURSOR], 1, &g, &settings);
 }
 
 static void
@@ -785,6 +2338,21 @@ clamp_to_bounds(struct wlc_geometry *g, const struct wlc_size *bounds)
       g->size.h -= (g->origin.y + g->size.h) - bounds->h;
 }
 
+static void
+swizzle(uint8_t *dst, const uint8_t *src, size_t pixels, bool opaque)
+{
+   assert(dst && src);
+
+   // RGBA <-> BGRA, may be done in place
+   for (size_t i = 0; i < pixels * 4; i += 4) {
+      const uint8_t r = src[i + 0];
+      dst[i + 0] = src[i + 2];
+      dst[i + 1] = src[i + 1];
+      dst[i + 2] = r;
+      dst[i + 3] = (opaque ? 0xff : src[i + 3]);
+   }
+}
+
 static void
 read_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data)
 {
@@ -792,7 +2360,15 @@ read_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_
    assert(context && geometry && out_geometry && out_data);
    struct wlc_geometry g = *geometry;
    clamp_to_bounds(&g, &context->resolution);
-   GL_CALL(glReadPixels(g.origin.x, g.origin.y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, out_data));
+   flush_batch(context);
+
+   if (format == WLC_RGBA8888 || context->read_bgra) {
+      GL_CALL(glReadPixels(g.origin.x, g.origin.y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, out_data));
+   } else {
+      GL_CALL(glReadPixels(g.origin.x, g.origin.y, g.size.w, g.size.h, GL_RGBA, GL_UNSIGNED_BYTE, out_data));
+      swizzle(out_data, out_data, g.size.w * g.size.h, false);
+   }
+
    *out_geometry = g;
 }
 
@@ -803,11 +2379,242 @@ write_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc
    assert(context && geometry && data);
    struct wlc_geometry g = *geometry;
    clamp_to_bounds(&g, &context->resolution);
-   GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[TEXTURE_FAKEFB]));
-   GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, g.origin.x, g.origin.y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, data));
+   flush_batch(context);
+   bind_texture(context, 0, context->textures[TEXTURE_FAKEFB]);
+
+   if (format == WLC_RGBA8888) {
+      GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, g.origin.x, g.origin.y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, data));
+   } else {
+      // fakefb is GL_RGBA, which can't be updated with GL_BGRA_EXT data
+      uint8_t *rgba;
+      if (!(rgba = malloc(g.size.w * g.size.h * 4)))
+         return;
+
+      swizzle(rgba, data, g.size.w * g.size.h, (format == WLC_XRGB8888));
+      GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, g.origin.x, g.origin.y, g.size.w, g.size.h, GL_RGBA, GL_UNSIGNED_BYTE, rgba));
+      free(rgba);
+   }
+
    context->fakefb_dirty = true;
 }
 
+static void
+exports_release(struct ctx *context)
+{
+   assert(context);
+
+   for (uint32_t i = 0; i < EXPORT_BUFFERS; ++i) {
+      struct export *e = &context->exports.buffers[i];
+
+      for (uint32_t p = 0; p < e->attributes.num_planes; ++p) {
+         if (e->attributes.fd[p] >= 0)
+            close(e->attributes.fd[p]);
+      }
+
+      if (e->image)
+         wlc_context_destroy_image(&context->bound, e->image);
+
+      if (e->texture) {
+         GL_CALL(glDeleteTextures(1, &e->texture));
+      }
+
+      memset(e, 0, sizeof(struct export));
+   }
+
+   context->exports.size = (struct wlc_size){ 0, 0 };
+   context->exports.next = 0;
+}
+
+static bool
+exports_create(struct ctx *context, const struct wlc_size *size)
+{
+   assert(context && size);
+
+   // Copying from the framebuffer needs matching components, RGB can't be copied to RGBA
+   GLint alpha;
+   GL_CALL(glGetIntegerv(GL_ALPHA_BITS, &alpha));
+   const GLenum format = (alpha > 0 ? GL_RGBA : GL_RGB);
+
+   for (uint32_t i = 0; i < EXPORT_BUFFERS; ++i) {
+      struct export *e = &context->exports.buffers[i];
+
+      GL_CALL(glGenTextures(1, &e->texture));
+      bind_texture(context, 0, e->texture);
+      GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+      GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, format, size->w, size->h, 0, format, GL_UNSIGNED_BYTE, NULL));
+
+      static const EGLint attribs[] = { EGL_GL_TEXTURE_LEVEL_KHR, 0, EGL_NONE };
+      if (!(e->image = wlc_context_create_image(&context->bound, EGL_GL_TEXTURE_2D_KHR, (EGLClientBuffer)(uintptr_t)e->texture, attribs)))
+         return false;
+
+      if (!wlc_context_export_image(&context->bound, e->image, &e->attributes))
+         return false;
+
+      e->attributes.size = *size;
+      e->attributes.y_invert = true; // copied from GL framebuffer, which is bottom up
+   }
+
+   context->exports.size = *size;
+   return true;
+}
+
+static bool
+export_dmabuf(struct ctx *context, struct wlc_dmabuf_attributes *out_attributes, int32_t *out_fence)
+{
+   assert(context && out_attributes && out_fence);
+
+   if (context->exports.unsupported)
+      return false;
+
+   if (!wlc_size_equals(&context->exports.size, &context->mode)) {
+      exports_release(context);
+
+      if (!exports_create(context, &context->mode)) {
+         wlc_log(WLC_LOG_WARN, "Could not export frame buffers as dmabuf, frame export disabled");
+         exports_release(context);
+         context->exports.unsupported = true;
+         return false;
+      }
+   }
+
+   flush_batch(context);
+
+   struct export *e = &context->exports.buffers[context->exports.next];
+   context->exports.next = (context->exports.next + 1) % EXPORT_BUFFERS;
+
+   bind_texture(context, 0, e->texture);
+   GL_CALL(glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, context->mode.w, context->mode.h));
+
+   *out_attributes = e->attributes;
+   *out_fence = wlc_context_create_fence(&context->bound);
+   return true;
+}
+
+static void
+readback_release(struct ctx *context, struct wlc_readback *readback)
+{
+   assert(context && readback);
+
+   struct readback *rb;
+   if (!(rb = readback->internal))
+      return;
+
+   if (rb->map) {
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo));
+      GL_CALL(context->api.glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+   }
+
+   if (rb->pbo) {
+      GL_CALL(glDeleteBuffers(1, &rb->pbo));
+   }
+
+   if (rb->fence) {
+      GL_CALL(context->api.glDeleteSync(rb->fence));
+   }
+
+   free(rb->data);
+   free(rb);
+   readback->internal = NULL;
+}
+
+static bool
+readback_start(struct ctx *context, struct wlc_readback *readback)
+{
+   assert(context && readback);
+
+   clamp_to_bounds(&readback->geometry, &context->mode);
+   const struct wlc_geometry *g = &readback->geometry;
+
+   if (!g->size.w || !g->size.h)
+      return false;
+
+   struct readback *rb;
+   if (!(rb = calloc(1, sizeof(struct readback))))
+      return false;
+
+   readback->internal = rb;
+   flush_batch(context);
+
+   rb->swizzle = (readback->format != WLC_RGBA8888 && !context->read_bgra);
+   const GLenum format = (rb->swizzle ? GL_RGBA : format_map[readback->format].format);
+   const GLsizeiptr size = g->size.w * g->size.h * 4;
+
+   // Framebuffer origin is at bottom left
+   const GLint y = (GLint)context->mode.h - (g->origin.y + g->size.h);
+
+   if (context->api.glFenceSync) {
+      GL_CALL(glGenBuffers(1, &rb->pbo));
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo));
+      GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ));
+      GL_CALL(glReadPixels(g->origin.x, y, g->size.w, g->size.h, format, GL_UNSIGNED_BYTE, NULL));
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+      rb->fence = GL_CALL(context->api.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+      if (!rb->fence)
+         goto fail;
+   } else {
+      // The frame is already drawn, so this only waits for it to finish
+      if (!(rb->data = malloc(size)))
+         goto fail;
+
+      GL_CALL(glReadPixels(g->origin.x, y, g->size.w, g->size.h, format, GL_UNSIGNED_BYTE, rb->data));
+
+      if (rb->swizzle)
+         swizzle(rb->data, rb->data, g->size.w * g->size.h, false);
+   }
+
+   return true;
+
+fail:
+   readback_release(context, readback);
+   return false;
+}
+
+static bool
+readback_map(struct ctx *context, struct wlc_readback *readback, const void **out_data, int32_t *out_stride)
+{
+   assert(context && readback && out_data && out_stride);
+
+   struct readback *rb;
+   if (!(rb = readback->internal))
+      return true;
+
+   const struct wlc_size *s = &readback->geometry.size;
+   const int32_t stride = s->w * 4;
+
+   if (!rb->data && !rb->map) {
+      // Never blocks, we get called again on next frame
+      const GLenum status = GL_CALL(context->api.glClientWaitSync(rb->fence, 0, 0));
+      if (status == GL_TIMEOUT_EXPIRED)
+         return false;
+
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+         return true;
+
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo));
+      rb->map = GL_CALL(context->api.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, stride * s->h, GL_MAP_READ_BIT));
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+      if (!rb->map)
+         return true;
+
+      if (rb->swizzle) {
+         if (!(rb->data = malloc(stride * s->h)))
+            return true;
+
+         swizzle(rb->data, rb->map, s->w * s->h, false);
+      }
+   }
+
+   // Rows are bottom up, hand out the top row and walk backwards
+   const uint8_t *data = (rb->data ? rb->data : rb->map);
+   *out_data = data + (s->h - 1) * stride;
+   *out_stride = -stride;
+   return true;
+}
+
 static void
 flush_fakefb(struct ctx *context)
 {
@@ -818,7 +2625,7 @@ flush_fakefb(struct ctx *context)
 
    struct paint settings = {0};
    settings.program = PROGRAM_RGBA;
-   texture_paint(context, &context->textures[TEXTURE_FAKEFB], 1, &(struct wlc_geometry){ .origin = { 0, 0 }, .size = context->resolution }, &settings);
+   texture_paint(context, &context->textures[TEXTURE_FAKEFB], &context->filters[TEXTURE_FAKEFB], 1, &(struct wlc_geometry){ .origin = { 0, 0 }, .size = context->resolution }, &settings);
    clear_fakefb(context);
    context->fakefb_dirty = false;
 }
@@ -826,34 +2633,144 @@ flush_fakefb(struct ctx *context)
 static void
 clear(struct ctx *context)
 {
-   (void)context;
    assert(context);
+   flush_batch(context);
+
+   // Copies that finished before their event was dispatched are shown in this frame already
+   uploads_land(context);
    GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
 }
 
+static void
+scissor(struct ctx *context, const struct wlc_geometry *geometry)
+{
+   assert(context);
+
+   // Batched draws must be clipped by the scissor they were submitted with.
+   // This also flushes the frame before swap, as the scissor is reset before it.
+   flush_batch(context);
+
+   if (!geometry) {
+      GL_CALL(glDisable(GL_SCISSOR_TEST));
+      context->scissor = false;
+      return;
+   }
+
+   if (context->resolution.w * context->resolution.h == 0)
+      return;
+
+   // Scissor box is in framebuffer coordinates with origin at bottom left.
+   const float sw = (float)context->mode.w / context->resolution.w;
+   const float sh = (float)context->mode.h / context->resolution.h;
+   const GLint pad = !wlc_size_equals(&context->mode, &context->resolution);
+   const GLint x1 = geometry->origin.x * sw - pad, x2 = (geometry->origin.x + geometry->size.w) * sw + pad;
+   const GLint y1 = geometry->origin.y * sh - pad, y2 = (geometry->origin.y + geometry->size.h) * sh + pad;
+   GL_CALL(glScissor(x1, (GLint)context->mode.h - y2, x2 - x1, y2 - y1));
+
+   if (!context->scissor) {
+      GL_CALL(glEnable(GL_SCISSOR_TEST));
+      context->scissor = true;
+   }
+}
+
+static void
+clip(struct ctx *context, pixman_region32_t *region)
+{
+   assert(context);
+
+   // Only applies to quads added from now on, so the batch doesn't need flushing
+   if (!(context->clip.enabled = (region != NULL)))
+      return;
+
+   pixman_region32_copy(&context->clip.region, region);
+}
+
 static void
 terminate(struct ctx *context)
 {
    assert(context);
 
+   wl_list_remove(&context->link);
+
+   struct upload *upload, *utmp;
+   wl_list_for_each_safe(upload, utmp, &context->uploads, link) {
+      upload_wait(upload, true);
+      upload_free(context, upload);
+   }
+
+   if (wl_list_empty(&contexts))
+      uploader_stop();
+
+   // Surfaces of other outputs in the group may still show our imports, hand them over
+   struct ctx *c, *heir = NULL;
+   wl_list_for_each(c, &contexts, link) {
+      if (shares_objects(context, c)) {
+         heir = c;
+         break;
+      }
+   }
+
+   struct import *import, *tmp;
+   wl_list_for_each_safe(import, tmp, &context->imports, link) {
+      if (heir) {
+         import->context = heir;
+         wl_list_remove(&import->link);
+         wl_list_insert(&heir->imports, &import->link);
+      } else {
+         // Surfaces are destroyed before the renderer, so nothing references these anymore
+         import_free(import, context);
+      }
+   }
+
+   struct atlas *atlas, *atmp;
+   wl_list_for_each_safe(atlas, atmp, &context->atlases, link) {
+      if (heir) {
+         atlas->context = heir;
+         wl_list_remove(&atlas->link);
+         wl_list_insert(heir->atlases.prev, &atlas->link);
+      } else {
+         atlas_free(atlas);
+      }
+   }
+
    for (GLuint i = 0; i < PROGRAM_LAST; ++i) {
       GL_CALL(glDeleteProgram(context->programs[i].obj));
    }
 
+   GL_CALL(glDeleteBuffers(3, (GLuint[]){ context->batch.vbo, context->batch.ibo, context->batch.corners }));
+
+   if (context->batch.vao) {
+      GL_CALL(context->api.glDeleteVertexArrays(1, &context->batch.vao));
+   }
+
+   if (context->staging) {
+      GL_CALL(glDeleteBuffers(1, &context->staging));
+   }
+
+   exports_release(context);
    GL_CALL(glDeleteTextures(TEXTURE_LAST, context->textures));
    GL_CALL(glDeleteFramebuffers(1, &context->clear_fbo));
+   chck_string_release(&context->cache.path);
+   pixman_region32_fini(&context->clip.region);
    free(context);
 }
 
-void*
-wlc_gles2(struct wlc_render_api *api)
+static void*
+create(struct wlc_render_api *api, struct wlc_context *bound, bool gles3)
 {
-   assert(api);
+   assert(api && bound);
+
+   // Software contexts have no GL to draw with
+   if (wlc_context_has_framebuffer(bound))
+      return NULL;
 
    struct ctx *ctx;
-   if (!(ctx = create_context()))
+   if (!(ctx = create_context(bound, gles3)))
       return NULL;
 
+   wl_list_insert(&contexts, &ctx->link);
+
+   // GLES3 context runs everything written for GLES2, don't send compositors down their fallback path
    api->renderer_type = WLC_RENDERER_GLES2;
    api->terminate = terminate;
    api->resolution = resolution;
@@ -866,27 +2783,29 @@ wlc_gles2(struct wlc_render_api *api)
    api->write_pixels = write_pixels;
    api->flush_fakefb = flush_fakefb;
    api->clear = clear;
+   api->scissor = scissor;
+   api->clip = clip;
+   api->readback_start = readback_start;
+   api->readback_map = readback_map;
+   api->readback_release = readback_release;
+   api->export_dmabuf = export_dmabuf;
 
    chck_cstr_to_bool(getenv("WLC_DRAW_OPAQUE"), &DRAW_OPAQUE);
 
-   wlc_log(WLC_LOG_INFO, "GLES2 renderer initialized");
+   wlc_log(WLC_LOG_INFO, "%s renderer initialized", (gles3 ? "GLES3" : "GLES2"));
    return ctx;
 }
 
-// 0 == black, 1 == white, 2 == transparent
-static const GLubyte cursor_palette[] = {
-   0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
-   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
-   0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
-   0x01, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02,
-   0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x01, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
-   0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x01, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
-   0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02
-};
+void*
+wlc_gles3(struct wlc_render_api *api, struct wlc_context *bound)
+{
+   bool enabled = true;
+   chck_cstr_to_bool(getenv("WLC_GLES3"), &enabled);
+   return (enabled ? create(api, bound, true) : NULL);
+}
+
+void*
+wlc_gles2(struct wlc_render_api *api, struct wlc_context *bound)
+{
+   return create(api, bound, false);
+}
@@ -2,7 +2,9 @@
 #define _WLC_GLES2_H_
 
 struct wlc_render_api;
+struct wlc_context;
 
-void* wlc_gles2(struct wlc_render_api *api);
+void* wlc_gles3(struct wlc_render_api *api, struct wlc_context *bound);
+void* wlc_gles2(struct wlc_render_api *api, struct wlc_context *bound);
 
 #endif /* _WLC_GLES2_H_ */
@@ -4,6 +4,7 @@
 #include "platform/context/context.h"
 #include "render.h"
 #include "gles2.h"
+#include "software.h"
 
 void
 wlc_render_resolution(struct wlc_render *render, struct wlc_context *bound, const struct wlc_size *mode, const struct wlc_size *resolution)
@@ -115,6 +116,75 @@ wlc_render_clear(struct wlc_render *render, struct wlc_context *bound)
    render->api.clear(render->render);
 }
 
+void
+wlc_render_scissor(struct wlc_render *render, struct wlc_context *bound, const struct wlc_geometry *geometry)
+{
+   assert(render);
+
+   if (!render->api.scissor || !wlc_context_bind(bound))
+      return;
+
+   render->api.scissor(render->render, geometry);
+}
+
+void
+wlc_render_clip(struct wlc_render *render, struct wlc_context *bound, pixman_region32_t *region)
+{
+   assert(render);
+
+   if (!render->api.clip || !wlc_context_bind(bound))
+      return;
+
+   render->api.clip(render->render, region);
+}
+
+bool
+wlc_render_readback_start(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback)
+{
+   assert(render && bound && readback);
+
+   if (!render->api.readback_start || !wlc_context_bind(bound))
+      return false;
+
+   return render->api.readback_start(render->render, readback);
+}
+
+bool
+wlc_render_readback_map(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback, const void **out_data, int32_t *out_stride)
+{
+   assert(render && bound && readback && out_data && out_stride);
+   *out_data = NULL;
+   *out_stride = 0;
+
+   if (!render->api.readback_map || !wlc_context_bind(bound))
+      return true;
+
+   return render->api.readback_map(render->render, readback, out_data, out_stride);
+}
+
+void
+wlc_render_readback_release(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback)
+{
+   assert(render && bound && readback);
+
+   if (render->api.readback_release && wlc_context_bind(bound))
+      render->api.readback_release(render->render, readback);
+
+   readback->internal = NULL;
+}
+
+bool
+wlc_render_export_dmabuf(struct wlc_render *render, struct wlc_context *bound, struct wlc_dmabuf_attributes *out_attributes, int32_t *out_fence)
+{
+   assert(render && bound && out_attributes && out_fence);
+   *out_fence = -1;
+
+   if (!render->api.export_dmabuf || !wlc_context_bind(bound))
+      return false;
+
+   return render->api.export_dmabuf(render->render, out_attributes, out_fence);
+}
+
 void
 wlc_render_release(struct wlc_render *render, struct wlc_context *bound)
 {
@@ -139,13 +209,16 @@ wlc_render(struct wlc_render *render, struct wlc_context *context)
    if (!wlc_context_bind(context))
       return NULL;
 
-   void* (*constructor[])(struct wlc_render_api*) = {
+   // Pixman is picked when the context has no GL to draw with
+   void* (*constructor[])(struct wlc_render_api*, struct wlc_context*) = {
+      wlc_gles3,
       wlc_gles2,
+      wlc_pixman,
       NULL
    };
 
    for (uint32_t i = 0; constructor[i]; ++i) {
-      if ((render->render = constructor[i](&render->api)))
+      if ((render->render = constructor[i](&render->api, context)))
          return true;
    }
 
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pixman.h>
 #include <wlc/wlc-render.h>
 #include "resources/resources.h"
 
@@ -16,6 +17,13 @@ struct wlc_point;
 struct wlc_geometry;
 struct ctx;
 
+// Asynchronous read of the framebuffer, see wlc_output_read_pixels
+struct wlc_readback {
+   struct wlc_geometry geometry; // framebuffer pixels, top left origin, clamped by the renderer
+   enum wlc_pixel_format format;
+   void *internal; // renderer data (buffer object, fence, copy in memory, etc)
+};
+
 struct wlc_render_api {
    enum wlc_renderer renderer_type;
    WLC_NONULL void (*terminate)(struct ctx *render);
@@ -29,6 +37,12 @@ struct wlc_render_api {
    WLC_NONULL void (*write_pixels)(struct ctx *render, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data);
    WLC_NONULL void (*flush_fakefb)(struct ctx *render);
    WLC_NONULL void (*clear)(struct ctx *render);
+   WLC_NONULLV(1) void (*scissor)(struct ctx *render, const struct wlc_geometry *geometry);
+   WLC_NONULLV(1) void (*clip)(struct ctx *render, pixman_region32_t *region);
+   WLC_NONULL bool (*readback_start)(struct ctx *render, struct wlc_readback *readback);
+   WLC_NONULL bool (*readback_map)(struct ctx *render, struct wlc_readback *readback, const void **out_data, int32_t *out_stride);
+   WLC_NONULL void (*readback_release)(struct ctx *render, struct wlc_readback *readback);
+   WLC_NONULL bool (*export_dmabuf)(struct ctx *render, struct wlc_dmabuf_attributes *out_attributes, int32_t *out_fence);
 };
 
 struct wlc_render {
@@ -39,6 +53,8 @@ struct wlc_render {
 WLC_NONULL void wlc_render_resolution(struct wlc_render *render, struct wlc_context *bound, const struct wlc_size *mode, const struct wlc_size *resolution);
 WLC_NONULL void wlc_render_surface_destroy(struct wlc_render *render, struct wlc_context *bound, struct wlc_surface *surface);
 WLC_NONULLV(1,2,3) bool wlc_render_surface_attach(struct wlc_render *render, struct wlc_context *bound, struct wlc_surface *surface, struct wlc_buffer *buffer);
+// Opaque content is painted without blending: opaque formats, and the committed opaque region when drawn unscaled,
+// as filtering would bleed translucent pixels into it. Black borders are painted only around the visible area.
 WLC_NONULL void wlc_render_view_paint(struct wlc_render *render, struct wlc_context *bound, struct wlc_view *view);
 WLC_NONULL void wlc_render_surface_paint(struct wlc_render *render, struct wlc_context *bound, struct wlc_surface *surface, const struct wlc_geometry *geometry);
 WLC_NONULL void wlc_render_pointer_paint(struct wlc_render *render, struct wlc_context *bound, const struct wlc_point *pos);
@@ -46,6 +62,12 @@ WLC_NONULL void wlc_render_read_pixels(struct wlc_render *render, struct wlc_con
 WLC_NONULL void wlc_render_write_pixels(struct wlc_render *render, struct wlc_context *bound, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data);
 WLC_NONULL void wlc_render_flush_fakefb(struct wlc_render *render, struct wlc_context *bound); // only relevant to GLES2
 WLC_NONULL void wlc_render_clear(struct wlc_render *render, struct wlc_context *bound);
+WLC_NONULLV(1,2) void wlc_render_scissor(struct wlc_render *render, struct wlc_context *bound, const struct wlc_geometry *geometry); // NULL geometry disables scissor, box is rounded outwards on scaled outputs so no stale pixels are left at the edges
+WLC_NONULLV(1,2) void wlc_render_clip(struct wlc_render *render, struct wlc_context *bound, pixman_region32_t *region); // NULL region disables clipping
+WLC_NONULL bool wlc_render_readback_start(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback); // issued after the frame has been drawn
+WLC_NONULL bool wlc_render_readback_map(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback, const void **out_data, int32_t *out_stride); // false while in flight, NULL data on failure
+WLC_NONULL void wlc_render_readback_release(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback);
+WLC_NONULL bool wlc_render_export_dmabuf(struct wlc_render *render, struct wlc_context *bound, struct wlc_dmabuf_attributes *out_attributes, int32_t *out_fence); // fds stay owned by the renderer, fence by the caller
 void wlc_render_release(struct wlc_render *render, struct wlc_context *context);
 WLC_NONULL bool wlc_render(struct wlc_render *render, struct wlc_context *context);
 
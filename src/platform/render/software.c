@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include "internal.h"
+#include "macros.h"
+#include "software.h"
+#include "render.h"
+#include "cursor.h"
+#include "platform/context/context.h"
+#include "compositor/view.h"
+#include "xwayland/xwm.h"
+#include "resources/types/surface.h"
+#include "resources/types/buffer.h"
+
+// Composites wl_shm buffers straight from client memory into the framebuffer of a software context.
+// Surfaces own no renderer state, their committed buffer is wrapped into a pixman image when painted.
+
+struct ctx {
+   struct wlc_context bound;
+   pixman_image_t *fb; // owned by the context
+   pixman_image_t *fakefb;
+   pixman_image_t *cursor;
+   pixman_image_t *black;
+   struct wlc_size mode, resolution;
+
+   // Damaged area in mode coordinates, whole framebuffer when disabled
+   pixman_region32_t scissor;
+
+   // Area not covered by opaque views, in resolution coordinates
+   struct {
+      pixman_region32_t region;
+      bool enabled;
+   } clip;
+
+   bool fakefb_dirty;
+};
+
+static const struct {
+   pixman_format_code_t format;
+   uint32_t bpp;
+} format_map[] = {
+   { PIXMAN_a8b8g8r8, 4 }, // WLC_RGBA8888
+   { PIXMAN_a8r8g8b8, 4 }, // WLC_BGRA8888
+   { PIXMAN_x8r8g8b8, 4 }, // WLC_XRGB8888
+};
+
+WLC_CONST static int32_t
+scale(int32_t v, uint32_t to, uint32_t from)
+{
+   // Rounds towards negative infinity, so edges shared by two rectangles stay shared
+   const int64_t n = (int64_t)v * to;
+   return (n >= 0 ? n / from : -((-n + from - 1) / from));
+}
+
+static void
+region_to_mode(struct ctx *context, pixman_region32_t *region)
+{
+   assert(context && region);
+
+   if (wlc_size_equals(&context->mode, &context->resolution))
+      return;
+
+   pixman_region32_t scaled;
+   pixman_region32_init(&scaled);
+
+   int nrects;
+   pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const int32_t x1 = scale(rects[i].x1, context->mode.w, context->resolution.w), x2 = scale(rects[i].x2, context->mode.w, context->resolution.w);
+      const int32_t y1 = scale(rects[i].y1, context->mode.h, context->resolution.h), y2 = scale(rects[i].y2, context->mode.h, context->resolution.h);
+      pixman_region32_union_rect(&scaled, &scaled, x1, y1, x2 - x1, y2 - y1);
+   }
+
+   pixman_region32_copy(region, &scaled);
+   pixman_region32_fini(&scaled);
+}
+
+static void
+composite(struct ctx *context, pixman_image_t *image, pixman_op_t op, const struct wlc_geometry *geometry, pixman_region32_t *region)
+{
+   assert(context && image && geometry);
+
+   if (!context->fb || context->resolution.w * context->resolution.h == 0)
+      return;
+
+   pixman_region32_t area;
+   pixman_region32_init_rect(&area, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+
+   if (region)
+      pixman_region32_intersect(&area, &area, region);
+
+   if (context->clip.enabled)
+      pixman_region32_intersect(&area, &area, &context->clip.region);
+
+   region_to_mode(context, &area);
+   pixman_region32_intersect(&area, &area, &context->scissor);
+
+   const int32_t x1 = scale(geometry->origin.x, context->mode.w, context->resolution.w);
+   const int32_t y1 = scale(geometry->origin.y, context->mode.h, context->resolution.h);
+   const int32_t x2 = scale(geometry->origin.x + geometry->size.w, context->mode.w, context->resolution.w);
+   const int32_t y2 = scale(geometry->origin.y + geometry->size.h, context->mode.h, context->resolution.h);
+
+   if (!pixman_region32_not_empty(&area) || x2 <= x1 || y2 <= y1)
+      goto out;
+
+   // Solid fills have no size and are never scaled
+   const int32_t w = pixman_image_get_width(image), h = pixman_image_get_height(image);
+   if (w > 0 && h > 0 && (w != x2 - x1 || h != y2 - y1)) {
+      pixman_transform_t transform;
+      pixman_transform_init_scale(&transform, pixman_double_to_fixed((double)w / (x2 - x1)), pixman_double_to_fixed((double)h / (y2 - y1)));
+      pixman_image_set_transform(image, &transform);
+      pixman_image_set_filter(image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+      pixman_image_set_repeat(image, PIXMAN_REPEAT_PAD);
+   } else {
+      pixman_image_set_transform(image, NULL);
+      pixman_image_set_filter(image, PIXMAN_FILTER_NEAREST, NULL, 0);
+      pixman_image_set_repeat(image, PIXMAN_REPEAT_NONE);
+   }
+
+   pixman_image_set_clip_region32(context->fb, &area);
+   pixman_image_composite32(op, image, NULL, context->fb, 0, 0, 0, 0, x1, y1, x2 - x1, y2 - y1);
+   pixman_image_set_clip_region32(context->fb, NULL);
+
+out:
+   pixman_region32_fini(&area);
+}
+
+static void
+resolution(struct ctx *context, const struct wlc_size *mode, const struct wlc_size *resolution)
+{
+   assert(context && mode && resolution);
+
+   if (!wlc_size_equals(&context->resolution, resolution)) {
+      if (context->fakefb)
+         pixman_image_unref(context->fakefb);
+
+      context->fakefb = pixman_image_create_bits(PIXMAN_a8b8g8r8, resolution->w, resolution->h, NULL, 0);
+      context->fakefb_dirty = false;
+      context->resolution = *resolution;
+   }
+
+   context->fb = wlc_context_get_framebuffer(&context->bound, mode);
+
+   if (!wlc_size_equals(&context->mode, mode)) {
+      pixman_region32_fini(&context->scissor);
+      pixman_region32_init_rect(&context->scissor, 0, 0, mode->w, mode->h);
+      context->mode = *mode;
+   }
+}
+
+static pixman_format_code_t
+shm_format(uint32_t format, enum wlc_surface_format surface_format)
+{
+   switch (format) {
+      case WL_SHM_FORMAT_XRGB8888:
+         return PIXMAN_x8r8g8b8;
+      case WL_SHM_FORMAT_ARGB8888:
+         // X11 windows without alpha channel may still send garbage in it
+         return (surface_format == SURFACE_RGB ? PIXMAN_x8r8g8b8 : PIXMAN_a8r8g8b8);
+      case WL_SHM_FORMAT_RGB565:
+         return PIXMAN_r5g6b5;
+      default: break;
+   }
+
+   return 0;
+}
+
+static bool
+surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surface *surface, struct wlc_buffer *buffer)
+{
+   (void)context, (void)bound;
+   assert(context && bound && surface);
+
+   struct wl_resource *wl_buffer;
+   if (!buffer || !(wl_buffer = convert_to_wl_resource(buffer, "buffer")))
+      return true;
+
+   struct wl_shm_buffer *shm_buffer;
+   if (!(shm_buffer = wl_shm_buffer_get(wl_buffer))) {
+      wlc_log(WLC_LOG_WARN, "Software renderer can only composite wl_shm buffers");
+      return false;
+   }
+
+   switch (wl_shm_buffer_get_format(shm_buffer)) {
+      case WL_SHM_FORMAT_XRGB8888:
+      case WL_SHM_FORMAT_RGB565:
+         surface->format = SURFACE_RGB;
+         break;
+      case WL_SHM_FORMAT_ARGB8888:
+         surface->format = SURFACE_RGBA;
+         break;
+      default:
+         /* unknown shm buffer format */
+         return false;
+   }
+
+   buffer->shm_buffer = shm_buffer;
+   buffer->size.w = wl_shm_buffer_get_width(shm_buffer);
+   buffer->size.h = wl_shm_buffer_get_height(shm_buffer);
+
+   struct wlc_view *view;
+   if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
+      wlc_x11_window_set_surface_format(surface, &view->x11);
+
+   // Nothing to upload, the buffer is read when painted
+   pixman_region32_clear(&surface->commit.buffer_damage);
+
+   wlc_dlog(WLC_DBG_RENDER, "-> Attached surface (%" PRIuWLC ") with buffer of size (%ux%u)", convert_to_wlc_resource(surface), buffer->size.w, buffer->size.h);
+   return true;
+}
+
+static void
+surface_paint_internal(struct ctx *context, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible)
+{
+   assert(context && surface && geometry && visible);
+
+   struct wlc_buffer *buffer;
+   if (!(buffer = convert_from_wlc_resource(surface->commit.buffer, "buffer")) || !buffer->shm_buffer)
+      return;
+
+   struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+
+   pixman_format_code_t format;
+   if (!(format = shm_format(wl_shm_buffer_get_format(shm_buffer), surface->format)))
+      return;
+
+   const struct wlc_geometry *g = geometry;
+   if (!wlc_size_equals(&surface->size, &geometry->size) && !wlc_geometry_equals(visible, geometry)) {
+      // black borders are requested
+      pixman_region32_t strips, inner;
+      pixman_region32_init_rect(&strips, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+      pixman_region32_init_rect(&inner, visible->origin.x, visible->origin.y, visible->size.w, visible->size.h);
+      pixman_region32_subtract(&strips, &strips, &inner);
+      pixman_region32_fini(&inner);
+      composite(context, context->black, PIXMAN_OP_SRC, geometry, &strips);
+      pixman_region32_fini(&strips);
+      g = visible;
+   }
+
+   wl_shm_buffer_begin_access(shm_buffer);
+
+   pixman_image_t *image;
+   if (!(image = pixman_image_create_bits(format, wl_shm_buffer_get_width(shm_buffer), wl_shm_buffer_get_height(shm_buffer), wl_shm_buffer_get_data(shm_buffer), wl_shm_buffer_get_stride(shm_buffer))))
+      goto out;
+
+   if (!PIXMAN_FORMAT_A(format)) {
+      composite(context, image, PIXMAN_OP_SRC, g, NULL);
+   } else if (wlc_size_equals(&surface->size, &g->size) && pixman_region32_not_empty(&surface->commit.opaque)) {
+      // Opaque part is copied with PIXMAN_OP_SRC, only the rest is composited
+      pixman_region32_t opaque;
+      pixman_region32_init(&opaque);
+      pixman_region32_copy(&opaque, &surface->commit.opaque);
+      pixman_region32_translate(&opaque, g->origin.x, g->origin.y);
+      composite(context, image, PIXMAN_OP_SRC, g, &opaque);
+
+      pixman_region32_t translucent;
+      pixman_region32_init_rect(&translucent, g->origin.x, g->origin.y, g->size.w, g->size.h);
+      pixman_region32_subtract(&translucent, &translucent, &opaque);
+      composite(context, image, PIXMAN_OP_OVER, g, &translucent);
+      pixman_region32_fini(&translucent);
+      pixman_region32_fini(&opaque);
+   } else {
+      composite(context, image, PIXMAN_OP_OVER, g, NULL);
+   }
+
+   pixman_image_unref(image);
+
+out:
+   wl_shm_buffer_end_access(shm_buffer);
+}
+
+static void
+surface_paint(struct ctx *context, struct wlc_surface *surface, const struct wlc_geometry *geometry)
+{
+   surface_paint_internal(context, surface, geometry, geometry);
+}
+
+static void
+view_paint(struct ctx *context, struct wlc_view *view)
+{
+   assert(context && view);
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wlc_resource(view->surface, "surface")))
+      return;
+
+   struct wlc_geometry geometry, visible;
+   wlc_view_get_bounds(view, &geometry, &visible);
+   surface_paint_internal(context, surface, &geometry, &visible);
+}
+
+static void
+pointer_paint(struct ctx *context, const struct wlc_point *pos)
+{
+   assert(context && pos);
+   struct wlc_geometry g = { *pos, { CURSOR_SIZE, CURSOR_SIZE } };
+   composite(context, context->cursor, PIXMAN_OP_OVER, &g, NULL);
+}
+
+static void
+clamp_to_bounds(struct wlc_geometry *g, const struct wlc_size *bounds)
+{
+   assert(g);
+
+   if (g->origin.x < 0) {
+      g->size.w = (g->size.w > (uint32_t)-g->origin.x ? g->size.w + g->origin.x : 0);
+      g->origin.x = 0;
+   } else if ((uint32_t)g->origin.x > bounds->w) {
+      g->origin.x = bounds->w;
+   }
+
+   if (g->origin.y < 0) {
+      g->size.h = (g->size.h > (uint32_t)-g->origin.y ? g->size.h + g->origin.y : 0);
+      g->origin.y = 0;
+   } else if ((uint32_t)g->origin.y > bounds->h) {
+      g->origin.y = bounds->h;
+   }
+
+   if (g->origin.x + g->size.w > bounds->w)
+      g->size.w = bounds->w - g->origin.x;
+
+   if (g->origin.y + g->size.h > bounds->h)
+      g->size.h = bounds->h - g->origin.y;
+}
+
+static void
+read_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data)
+{
+   assert(context && geometry && out_geometry && out_data);
+   struct wlc_geometry g = *geometry;
+   clamp_to_bounds(&g, &context->resolution);
+   *out_geometry = g;
+
+   if (!context->fb || !g.size.w || !g.size.h)
+      return;
+
+   // Same layout as glReadPixels in GLES2 renderer, origin and first row at the bottom
+   const uint32_t stride = g.size.w * format_map[format].bpp;
+   const int32_t y = (int32_t)pixman_image_get_height(context->fb) - (int32_t)(g.origin.y + g.size.h);
+   for (uint32_t row = 0; row < g.size.h; ++row) {
+      pixman_image_t *line;
+      if (!(line = pixman_image_create_bits(format_map[format].format, g.size.w, 1, (uint32_t*)((uint8_t*)out_data + (g.size.h - 1 - row) * stride), stride)))
+         continue;
+
+      pixman_image_composite32(PIXMAN_OP_SRC, context->fb, NULL, line, g.origin.x, y + row, 0, 0, 0, 0, g.size.w, 1);
+      pixman_image_unref(line);
+   }
+}
+
+static void
+write_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data)
+{
+   assert(context && geometry && data);
+   struct wlc_geometry g = *geometry;
+   clamp_to_bounds(&g, &context->resolution);
+
+   if (!context->fakefb || !g.size.w || !g.size.h)
+      return;
+
+   const uint32_t stride = geometry->size.w * format_map[format].bpp;
+   const uint32_t offset = (g.origin.y - geometry->origin.y) * stride + (g.origin.x - geometry->origin.x) * format_map[format].bpp;
+
+   pixman_image_t *image;
+   if (!(image = pixman_image_create_bits(format_map[format].format, g.size.w, g.size.h, (uint32_t*)((uint8_t*)data + offset), stride)))
+      return;
+
+   pixman_image_composite32(PIXMAN_OP_SRC, image, NULL, context->fakefb, 0, 0, 0, 0, g.origin.x, g.origin.y, g.size.w, g.size.h);
+   pixman_image_unref(image);
+   context->fakefb_dirty = true;
+}
+
+static bool
+readback_start(struct ctx *context, struct wlc_readback *readback)
+{
+   assert(context && readback);
+
+   if (!context->fb)
+      return false;
+
+   const struct wlc_size fb = { pixman_image_get_width(context->fb), pixman_image_get_height(context->fb) };
+   clamp_to_bounds(&readback->geometry, &fb);
+   const struct wlc_geometry *g = &readback->geometry;
+
+   if (!g->size.w || !g->size.h)
+      return false;
+
+   // Framebuffer is in memory and already drawn, copy it out right away
+   pixman_image_t *image;
+   if (!(image = pixman_image_create_bits_no_clear(format_map[readback->format].format, g->size.w, g->size.h, NULL, 0)))
+      return false;
+
+   pixman_image_composite32(PIXMAN_OP_SRC, context->fb, NULL, image, g->origin.x, g->origin.y, 0, 0, 0, 0, g->size.w, g->size.h);
+   readback->internal = image;
+   return true;
+}
+
+static bool
+readback_map(struct ctx *context, struct wlc_readback *readback, const void **out_data, int32_t *out_stride)
+{
+   (void)context;
+   assert(readback && out_data && out_stride);
+
+   if (readback->internal) {
+      *out_data = pixman_image_get_data(readback->internal);
+      *out_stride = pixman_image_get_stride(readback->internal);
+   }
+
+   return true;
+}
+
+static void
+readback_release(struct ctx *context, struct wlc_readback *readback)
+{
+   (void)context;
+   assert(readback);
+
+   if (readback->internal)
+      pixman_image_unref(readback->internal);
+
+   readback->internal = NULL;
+}
+
+static void
+flush_fakefb(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->fakefb_dirty)
+      return;
+
+   composite(context, context->fakefb, PIXMAN_OP_OVER, &(struct wlc_geometry){ .origin = { 0, 0 }, .size = context->resolution }, NULL);
+   pixman_image_composite32(PIXMAN_OP_CLEAR, context->fakefb, NULL, context->fakefb, 0, 0, 0, 0, 0, 0, context->resolution.w, context->resolution.h);
+   context->fakefb_dirty = false;
+}
+
+static void
+clear(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->fb)
+      return;
+
+   int nrects;
+   pixman_box32_t *rects = pixman_region32_rectangles(&context->scissor, &nrects);
+   pixman_image_fill_boxes(PIXMAN_OP_SRC, context->fb, &(pixman_color_t){ 0, 0, 0, 0xffff }, nrects, rects);
+}
+
+static void
+scissor(struct ctx *context, const struct wlc_geometry *geometry)
+{
+   assert(context);
+
+   if (!geometry) {
+      pixman_region32_fini(&context->scissor);
+      pixman_region32_init_rect(&context->scissor, 0, 0, context->mode.w, context->mode.h);
+      return;
+   }
+
+   if (context->resolution.w * context->resolution.h == 0)
+      return;
+
+   // Scissor is kept in mode pixels, composite() clips every draw against it
+   const int32_t pad = !wlc_size_equals(&context->mode, &context->resolution);
+   const int32_t x1 = scale(geometry->origin.x, context->mode.w, context->resolution.w) - pad;
+   const int32_t y1 = scale(geometry->origin.y, context->mode.h, context->resolution.h) - pad;
+   const int32_t x2 = scale(geometry->origin.x + geometry->size.w, context->mode.w, context->resolution.w) + pad;
+   const int32_t y2 = scale(geometry->origin.y + geometry->size.h, context->mode.h, context->resolution.h) + pad;
+   pixman_region32_fini(&context->scissor);
+   pixman_region32_init_rect(&context->scissor, x1, y1, x2 - x1, y2 - y1);
+   pixman_region32_intersect_rect(&context->scissor, &context->scissor, 0, 0, context->mode.w, context->mode.h);
+}
+
+static void
+clip(struct ctx *context, pixman_region32_t *region)
+{
+   assert(context);
+
+   if (!(context->clip.enabled = (region != NULL)))
+      return;
+
+   pixman_region32_copy(&context->clip.region, region);
+}
+
+static void
+terminate(struct ctx *context)
+{
+   assert(context);
+
+   if (context->fakefb)
+      pixman_image_unref(context->fakefb);
+
+   if (context->cursor)
+      pixman_image_unref(context->cursor);
+
+   if (context->black)
+      pixman_image_unref(context->black);
+
+   pixman_region32_fini(&context->scissor);
+   pixman_region32_fini(&context->clip.region);
+   free(context);
+}
+
+static struct ctx*
+create_context(struct wlc_context *bound)
+{
+   assert(bound);
+
+   struct ctx *context;
+   if (!(context = calloc(1, sizeof(struct ctx))))
+      return NULL;
+
+   context->bound = *bound;
+   pixman_region32_init(&context->scissor);
+   pixman_region32_init(&context->clip.region);
+
+   if (!(context->black = pixman_image_create_solid_fill(&(pixman_color_t){ 0, 0, 0, 0xffff })))
+      goto fail;
+
+   if (!(context->cursor = pixman_image_create_bits(PIXMAN_a8r8g8b8, CURSOR_SIZE, CURSOR_SIZE, NULL, 0)))
+      goto fail;
+
+   {
+      uint32_t *pixels = pixman_image_get_data(context->cursor);
+      const uint32_t stride = pixman_image_get_stride(context->cursor) / sizeof(uint32_t);
+      for (uint32_t y = 0; y < CURSOR_SIZE; ++y) {
+         for (uint32_t x = 0; x < CURSOR_SIZE; ++x)
+            pixels[y * stride + x] = cursor_colors[cursor_palette[y * CURSOR_SIZE + x]];
+      }
+   }
+
+   return context;
+
+fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create pixman images");
+   terminate(context);
+   return NULL;
+}
+
+void*
+wlc_pixman(struct wlc_render_api *api, struct wlc_context *bound)
+{
+   assert(api && bound);
+
+   // Draws only to framebuffer in memory
+   if (!wlc_context_has_framebuffer(bound))
+      return NULL;
+
+   struct ctx *ctx;
+   if (!(ctx = create_context(bound)))
+      return NULL;
+
+   api->renderer_type = WLC_RENDERER_PIXMAN;
+   api->terminate = terminate;
+   api->resolution = resolution;
+   api->surface_attach = surface_attach;
+   api->view_paint = view_paint;
+   api->surface_paint = surface_paint;
+   api->pointer_paint = pointer_paint;
+   api->read_pixels = read_pixels;
+   api->write_pixels = write_pixels;
+   api->flush_fakefb = flush_fakefb;
+   api->clear = clear;
+   api->scissor = scissor;
+   api->clip = clip;
+   api->readback_start = readback_start;
+   api->readback_map = readback_map;
+   api->readback_release = readback_release;
+
+   wlc_log(WLC_LOG_INFO, "Pixman renderer initialized");
+   return ctx;
+}
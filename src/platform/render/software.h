@@ -0,0 +1,9 @@
+#ifndef _WLC_SOFTWARE_H_
+#define _WLC_SOFTWARE_H_
+
+struct wlc_render_api;
+struct wlc_context;
+
+void* wlc_pixman(struct wlc_render_api *api, struct wlc_context *bound);
+
+#endif /* _WLC_SOFTWARE_H_ */
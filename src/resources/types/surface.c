@@ -10,6 +10,7 @@
 #include "macros.h"
 #include "compositor/output.h"
 #include "compositor/view.h"
+#include "compositor/presentation.h"
 
 static void
 surface_attach(struct wlc_surface *surface, struct wlc_buffer *buffer)
@@ -46,7 +47,13 @@ state_set_buffer(struct wlc_surface_state *state, struct wlc_buffer *buffer)
 static void
 commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, struct wlc_surface_state *out)
 {
+   // Buffer scale and transform are not supported, so surface and buffer coordinates are the same
+   pixman_region32_union(&pending->damage, &pending->damage, &pending->buffer_damage);
+   pixman_region32_clear(&pending->buffer_damage);
+
    if (pending->attached) {
+      // Renderer uploads only the damaged part of the buffer on attach
+      pixman_region32_union(&out->buffer_damage, &out->buffer_damage, &pending->damage);
       surface_attach(surface, convert_from_wlc_resource(pending->buffer, "buffer"));
       pending->attached = false;
    }
@@ -61,6 +68,12 @@ commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, str
       chck_iter_pool_push_back(&out->frame_cbs, r);
    chck_iter_pool_flush(&pending->frame_cbs);
 
+   // Feedbacks still here were never presented, this commit supersedes their content
+   wlc_presentation_feedback_discard_all(&out->feedbacks);
+   chck_iter_pool_for_each(&pending->feedbacks, r)
+      chck_iter_pool_push_back(&out->feedbacks, r);
+   chck_iter_pool_flush(&pending->feedbacks);
+
    pixman_region32_union(&out->damage, &out->damage, &pending->damage);
    pixman_region32_intersect_rect(&out->damage, &out->damage, 0, 0, surface->size.w, surface->size.h);
    pixman_region32_clear(&surface->pending.damage);
@@ -85,11 +98,14 @@ release_state(struct wlc_surface_state *state)
 
    pixman_region32_fini(&state->opaque);
    pixman_region32_fini(&state->damage);
+   pixman_region32_fini(&state->buffer_damage);
    pixman_region32_fini(&state->input);
 
    state_set_buffer(state, 0);
    chck_iter_pool_for_each_call(&state->frame_cbs, wlc_resource_release_ptr);
    chck_iter_pool_release(&state->frame_cbs);
+   wlc_presentation_feedback_discard_all(&state->feedbacks);
+   chck_iter_pool_release(&state->feedbacks);
 }
 
 static void
@@ -132,6 +148,19 @@ wl_cb_surface_damage(struct wl_client *client, struct wl_resource *resource, int
    wlc_dlog(WLC_DBG_RENDER, "-> Damage request");
 }
 
+static void
+wl_cb_surface_damage_buffer(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   (void)client;
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wl_resource(resource, "surface")))
+      return;
+
+   pixman_region32_union_rect(&surface->pending.buffer_damage, &surface->pending.buffer_damage, x, y, width, height);
+   wlc_dlog(WLC_DBG_RENDER, "-> Damage buffer request");
+}
+
 static void
 wl_cb_surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback_id)
 {
@@ -368,6 +397,7 @@ wlc_surface_release(struct wlc_surface *surface)
 
    wlc_source_release(&surface->buffers);
    wlc_source_release(&surface->callbacks);
+   wlc_source_release(&surface->feedbacks);
 }
 
 void
@@ -383,11 +413,14 @@ wlc_surface(struct wlc_surface *surface)
    assert(surface);
 
    if (!wlc_source(&surface->buffers, "buffer", wlc_buffer, wlc_buffer_release, 4, sizeof(struct wlc_buffer)) ||
-       !wlc_source(&surface->callbacks, "callback", NULL, NULL, 4, sizeof(struct wlc_resource)))
+       !wlc_source(&surface->callbacks, "callback", NULL, NULL, 4, sizeof(struct wlc_resource)) ||
+       !wlc_source(&surface->feedbacks, "presentation-feedback", NULL, NULL, 4, sizeof(struct wlc_resource)))
       goto fail;
 
    if (!chck_iter_pool(&surface->commit.frame_cbs, 4, 0, sizeof(wlc_resource)) ||
        !chck_iter_pool(&surface->pending.frame_cbs, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&surface->commit.feedbacks, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&surface->pending.feedbacks, 4, 0, sizeof(wlc_resource)) ||
        !chck_iter_pool(&surface->subsurface_list, 4, 0, sizeof(wlc_resource)))
       goto fail;
 
@@ -414,7 +447,8 @@ wlc_surface_implementation(void)
       .set_input_region = wl_cb_surface_set_input_region,
       .commit = wl_cb_surface_commit,
       .set_buffer_transform = wl_cb_surface_set_buffer_transform,
-      .set_buffer_scale = wl_cb_surface_set_buffer_scale
+      .set_buffer_scale = wl_cb_surface_set_buffer_scale,
+      .damage_buffer = wl_cb_surface_damage_buffer,
    };
 
    return &wl_surface_implementation;
@@ -15,9 +15,11 @@ struct wlc_view;
 
 struct wlc_surface_state {
    struct chck_iter_pool frame_cbs;
+   struct chck_iter_pool feedbacks;
    pixman_region32_t opaque;
    pixman_region32_t input;
    pixman_region32_t damage;
+   pixman_region32_t buffer_damage;
    struct wlc_point offset;
    struct wlc_point subsurface_position;
    wlc_resource buffer;
@@ -31,7 +33,7 @@ struct wlc_coordinate_scale {
 };
 
 struct wlc_surface {
-   struct wlc_source buffers, callbacks;
+   struct wlc_source buffers, callbacks, feedbacks;
    struct wlc_surface_state pending;
    struct wlc_surface_state commit;
    struct wlc_size size;
@@ -52,6 +54,9 @@ struct wlc_surface {
    /* Current output the surface is attached to */
    wlc_resource output;
 
+   /* Geometry of the surface on the output when it was last painted, used for damage tracking */
+   struct wlc_geometry painted;
+
    /**
     * "Texture" as we use OpenGL terminology, but can be id to anything.
     * Managed by the renderer.
@@ -59,10 +64,33 @@ struct wlc_surface {
    uint32_t textures[3];
 
    /**
-    * Images, contains hw surfaces that can be anything (For example EGL KHR Images in EGL/gles2 renderer).
+    * Filtering currently set on the textures, so it's only changed when needed.
+    * Managed by the renderer.
+    */
+   uint32_t filters[3];
+
+   /**
+    * Size and format of the texture storage, so it can be reused when they don't change.
+    * Managed by the renderer.
+    */
+   struct {
+      struct wlc_size size;
+      uint32_t format;
+   } storage;
+
+   /**
+    * Imported client buffer the textures belong to, NULL if the surface owns its textures.
+    * (For example cached EGL KHR Images in EGL/gles2 renderer)
+    * Managed by the renderer.
+    */
+   void *import;
+
+   /**
+    * Shared atlas texture the surface is packed into at atlas_origin, NULL if it has its own texture.
     * Managed by the renderer.
     */
-   void *images[3];
+   void *atlas;
+   struct wlc_point atlas_origin;
 
    enum wlc_surface_format format;
 
@@ -95,6 +95,14 @@ wlc_get_time(struct timespec *out_ts)
    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+uint64_t
+wlc_get_time_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 void
 wlc_set_active(bool active)
 {
@@ -300,10 +308,14 @@ wlc_init(void)
    bool privileged = false;
    const bool has_logind = wlc_logind_available();
 
+   // Headless outputs need neither tty, session nor input devices
+   bool headless = false;
+   chck_cstr_to_bool(getenv("WLC_HEADLESS"), &headless);
+
    if (getuid() != geteuid() || getgid() != getegid()) {
       wlc_log(WLC_LOG_INFO, "Doing work on SUID/SGID side and dropping permissions");
       privileged = true;
-   } else if (!x11display && !has_logind && access("/dev/input/event0", R_OK | W_OK) != 0) {
+   } else if (!x11display && !headless && !has_logind && access("/dev/input/event0", R_OK | W_OK) != 0) {
       die("Not running from X11 and no access to /dev/input/event0 or logind unavailable");
    }
 
@@ -312,7 +324,7 @@ wlc_init(void)
 #ifdef HAS_LOGIND
    // Init logind if we are not running as SUID.
    // We need event loop for logind to work, and thus we won't allow it on SUID process.
-   if (!privileged && !x11display && has_logind) {
+   if (!privileged && !x11display && !headless && has_logind) {
       if (!(wlc.display = wl_display_create()))
          die("Failed to create wayland display");
 
@@ -324,7 +336,7 @@ wlc_init(void)
    (void)privileged;
 #endif
 
-   if (!x11display)
+   if (!x11display && !headless)
       wlc_tty_init(vt);
 
    // -- we open tty before dropping permissions
@@ -367,11 +379,11 @@ wlc_init(void)
    if (wl_display_init_shm(wlc.display) != 0)
       die("Failed to init shm");
 
-   if (!wlc_udev_init())
+   if (!headless && !wlc_udev_init())
       die("Failed to init udev");
 
    const char *libinput = getenv("WLC_LIBINPUT");
-   if (!x11display || (libinput && !chck_cstreq(libinput, "0"))) {
+   if (!headless && (!x11display || (libinput && !chck_cstreq(libinput, "0")))) {
       if (!wlc_input_init())
          die("Failed to init input");
    }
@@ -31,6 +31,10 @@ struct client_test {
    struct background *background;
 #endif
 
+#ifdef WLR_SCREENCOPY_UNSTABLE_V1_CLIENT_PROTOCOL_H
+   struct zwlr_screencopy_manager_v1 *screencopy;
+#endif
+
    struct {
       struct wl_surface *surface;
       struct wl_shell_surface *ssurface;
@@ -273,6 +277,10 @@ handle_global(void *data, struct wl_registry *registry, uint32_t name, const cha
 #ifdef BACKGROUND_CLIENT_PROTOCOL_H
    } else if (chck_cstreq(interface, "background")) {
       assert((test->background = wl_registry_bind(registry, name, &background_interface, 1)));
+#endif
+#ifdef WLR_SCREENCOPY_UNSTABLE_V1_CLIENT_PROTOCOL_H
+   } else if (chck_cstreq(interface, "zwlr_screencopy_manager_v1")) {
+      assert((test->screencopy = wl_registry_bind(registry, name, &zwlr_screencopy_manager_v1_interface, 2)));
 #endif
    }
 }
@@ -394,6 +402,7 @@ compositor_test_create(struct compositor_test *test, const char *name)
    test->name = name;
    wlc_log_set_handler(cb_log);
    setup_signals(compositor_sigterm);
+   setenv("WLC_HEADLESS", "1", false);
    assert(wlc_init());
 }
 
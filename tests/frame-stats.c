@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wlc/wlc.h>
+#include "compositor/output.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+static void
+assert_timing(const struct wlc_frame_timing *timing, uint64_t min, uint64_t median, uint64_t p90, uint64_t p99, uint64_t max)
+{
+   assert(timing);
+   assert(timing->min == min);
+   assert(timing->median == median);
+   assert(timing->p90 == p90);
+   assert(timing->p99 == p99);
+   assert(timing->max == max);
+}
+
+int
+main(void)
+{
+   struct wlc_output_frame_stats stats;
+
+   // TEST: Missing output
+   {
+      memset(&stats, 0xff, sizeof(stats));
+      assert(!wlc_output_get_frame_stats_ptr(NULL, &stats));
+      assert(stats.frames == 0 && stats.missed == 0);
+      assert_timing(&stats.repaint, 0, 0, 0, 0, 0);
+   }
+
+   struct wlc_output *output;
+   assert((output = calloc(1, sizeof(struct wlc_output))));
+
+   // TEST: No frames presented yet
+   {
+      memset(&stats, 0xff, sizeof(stats));
+      assert(wlc_output_get_frame_stats_ptr(output, &stats));
+      assert(stats.frames == 0 && stats.missed == 0);
+      assert_timing(&stats.repaint, 0, 0, 0, 0, 0);
+      assert_timing(&stats.swap, 0, 0, 0, 0, 0);
+      assert_timing(&stats.flip, 0, 0, 0, 0, 0);
+   }
+
+   // TEST: Single frame is every percentile
+   {
+      output->stats.repaint[0] = 5;
+      output->stats.swap[0] = 7;
+      output->stats.flip[0] = 11;
+      output->stats.frames = 1;
+      output->stats.missed = 2;
+      assert(wlc_output_get_frame_stats_ptr(output, &stats));
+      assert(stats.frames == 1 && stats.missed == 2);
+      assert_timing(&stats.repaint, 5, 5, 5, 5, 5);
+      assert_timing(&stats.swap, 7, 7, 7, 7, 7);
+      assert_timing(&stats.flip, 11, 11, 11, 11, 11);
+   }
+
+   // TEST: Percentiles are nearest rank, whatever the order in the ring buffer
+   {
+      for (uint32_t i = 0; i < 100; ++i) {
+         output->stats.repaint[i] = ((i * 37) % 100 + 1) * 1000;
+         output->stats.swap[i] = 100 - i;
+         output->stats.flip[i] = 42;
+      }
+
+      output->stats.frames = 100;
+      assert(wlc_output_get_frame_stats_ptr(output, &stats));
+      assert(stats.frames == 100);
+      assert_timing(&stats.repaint, 1000, 50000, 90000, 99000, 100000);
+      assert_timing(&stats.swap, 1, 50, 90, 99, 100);
+      assert_timing(&stats.flip, 42, 42, 42, 42, 42);
+
+      // Samples are sorted on a copy
+      assert(output->stats.repaint[0] == 1000 && output->stats.repaint[1] == 38000);
+      assert(output->stats.swap[0] == 100);
+   }
+
+   // TEST: Full history
+   {
+      for (uint32_t i = 0; i < OUTPUT_FRAME_STATS_HISTORY; ++i)
+         output->stats.repaint[i] = OUTPUT_FRAME_STATS_HISTORY - i;
+
+      output->stats.frames = OUTPUT_FRAME_STATS_HISTORY;
+      assert(wlc_output_get_frame_stats_ptr(output, &stats));
+
+      const uint64_t n = OUTPUT_FRAME_STATS_HISTORY;
+      assert_timing(&stats.repaint, 1, (n - 1) / 2 + 1, (n - 1) * 90 / 100 + 1, (n - 1) * 99 / 100 + 1, n);
+   }
+
+   free(output);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+#include "client.h"
+#include <wlc/wlc-render.h>
+
+static struct compositor_test compositor;
+static wlc_handle test_view;
+
+// Left half is opaque, right half is translucent and blended over the cleared (black) output
+static const uint32_t opaque_argb = 0xff204080, translucent_argb = 0x80102040;
+static const uint8_t opaque_rgba[4] = { 0x20, 0x40, 0x80, 0xff };
+static const uint8_t translucent_rgba[4] = { 0x10, 0x20, 0x40, 0xff };
+static const uint8_t background_rgba[4] = { 0x00, 0x00, 0x00, 0xff };
+
+// Pixels read back on the last frame the view was drawn
+static struct {
+   uint8_t opaque[4], translucent[4], background[4];
+   uint32_t frames;
+} readback;
+
+static void
+handle_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+   (void)time;
+   bool *done;
+   assert((done = data));
+   *done = true;
+   wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener frame_listener = {
+   .done = handle_frame_done,
+};
+
+static int
+client_main(void)
+{
+   struct client_test client;
+   client_test_create(&client, "pixman", 64, 64);
+   surface_create(&client);
+   shell_surface_create(&client);
+   client_test_roundtrip(&client);
+
+   uint32_t *pixels = client.buffer.data;
+   for (size_t y = 0; y < client.view.height; ++y) {
+      for (size_t x = 0; x < client.view.width; ++x)
+         pixels[y * client.view.width + x] = (x < client.view.width / 2 ? opaque_argb : translucent_argb);
+   }
+
+   bool done = false;
+   struct wl_callback *callback;
+   assert((callback = wl_surface_frame(client.view.surface)));
+   wl_callback_add_listener(callback, &frame_listener, &done);
+   wl_surface_attach(client.view.surface, client.buffer.wbuf, 0, 0);
+   wl_surface_damage(client.view.surface, 0, 0, client.view.width, client.view.height);
+   wl_surface_commit(client.view.surface);
+
+   // Frame with the new contents has been drawn once the callback is done
+   while (!done)
+      assert(wl_display_dispatch(client.display) != -1);
+
+   return client_test_end(&client);
+}
+
+static void
+read_pixel(wlc_handle output, int32_t x, int32_t y, uint8_t out_rgba[4])
+{
+   // Rows are counted from the bottom, as with glReadPixels
+   const struct wlc_size *resolution = wlc_output_get_resolution(output);
+   struct wlc_geometry g;
+   wlc_pixels_read(WLC_RGBA8888, &(struct wlc_geometry){ { x, resolution->h - 1 - y }, { 1, 1 } }, &g, out_rgba);
+   assert(g.size.w == 1 && g.size.h == 1);
+}
+
+static void
+output_render_post(wlc_handle output)
+{
+   if (!test_view || wlc_view_get_output(test_view) != output)
+      return;
+
+   assert(wlc_output_get_renderer(output) == WLC_RENDERER_PIXMAN);
+   read_pixel(output, 16, 32, readback.opaque);
+   read_pixel(output, 48, 32, readback.translucent);
+   read_pixel(output, 128, 32, readback.background);
+   readback.frames++;
+}
+
+static bool
+view_created(wlc_handle view)
+{
+   wlc_view_set_geometry(view, 0, &(struct wlc_geometry){ wlc_origin_zero, { 64, 64 } });
+   wlc_view_set_mask(view, wlc_output_get_mask(wlc_view_get_output(view)));
+   wlc_view_bring_to_front(view);
+   test_view = view;
+   return true;
+}
+
+static void
+view_destroyed(wlc_handle view)
+{
+   if (view == test_view)
+      test_view = 0;
+}
+
+static void
+compositor_ready(void)
+{
+   // Keep the cursor away from the pixels read back
+   wlc_pointer_set_position(&(struct wlc_point){ 512, 512 });
+   compositor_test_fork_client(&compositor, client_main);
+}
+
+static int
+compositor_main(void)
+{
+   wlc_set_view_created_cb(view_created);
+   wlc_set_view_destroyed_cb(view_destroyed);
+   wlc_set_output_render_post_cb(output_render_post);
+   wlc_set_compositor_ready_cb(compositor_ready);
+
+   setenv("WLC_PIXMAN", "1", true);
+   compositor_test_create(&compositor, "pixman");
+   wlc_run();
+
+   // TEST: Composited output matches the committed buffer
+   {
+      assert(readback.frames > 0);
+      assert(!memcmp(readback.opaque, opaque_rgba, sizeof(opaque_rgba)));
+      assert(!memcmp(readback.translucent, translucent_rgba, sizeof(translucent_rgba)));
+      assert(!memcmp(readback.background, background_rgba, sizeof(background_rgba)));
+   }
+
+   return compositor_test_end(&compositor);
+}
+
+int
+main(void)
+{
+   return compositor_main();
+}
@@ -0,0 +1,328 @@
+#include "wayland-wlr-screencopy-unstable-v1-client-protocol.h"
+#include "client.h"
+#include <chck/math/math.h>
+#include <wlc/wlc-render.h>
+
+static struct compositor_test compositor;
+
+// Written under the views every frame, so copies have something known to compare against
+static const uint8_t background[4] = { 0x33, 0x66, 0x99, 0xff };
+static const uint32_t background_xrgb = 0x336699;
+
+struct frame {
+   struct zwlr_screencopy_frame_v1 *frame;
+   struct wl_buffer *buffer;
+   uint32_t *data;
+   uint32_t format, width, height, stride, flags;
+   int32_t x1, y1, x2, y2; // extents of the damage events
+   uint32_t damaged;
+   bool ready, failed;
+};
+
+static void
+handle_buffer(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format, uint32_t width, uint32_t height, uint32_t stride)
+{
+   struct frame *f;
+   assert((f = data) && frame);
+   f->format = format;
+   f->width = width;
+   f->height = height;
+   f->stride = stride;
+}
+
+static void
+handle_flags(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t flags)
+{
+   struct frame *f;
+   assert((f = data) && frame);
+   f->flags = flags;
+}
+
+static void
+handle_ready(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+   struct frame *f;
+   assert((f = data) && frame);
+   assert((tv_sec_hi || tv_sec_lo || tv_nsec) && tv_nsec < 1000000000);
+   f->ready = true;
+}
+
+static void
+handle_failed(void *data, struct zwlr_screencopy_frame_v1 *frame)
+{
+   struct frame *f;
+   assert((f = data) && frame);
+   f->failed = true;
+}
+
+static void
+handle_damage(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+   struct frame *f;
+   assert((f = data) && frame);
+   assert(!f->ready && width > 0 && height > 0);
+   assert(x + width <= f->width && y + height <= f->height);
+
+   if (!f->damaged++) {
+      f->x1 = x, f->y1 = y, f->x2 = x + width, f->y2 = y + height;
+   } else {
+      f->x1 = chck_min32(f->x1, (int32_t)x), f->y1 = chck_min32(f->y1, (int32_t)y);
+      f->x2 = chck_max32(f->x2, (int32_t)(x + width)), f->y2 = chck_max32(f->y2, (int32_t)(y + height));
+   }
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+   .buffer = handle_buffer,
+   .flags = handle_flags,
+   .ready = handle_ready,
+   .failed = handle_failed,
+   .damage = handle_damage,
+};
+
+static struct wl_buffer*
+create_buffer(struct client_test *client, uint32_t width, uint32_t height, uint32_t stride, uint32_t format, uint32_t **out_data)
+{
+   assert(client);
+
+   int fd;
+   const size_t size = (size_t)stride * height;
+   assert((fd = os_create_anonymous_file(size)) >= 0);
+
+   void *data;
+   assert((data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED);
+
+   struct wl_shm_pool *pool;
+   struct wl_buffer *buffer;
+   assert((pool = wl_shm_create_pool(client->shm, fd, size)));
+   assert((buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format)));
+   wl_shm_pool_destroy(pool);
+   close(fd);
+
+   if (out_data)
+      *out_data = data;
+
+   return buffer;
+}
+
+static struct output*
+first_output(struct client_test *client, struct mode *out_mode)
+{
+   assert(client && out_mode);
+
+   struct output *o;
+   assert((o = chck_iter_pool_get(&client->outputs, 0)));
+
+   struct mode *m;
+   chck_iter_pool_for_each(&o->modes, m) {
+      if (m->flags & WL_OUTPUT_MODE_CURRENT) {
+         *out_mode = *m;
+         return o;
+      }
+   }
+
+   assert(0 && "output has no current mode");
+   return NULL;
+}
+
+static void
+capture(struct client_test *client, struct frame *frame, struct wl_output *output, const struct wlc_geometry *region)
+{
+   assert(client && client->screencopy && frame && output);
+   memset(frame, 0, sizeof(struct frame));
+
+   if (region) {
+      assert((frame->frame = zwlr_screencopy_manager_v1_capture_output_region(client->screencopy, 0, output, region->origin.x, region->origin.y, region->size.w, region->size.h)));
+   } else {
+      assert((frame->frame = zwlr_screencopy_manager_v1_capture_output(client->screencopy, 0, output)));
+   }
+
+   zwlr_screencopy_frame_v1_add_listener(frame->frame, &frame_listener, frame);
+   assert(wl_display_roundtrip(client->display) != -1);
+   assert(!frame->failed && frame->format == WL_SHM_FORMAT_XRGB8888 && frame->stride >= frame->width * 4);
+}
+
+static void
+copy(struct client_test *client, struct frame *frame, bool with_damage)
+{
+   assert(client && frame && frame->frame);
+   frame->buffer = create_buffer(client, frame->width, frame->height, frame->stride, frame->format, &frame->data);
+
+   if (with_damage) {
+      zwlr_screencopy_frame_v1_copy_with_damage(frame->frame, frame->buffer);
+   } else {
+      zwlr_screencopy_frame_v1_copy(frame->frame, frame->buffer);
+   }
+
+   while (!frame->ready && !frame->failed)
+      assert(wl_display_dispatch(client->display) != -1);
+
+   assert(frame->ready && !frame->failed && !frame->flags);
+}
+
+static void
+frame_destroy(struct frame *frame)
+{
+   assert(frame);
+   zwlr_screencopy_frame_v1_destroy(frame->frame);
+
+   if (frame->buffer) {
+      munmap(frame->data, (size_t)frame->stride * frame->height);
+      wl_buffer_destroy(frame->buffer);
+   }
+
+   memset(frame, 0, sizeof(struct frame));
+}
+
+static void
+expect_copy_error(uint32_t width_pad, uint32_t format, bool twice, uint32_t error)
+{
+   // Protocol errors are fatal to the connection, so each one gets its own
+   struct client_test client;
+   client_test_create(&client, "screencopy", 320, 320);
+   assert(client.screencopy);
+
+   struct mode mode;
+   struct frame frame;
+   capture(&client, &frame, first_output(&client, &mode)->output, NULL);
+
+   const uint32_t width = frame.width + width_pad;
+   struct wl_buffer *buffer = create_buffer(&client, width, frame.height, width * 4, format, NULL);
+   zwlr_screencopy_frame_v1_copy(frame.frame, buffer);
+
+   if (twice)
+      zwlr_screencopy_frame_v1_copy(frame.frame, buffer);
+
+   assert(wl_display_roundtrip(client.display) == -1);
+
+   uint32_t id;
+   const struct wl_interface *interface;
+   assert(wl_display_get_protocol_error(client.display, &interface, &id) == error);
+   assert(interface == &zwlr_screencopy_frame_v1_interface);
+   wl_display_disconnect(client.display);
+}
+
+static int
+client_main(void)
+{
+   struct client_test client;
+   client_test_create(&client, "screencopy", 320, 320);
+   assert(client.screencopy);
+   surface_create(&client);
+   shell_surface_create(&client);
+   client_test_roundtrip(&client);
+
+   struct mode mode;
+   struct output *o = first_output(&client, &mode);
+   assert(mode.width >= (int32_t)client.view.width + 32 && mode.height >= 16);
+
+   struct frame frame;
+
+   // TEST: Whole output is copied, background outside of the view
+   {
+      capture(&client, &frame, o->output, NULL);
+      assert(frame.width == (uint32_t)mode.width && frame.height == (uint32_t)mode.height);
+      copy(&client, &frame, false);
+      assert(!frame.damaged);
+      assert((frame.data[(frame.height - 1) * frame.stride / 4 + frame.width - 1] & 0xffffff) == background_xrgb);
+      frame_destroy(&frame);
+   }
+
+   // TEST: Region is captured in output pixels
+   {
+      capture(&client, &frame, o->output, &(struct wlc_geometry){ { mode.width - 32, 8 }, { 32, 16 } });
+      assert(frame.width == 32 && frame.height == 16);
+      copy(&client, &frame, false);
+      assert((frame.data[0] & 0xffffff) == background_xrgb);
+      frame_destroy(&frame);
+   }
+
+   // TEST: First copy with damage reports the whole frame as damaged
+   {
+      capture(&client, &frame, o->output, NULL);
+      copy(&client, &frame, true);
+      assert(frame.damaged);
+      assert(frame.x1 == 0 && frame.y1 == 0 && frame.x2 == mode.width && frame.y2 == mode.height);
+      frame_destroy(&frame);
+   }
+
+   // TEST: Next copy with damage waits for damage, and reports only what changed
+   {
+      memset(client.buffer.data, 128, client.view.width * client.view.height * 4);
+      wl_surface_attach(client.view.surface, client.buffer.wbuf, 0, 0);
+      wl_surface_damage(client.view.surface, 16, 16, 8, 8);
+      wl_surface_commit(client.view.surface);
+
+      capture(&client, &frame, o->output, NULL);
+      copy(&client, &frame, true);
+      assert(frame.damaged);
+      assert(frame.x1 <= 16 && frame.y1 <= 16 && frame.x2 >= 24 && frame.y2 >= 24);
+      assert(frame.x2 - frame.x1 < mode.width || frame.y2 - frame.y1 < mode.height);
+      frame_destroy(&frame);
+   }
+
+   // TEST: Buffers that don't match the buffer event, or copying twice, are protocol errors
+   {
+      expect_copy_error(1, WL_SHM_FORMAT_XRGB8888, false, ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER);
+      expect_copy_error(0, WL_SHM_FORMAT_XRGB8888, true, ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED);
+
+      bool *rgb565;
+      if ((rgb565 = chck_hash_table_get(&client.formats, WL_SHM_FORMAT_RGB565)) && *rgb565)
+         expect_copy_error(0, WL_SHM_FORMAT_RGB565, false, ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER);
+   }
+
+   return client_test_end(&client);
+}
+
+static bool
+view_created(wlc_handle view)
+{
+   // Known place for the client's damage
+   wlc_view_set_geometry(view, 0, &(struct wlc_geometry){ wlc_origin_zero, { 320, 320 } });
+   wlc_view_set_mask(view, wlc_output_get_mask(wlc_view_get_output(view)));
+   wlc_view_bring_to_front(view);
+   return true;
+}
+
+static void
+output_render_pre(wlc_handle output)
+{
+   static uint8_t *data;
+   static size_t size;
+
+   const struct wlc_size *resolution = wlc_output_get_resolution(output);
+   const size_t needed = (size_t)resolution->w * resolution->h * 4;
+
+   if (size < needed) {
+      assert((data = realloc(data, needed)));
+      for (size_t i = 0; i < needed; i += 4)
+         memcpy(data + i, background, sizeof(background));
+      size = needed;
+   }
+
+   wlc_pixels_write(WLC_RGBA8888, &(struct wlc_geometry){ wlc_origin_zero, *resolution }, data);
+}
+
+static void
+compositor_ready(void)
+{
+   // XXX: Same fork caveats as in wl-extension test
+   compositor_test_fork_client(&compositor, client_main);
+}
+
+static int
+compositor_main(void)
+{
+   wlc_set_view_created_cb(view_created);
+   wlc_set_output_render_pre_cb(output_render_pre);
+   wlc_set_compositor_ready_cb(compositor_ready);
+
+   compositor_test_create(&compositor, "screencopy");
+   wlc_run();
+   return compositor_test_end(&compositor);
+}
+
+int
+main(void)
+{
+   return compositor_main();
+}
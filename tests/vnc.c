@@ -0,0 +1,148 @@
+#include "client.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static struct compositor_test compositor;
+
+// Written before the fork, so the client knows where to connect and what to expect
+static char path[108];
+static struct wlc_size expected;
+
+static void
+read_all(int fd, void *data, size_t size)
+{
+   for (size_t off = 0; off < size;) {
+      const ssize_t ret = read(fd, (uint8_t*)data + off, size - off);
+      assert(ret > 0);
+      off += ret;
+   }
+}
+
+static void
+write_all(int fd, const void *data, size_t size)
+{
+   for (size_t off = 0; off < size;) {
+      const ssize_t ret = write(fd, (const uint8_t*)data + off, size - off);
+      assert(ret > 0);
+      off += ret;
+   }
+}
+
+static uint16_t
+get_u16(const uint8_t *p)
+{
+   return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get_u32(const uint8_t *p)
+{
+   return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int
+client_main(void)
+{
+   int fd;
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   strcpy(addr.sun_path, path);
+   assert((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+   assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+   uint8_t msg[24];
+
+   // TEST: Version and security handshake of RFB 3.8
+   {
+      read_all(fd, msg, 12);
+      assert(!memcmp(msg, "RFB 003.008\n", 12));
+      write_all(fd, "RFB 003.008\n", 12);
+
+      // Only security type is None
+      read_all(fd, msg, 2);
+      assert(msg[0] == 1 && msg[1] == 1);
+      write_all(fd, (uint8_t[]){ 1 }, 1);
+
+      read_all(fd, msg, 4);
+      assert(get_u32(msg) == 0);
+   }
+
+   // TEST: ServerInit describes the output
+   {
+      write_all(fd, (uint8_t[]){ 1 }, 1);
+      read_all(fd, msg, 24);
+      assert(get_u16(msg) == expected.w && get_u16(msg + 2) == expected.h);
+
+      // 32bpp true colour, as the client did not set a pixel format
+      assert(msg[4] == 32 && msg[7] == 1);
+
+      const uint32_t len = get_u32(msg + 20);
+      assert(len > 0 && len < sizeof(msg));
+      read_all(fd, msg, len);
+   }
+
+   // TEST: Non-incremental request is answered with the whole output
+   {
+      uint8_t request[10] = { 3, 0 };
+      request[6] = expected.w >> 8, request[7] = expected.w & 0xff;
+      request[8] = expected.h >> 8, request[9] = expected.h & 0xff;
+      write_all(fd, request, sizeof(request));
+
+      read_all(fd, msg, 4);
+      assert(msg[0] == 0);
+
+      const uint16_t rects = get_u16(msg + 2);
+      assert(rects > 0);
+
+      uint8_t *pixels = NULL;
+      uint64_t area = 0;
+      for (uint16_t i = 0; i < rects; ++i) {
+         read_all(fd, msg, 12);
+         const uint16_t x = get_u16(msg), y = get_u16(msg + 2), w = get_u16(msg + 4), h = get_u16(msg + 6);
+         assert(w > 0 && h > 0 && x + w <= expected.w && y + h <= expected.h);
+         assert(get_u32(msg + 8) == 0);
+
+         // Raw encoding, pixels follow the rectangle
+         assert((pixels = realloc(pixels, (size_t)w * h * 4)));
+         read_all(fd, pixels, (size_t)w * h * 4);
+         area += (uint64_t)w * h;
+      }
+
+      free(pixels);
+      assert(area == (uint64_t)expected.w * expected.h);
+   }
+
+   close(fd);
+   kill(getppid(), SIGUSR2);
+   return EXIT_SUCCESS;
+}
+
+static void
+compositor_ready(void)
+{
+   const struct wlc_size *resolution;
+   assert((resolution = wlc_output_get_resolution(wlc_get_focused_output())));
+   expected = *resolution;
+
+   // XXX: Same fork caveats as in wl-extension test
+   compositor_test_fork_client(&compositor, client_main);
+}
+
+static int
+compositor_main(void)
+{
+   const char *dir = getenv("XDG_RUNTIME_DIR");
+   snprintf(path, sizeof(path), "%s/wlc-vnc-test-%d", (dir ? dir : "/tmp"), getpid());
+   setenv("WLC_VNC", path, true);
+
+   wlc_set_compositor_ready_cb(compositor_ready);
+
+   compositor_test_create(&compositor, "vnc");
+   wlc_run();
+   return compositor_test_end(&compositor);
+}
+
+int
+main(void)
+{
+   return compositor_main();
+}